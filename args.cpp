@@ -0,0 +1,333 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "args.h"
+#include <cstring>
+
+// Known compiler option. The value of an option taking one is either joined or the next argument, the options without
+// value only match exactly.
+struct option_t {
+  const char* name;
+  bool        value;        ///< Takes a value
+  bool        preprocessor; ///< Only the preprocessor uses it
+};
+
+static const option_t options[] = {
+    // Output and language
+    {"-o", true, false},
+    {"-x", true, false},
+
+    // Preprocessor
+    {"-D", true, true},
+    {"-U", true, true},
+    {"-I", true, true},
+    {"-include", true, true},
+    {"-imacros", true, true},
+    {"-isystem", true, true},
+    {"-idirafter", true, true},
+    {"-iquote", true, true},
+    {"-iprefix", true, true},
+    {"-iwithprefix", true, true},
+    {"-iwithprefixbefore", true, true},
+    {"-MF", true, true},
+    {"-MT", true, true},
+    {"-MQ", true, true},
+    {"-Xpreprocessor", true, true},
+    {"-Wp,", true, true},
+    {"-M", false, true},
+    {"-MM", false, true},
+    {"-MD", false, true},
+    {"-MMD", false, true},
+    {"-MP", false, true},
+    {"-MG", false, true},
+    {"-nostdinc", false, true},
+    {"-nostdinc++", false, true},
+    {"-undef", false, true},
+
+    // Compiler, assembler and linker options with a value
+    {"-Xclang", true, false},
+    {"-Xassembler", true, false},
+    {"-Xlinker", true, false},
+    {"-aux-info", true, false},
+    {"-imultilib", true, false},
+    {"-isysroot", true, false},
+    {"--sysroot", true, false},
+    {"-target", true, false},
+    {"-arch", true, false},
+    {"--param", true, false},
+    {"-dumpbase", true, false},
+    {"-dumpdir", true, false},
+    {"-L", true, false},
+    {"-l", true, false},
+    {"-T", true, false},
+    {"-u", true, false},
+    {"-z", true, false},
+};
+
+// Source extensions and their language, used unless -x gives one
+static const struct {
+  const char* extension;
+  const char* language;
+} source_extensions[] = {
+    {".c", "c"},
+    {".cc", "c++"},
+    {".cpp", "c++"},
+    {".cxx", "c++"},
+    {".c++", "c++"},
+    {".C", "c++"},
+};
+
+// Finds the option of the argument, an exact match first and then the longest option with a joined value. Returns
+// nullptr for an unknown option.
+static const option_t* find_option(const std::string& str, bool& joined)
+{
+  const option_t* found  = nullptr;
+  std::size_t     length = 0;
+  for (const option_t& option : options) {
+    std::size_t n = strlen(option.name);
+    if (str.size() == n and str.compare(0, n, option.name) == 0) {
+      joined = false;
+      return &option;
+    }
+    if (option.value and n > length and str.size() > n and str.compare(0, n, option.name) == 0) {
+      found  = &option;
+      length = n;
+    }
+  }
+
+  joined = true;
+  return found;
+}
+
+static const char* get_extension_language(const std::string& str)
+{
+  for (const auto& entry : source_extensions) {
+    std::size_t n = strlen(entry.extension);
+    if (str.size() > n and str.compare(str.size() - n, n, entry.extension) == 0) {
+      return entry.language;
+    }
+  }
+  return nullptr;
+}
+
+// True if some text in a single line is between two of the quotes
+static bool is_quoted(const std::string& str, char quote)
+{
+  bool open = false;
+  for (char c : str) {
+    if (c == '\n' or c == '\r') {
+      open = false;
+    } else if (c == quote) {
+      if (open) {
+        return true;
+      }
+      open = true;
+    }
+  }
+  return false;
+}
+
+swarm::args::args(int argc, char** argv)
+{
+  // Allocate arguments
+  list.reserve(argc);
+
+  // For each param...
+  for (std::size_t i = 1; i < (std::size_t)argc; i++) {
+    // Check argument pointer is valid
+    SWARM_ASSERT(argv[i] != nullptr, "Argument %d is invalid", (int)i);
+
+    // Convert argument to C++ string
+    std::string str = std::string(argv[i]);
+
+    // Find single quoted text
+    if (is_quoted(str, '\'')) {
+      std::size_t open_quote_pos = str.find_first_of('\'');
+      str.replace(open_quote_pos, 1, "\"\'");
+
+      std::size_t close_quote_pos = str.find_last_of('\'');
+      str.replace(close_quote_pos, 1, "\'\"");
+    }
+
+    // Find double quoted text
+    if (is_quoted(str, '\"')) {
+      std::size_t open_quote_pos = str.find_first_of('\"');
+      str.replace(open_quote_pos, 1, "\'\"");
+
+      std::size_t close_quote_pos = str.find_last_of('\"');
+      str.replace(close_quote_pos, 1, "\"\'");
+    }
+
+    // Classify and put string in vector
+    push(str);
+  }
+}
+
+void swarm::args::push(const std::string& str)
+{
+  arg_t arg = {str, ARG_INPUT};
+
+  if (list.empty()) {
+    arg.kind = ARG_COMPILER;
+  } else if (expect_value) {
+    // The language applies to the following inputs
+    if (list.back().str == "-x") {
+      language = str;
+    }
+    arg.kind     = ARG_VALUE;
+    expect_value = false;
+  } else if (str.size() > 1 and str.front() == '-') {
+    bool            joined = false;
+    const option_t* option = find_option(str, joined);
+    if (option == nullptr) {
+      arg.kind = ARG_OPTION;
+    } else {
+      if (strcmp(option->name, "-o") == 0) {
+        arg.kind = ARG_OUTPUT;
+      } else {
+        arg.kind = option->preprocessor ? ARG_PREPROCESSOR : ARG_OPTION;
+      }
+      expect_value = option->value and not joined;
+      if (joined and strcmp(option->name, "-x") == 0) {
+        language = str.substr(2);
+      }
+    }
+  } else if (str != "-") {
+    // A source is either in the -x language or has a source extension
+    const char* source = (language.empty() or language == "none") ? get_extension_language(str) : language.c_str();
+    if (source != nullptr and (strcmp(source, "c") == 0 or strcmp(source, "c++") == 0)) {
+      arg.kind = ARG_SOURCE;
+      if (source_language.empty()) {
+        source_language = source;
+      }
+    }
+  }
+
+  list.emplace_back(std::move(arg));
+}
+
+std::vector<swarm::args::arg_t>::iterator swarm::args::erase(std::vector<arg_t>::iterator it)
+{
+  // The separate value goes with its option
+  it = list.erase(it);
+  if (it != list.end() and it->kind == ARG_VALUE) {
+    it = list.erase(it);
+  }
+  return it;
+}
+
+void swarm::args::delete_kind(arg_kind_t kind)
+{
+  for (auto it = list.begin(); it != list.end();) {
+    if (it->kind != kind) {
+      it++;
+      continue;
+    }
+
+    it = erase(it);
+  }
+}
+
+std::string swarm::args::get_command() const
+{
+  std::string ret;
+  for (const arg_t& e : list) {
+    ret += e.str + " ";
+  }
+  return ret;
+}
+
+bool swarm::args::has(const std::string& option) const
+{
+  for (const arg_t& e : list) {
+    if (e.str == option) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string swarm::args::get_value(const std::string& option) const
+{
+  for (std::size_t i = 0; i < list.size(); i++) {
+    if (list[i].str == option) {
+      SWARM_ASSERT(i + 1 < list.size(), "Error, option '%s' needs a value", option.c_str());
+      return list[i + 1].str;
+    }
+  }
+  return "";
+}
+
+std::string swarm::args::get_source() const
+{
+  for (const arg_t& e : list) {
+    if (e.kind == ARG_SOURCE) {
+      return e.str;
+    }
+  }
+  return "";
+}
+
+std::string swarm::args::get_output() const
+{
+  for (std::size_t i = 0; i < list.size(); i++) {
+    if (list[i].kind != ARG_OUTPUT) {
+      continue;
+    }
+    if (list[i].str.size() > 2) {
+      return list[i].str.substr(2);
+    }
+    return (i + 1 < list.size()) ? list[i + 1].str : "";
+  }
+  return "";
+}
+
+void swarm::args::set_source(const std::string& str)
+{
+  for (arg_t& e : list) {
+    if (e.kind == ARG_SOURCE) {
+      e.str = str;
+    }
+  }
+}
+
+void swarm::args::set_output(const std::string& str)
+{
+  for (std::size_t i = 0; i < list.size(); i++) {
+    if (list[i].kind != ARG_OUTPUT) {
+      continue;
+    }
+    if (list[i].str.size() > 2) {
+      list[i].str = "-o" + str;
+    } else if (i + 1 < list.size()) {
+      list[i + 1].str = str;
+    }
+  }
+}
+
+void swarm::args::delete_options(const std::string& prefix)
+{
+  for (auto it = list.begin(); it != list.end();) {
+    bool is_option = (it->kind == ARG_OPTION or it->kind == ARG_PREPROCESSOR or it->kind == ARG_OUTPUT);
+    if (not is_option or it->str.compare(0, prefix.size(), prefix) != 0) {
+      it++;
+      continue;
+    }
+
+    it = erase(it);
+  }
+}
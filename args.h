@@ -19,125 +19,93 @@
 #define SWARM_ARGS_H
 
 #include "config.h"
-#include <regex>
 #include <string>
 #include <vector>
 
 namespace swarm {
+
+// Role of an argument in a GCC or Clang command line
+enum arg_kind_t {
+  ARG_COMPILER     = 0, ///< First argument
+  ARG_OPTION       = 1, ///< Option, its value is either joined or the next argument
+  ARG_PREPROCESSOR = 2, ///< Option only the preprocessor uses, for instance -D, -I or -MF
+  ARG_OUTPUT       = 3, ///< -o
+  ARG_VALUE        = 4, ///< Value of the previous option
+  ARG_SOURCE       = 5, ///< C or C++ source, by its extension or the -x language
+  ARG_INPUT        = 6, ///< Any other input
+};
+
+// Command line classified in a single pass with a table of the known compiler options, the rewrites work on the
+// classification and never parse the arguments again. The tools use it too for their own options.
 class args
 {
 private:
-  std::vector<std::string> list = {};
+  struct arg_t {
+    std::string str;
+    arg_kind_t  kind;
+  };
+
+  std::vector<arg_t> list;
+  bool               expect_value = false; ///< The next argument is the value of the last option
+  std::string        language;             ///< Language given with -x, empty for the extension
+  std::string        source_language;      ///< Language of the first source, "c" or "c++"
+
+  // Classifies the argument from the previous ones and appends it
+  void push(const std::string& str);
+
+  // Deletes the argument together with its separate value, returns the following argument
+  std::vector<arg_t>::iterator erase(std::vector<arg_t>::iterator it);
+
+  // Deletes the arguments of the kind
+  void delete_kind(arg_kind_t kind);
 
 public:
   // Argument parse constructor
-  args(int argc, char** argv)
-  {
-    std::regex regex_double_quote("(\".*\")");
-    std::regex regex_single_quote("(\'.*\')");
+  args(int argc, char** argv);
 
-    // Allocate arguments
-    list.resize(argc - 1);
+  // Get command
+  std::string get_command() const;
 
-    // For each param...
-    for (std::size_t i = 1; i < (std::size_t)argc; i++) {
-      // Check argument pointer is valid
-      SWARM_ASSERT(argv[i] != nullptr, "Argument %d is invalid", (int)i);
+  // Number of arguments, the compiler included
+  std::size_t        size() const { return list.size(); }
+  const std::string& at(std::size_t i) const { return list.at(i).str; }
+  arg_kind_t         kind(std::size_t i) const { return list.at(i).kind; }
 
-      // Convert argument to C++ string
-      std::string str = std::string(argv[i]);
+  std::string get_first_param() const { return list.front().str; }
+  std::string get_last_param() const { return list.back().str; }
+  void        append(const std::string& str) { push(str); }
 
-      // Find single quoted text
-      std::smatch m;
-      if (std::regex_search(str, m, regex_single_quote)) {
-        std::size_t open_quote_pos = str.find_first_of('\'');
-        str.replace(open_quote_pos, 1, "\"\'");
+  // True if some argument is exactly the option
+  bool has(const std::string& option) const;
 
-        std::size_t close_quote_pos = str.find_last_of('\'');
-        str.replace(close_quote_pos, 1, "\'\"");
-      }
+  // Argument following the first occurrence of the option, empty if the option is not given
+  std::string get_value(const std::string& option) const;
 
-      // Find double quoted text
-      if (std::regex_search(str, m, regex_double_quote)) {
-        std::size_t open_quote_pos = str.find_first_of('\"');
-        str.replace(open_quote_pos, 1, "\'\"");
+  // First C or C++ source, empty if there is none
+  std::string get_source() const;
 
-        std::size_t close_quote_pos = str.find_last_of('\"');
-        str.replace(close_quote_pos, 1, "\"\'");
-      }
+  // Language of the first source, "c" or "c++", empty if there is none
+  const std::string& get_source_language() const { return source_language; }
 
-      // Put string in vector
-      list[i - 1] = str;
-    }
-  }
+  // Output given with -o, empty if there is none
+  std::string get_output() const;
 
-  // Copy constructor
-  args(const args& other) { list = other.list; }
+  // Replaces every source
+  void set_source(const std::string& str);
 
-  // Get command
-  std::string get_command() const
-  {
-    std::string ret;
-    for (const std::string& e : list) {
-      ret += e + " ";
-    }
-    return ret;
-  }
-
-  void delete_args(const std::string& regexp, std::size_t count = 1)
-  {
-    std::regex  regex(regexp);
-    std::cmatch m;
-
-    // For each argument
-    for (auto it = list.begin(); it != list.end();) {
-      // Try to match regular expression with argument
-      if (not std::regex_search(it->c_str(), m, regex)) {
-        it++;
-        continue;
-      }
-
-      // Delete the matched string and the following count elements
-      for (std::size_t i = 0; i < count and it != list.end(); i++) {
-        list.erase(it);
-      }
-    }
-  }
-
-  std::string get_first_param_match(const std::string& regexp, std::size_t offset = 0) const
-  {
-    std::regex  regex(regexp);
-    std::cmatch m;
-
-    // For each argument
-    for (auto it = list.begin(); it != list.end(); it++) {
-      // Try to match regular expression with argument
-      if (std::regex_search(it->c_str(), m, regex)) {
-        SWARM_ASSERT(it + offset < list.end(), "Error out-of-range after applying offset in get first param match");
-        return *(it + offset);
-      }
-    }
-    return "";
-  }
-
-  std::string get_last_param() const { return list.back(); }
-  void        append(const std::string& str) { list.emplace_back(str); }
-
-  void substitute_all_param_match(const std::string& regexp, const std::string& str, std::size_t offset = 0)
-  {
-    std::regex  regex(regexp);
-    std::cmatch m;
-
-    // For each argument
-    for (auto it = list.begin(); it != list.end(); it++) {
-      // Try to match regular expression with argument
-      if (std::regex_search(it->c_str(), m, regex)) {
-        SWARM_ASSERT(it + offset < list.end(),
-                     "Error out-of-range after applying offset in substitute all parameter match");
-        *(it + offset) = str;
-      }
-    }
-  }
+  // Replaces the output, keeping the option joined if it was
+  void set_output(const std::string& str);
+
+  void delete_sources() { delete_kind(ARG_SOURCE); }
+  void delete_output() { delete_kind(ARG_OUTPUT); }
+
+  // Deletes the options the compilation of a preprocessed source does not need
+  void delete_preprocessor_options() { delete_kind(ARG_PREPROCESSOR); }
+
+  // Deletes the options starting with the prefix, together with their separate values
+  void delete_options(const std::string& prefix);
 };
+
 } // namespace swarm
+
 #endif // SWARM_ARGS_H
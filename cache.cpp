@@ -0,0 +1,410 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "cache.h"
+#include "config.h"
+#include "hash.h"
+#include "string_helpers.h"
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+// Copies a file through a temporary file in the destination directory so readers never see partial files
+static bool copy_file(const std::string& src, const std::string& dst)
+{
+  std::string tmp = dst + ".tmp." + std::to_string(getpid());
+
+  int fd_src = open(src.c_str(), O_RDONLY);
+  if (fd_src < 0) {
+    return false;
+  }
+
+  int fd_dst = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd_dst < 0) {
+    close(fd_src);
+    return false;
+  }
+
+  std::vector<char> buffer(SWARM_SCP_BUFFER_SZ);
+  ssize_t           n  = 0;
+  bool              ok = true;
+  while (ok and (n = read(fd_src, buffer.data(), buffer.size())) > 0) {
+    ok = (write(fd_dst, buffer.data(), n) == n);
+  }
+  ok = ok and (n == 0);
+
+  close(fd_src);
+  ok = (close(fd_dst) == 0) and ok;
+
+  if (not ok or rename(tmp.c_str(), dst.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+class local_cache_impl : public swarm::cache::local
+{
+private:
+  struct entry_t {
+    uint64_t    mtime_ns;
+    uint64_t    size;
+    std::string path;
+  };
+
+  const std::string directory;
+  const uint64_t    max_size;
+
+  std::string get_path(const std::string& key) const
+  {
+    return directory + "/" + key.substr(0, 2) + "/" + key.substr(2);
+  }
+
+  // Applies a modification to the persistent statistics while holding an exclusive lock
+  template <class F>
+  swarm::cache::stats update_stats(F&& modify)
+  {
+    swarm::cache::stats s = {};
+
+    int fd = open((directory + "/stats").c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+      return s;
+    }
+
+    flock(fd, LOCK_EX);
+
+    if (pread(fd, &s, sizeof(s), 0) != sizeof(s)) {
+      s = {};
+    }
+
+    modify(s);
+
+    if (pwrite(fd, &s, sizeof(s), 0) != sizeof(s)) {
+      fprintf(stderr, "Warning: cannot write cache statistics in '%s'\n", directory.c_str());
+    }
+
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    return s;
+  }
+
+  // Removes the least recently used objects until the size goes below the eviction target, returns the new size
+  uint64_t evict()
+  {
+    std::vector<entry_t> entries;
+    uint64_t             total = 0;
+
+    // List all the objects in the two level directory tree
+    DIR* top = opendir(directory.c_str());
+    if (top == nullptr) {
+      return 0;
+    }
+    for (struct dirent* d = readdir(top); d != nullptr; d = readdir(top)) {
+      if (strlen(d->d_name) != 2 or d->d_name[0] == '.') {
+        continue;
+      }
+
+      std::string sub_path = directory + "/" + d->d_name;
+      DIR*        sub      = opendir(sub_path.c_str());
+      if (sub == nullptr) {
+        continue;
+      }
+      for (struct dirent* e = readdir(sub); e != nullptr; e = readdir(sub)) {
+        std::string path = sub_path + "/" + e->d_name;
+        struct stat st   = {};
+        if (e->d_name[0] == '.' or stat(path.c_str(), &st) != 0 or not S_ISREG(st.st_mode)) {
+          continue;
+        }
+        uint64_t mtime_ns = st.st_mtim.tv_sec * 1000000000UL + st.st_mtim.tv_nsec;
+        entries.push_back({mtime_ns, static_cast<uint64_t>(st.st_size), path});
+        total += st.st_size;
+      }
+      closedir(sub);
+    }
+    closedir(top);
+
+    // Oldest first
+    std::sort(entries.begin(), entries.end(), [](const entry_t& a, const entry_t& b) { return a.mtime_ns < b.mtime_ns; });
+
+    uint64_t target = static_cast<uint64_t>(SWARM_CACHE_EVICT_TARGET * static_cast<double>(max_size));
+    for (const entry_t& e : entries) {
+      if (total <= target) {
+        break;
+      }
+      if (unlink(e.path.c_str()) == 0) {
+        total -= e.size;
+      }
+    }
+
+    return total;
+  }
+
+public:
+  local_cache_impl(const std::string& directory_, uint64_t max_size_) : directory(directory_), max_size(max_size_)
+  {
+    std::string mkdir_command = "mkdir -p " + directory;
+    SWARM_ASSERT(system(mkdir_command.c_str()) == 0, "Error creating cache directory '%s'", directory.c_str());
+  }
+
+  bool fetch(const std::string& key, const std::string& path) override
+  {
+    std::string cached = get_path(key);
+    bool        hit    = copy_file(cached, path);
+
+    // Refresh the modification time to keep the least recently used order
+    if (hit) {
+      utimes(cached.c_str(), nullptr);
+    }
+
+    update_stats([hit](swarm::cache::stats& s) {
+      if (hit) {
+        s.hits++;
+      } else {
+        s.misses++;
+      }
+    });
+
+    return hit;
+  }
+
+  void store(const std::string& key, const std::string& path) override
+  {
+    std::string cached = get_path(key);
+
+    // Create the sub-directory, it may exist already
+    mkdir(cached.substr(0, cached.find_last_of('/')).c_str(), S_IRWXU | S_IRWXG | S_IRWXO);
+
+    // An object stored again under the same key replaces the previous one, which is no longer accounted
+    struct stat old_st   = {};
+    uint64_t    old_size = (stat(cached.c_str(), &old_st) == 0) ? static_cast<uint64_t>(old_st.st_size) : 0;
+
+    if (not copy_file(path, cached)) {
+      return;
+    }
+
+    struct stat st = {};
+    if (stat(cached.c_str(), &st) != 0) {
+      return;
+    }
+
+    update_stats([this, &st, old_size](swarm::cache::stats& s) {
+      s.size = (s.size > old_size) ? s.size - old_size : 0;
+      s.size += st.st_size;
+      if (s.size > max_size) {
+        s.size = evict();
+      }
+    });
+  }
+
+  swarm::cache::stats get_stats() override
+  {
+    return update_stats([](swarm::cache::stats&) {});
+  }
+};
+
+class remote_cache_impl : public swarm::cache::remote
+{
+private:
+  swarm::ssh::session_ptr session;
+  const std::string       compiler;
+  const uint64_t          max_size;
+
+  // The objects of every host compiler are kept apart, in the directory named after its identity
+  static std::string get_path(const std::string& key) { return SWARM_REMOTE_CACHE_PATH + "$H/" + key + ".o"; }
+
+  // Shell command setting the variable H to the identity of the host compiler: its version, its target and the hash of
+  // its executable. It fails if the host cannot hash.
+  std::string identity_command() const
+  {
+    std::string cc = swarm::string_helpers::quote(compiler);
+    return "H=$({ " + cc + " -dumpfullversion -dumpmachine; sha256sum < \"$(command -v " + cc +
+           ")\"; } 2>/dev/null | sha256sum 2>/dev/null | cut -c1-64) && [ -n \"$H\" ]";
+  }
+
+  // Removes the least recently used objects of the cache until it fits
+  std::string evict_command() const
+  {
+    uint64_t target = static_cast<uint64_t>(SWARM_CACHE_EVICT_TARGET * static_cast<double>(max_size));
+    return "find " + SWARM_REMOTE_CACHE_PATH +
+           " -type f -printf '%T@ %s %p\\n' 2>/dev/null | sort -n | awk -v max=" + std::to_string(max_size) +
+           " -v target=" + std::to_string(target) +
+           " '{s+=$2; n[NR]=$2; sub(/^[^ ]+ [^ ]+ /, \"\"); p[NR]=$0} END {if (s<=max) exit; "
+           "for (i=1; i<=NR && s>target; i++) {print p[i]; s-=n[i]}}' | xargs -r -d '\\n' rm -f";
+  }
+
+public:
+  remote_cache_impl(swarm::ssh::session_ptr session_, std::string compiler_, uint64_t max_size_) :
+    session(std::move(session_)), compiler(std::move(compiler_)), max_size(max_size_)
+  {
+    // Do nothing
+  }
+
+  bool fetch(const std::string& key, const std::string& local_path) override
+  {
+    SWARM_ASSERT(session != nullptr, "The remote cache has no session");
+
+    // Download through a temporary file so a miss or a failed download never leaves a partial object
+    std::string tmp_path = local_path + ".tmp." + std::to_string(getpid());
+    int         fd       = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+      return false;
+    }
+
+    int status = session->make_channel()->execute(fetch_command(key), fd);
+    close(fd);
+
+    if (status != 0 or rename(tmp_path.c_str(), local_path.c_str()) != 0) {
+      unlink(tmp_path.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+  std::string fetch_command(const std::string& key) override
+  {
+    // Refresh the modification time to keep the least recently used order
+    std::string path = get_path(key);
+    return identity_command() + " && test -f " + path + " && touch " + path + " && cat " + path;
+  }
+
+  std::string store_command(const std::string& key, const std::string& remote_path) override
+  {
+    std::string path = get_path(key);
+    std::string tmp  = path + ".tmp.$$";
+
+    std::string cmd = identity_command() + " && mkdir -p " + SWARM_REMOTE_CACHE_PATH + "$H && cp " + remote_path +
+                      " " + tmp + " && mv -f " + tmp + " " + path;
+
+    // Only a fraction of the stores check the disk usage, the key is uniformly distributed
+    if (key.front() == '$') {
+      cmd += " && { [ $((0x$(printf %.2s " + key + ") % " + std::to_string(SWARM_REMOTE_CACHE_EVICT_RATIO) +
+             ")) -ne 0 ] || " + evict_command() + "; }";
+    } else if (std::stoul(key.substr(0, 2), nullptr, 16) % SWARM_REMOTE_CACHE_EVICT_RATIO == 0) {
+      cmd += " && " + evict_command();
+    }
+
+    return cmd;
+  }
+
+  std::string key_command(const std::string& prefix, const std::string& remote_path) override
+  {
+    // Same hash as make_key, it never fails
+    std::string source_hash = "sha256sum < " + remote_path + " 2>/dev/null | cut -c1-64 | tr -d '\\n'";
+    return "{ K=$({ printf %s " + swarm::string_helpers::quote(prefix) + " && " + source_hash +
+           "; } | sha256sum 2>/dev/null | cut -c1-64); case $K in *[!0-9a-f]*) K= ;; esac; }";
+  }
+};
+
+bool swarm::cache::remote::is_enabled()
+{
+  const char* size_mb_c = getenv(SWARM_ENV_VAR_REMOTE_CACHE_SIZE_MB);
+
+  return size_mb_c == nullptr or std::strtoull(size_mb_c, nullptr, 10) != 0;
+}
+
+swarm::cache::remote::ptr swarm::cache::remote::make(const ssh::session_ptr& session, const std::string& compiler)
+{
+  const char* size_mb_c = getenv(SWARM_ENV_VAR_REMOTE_CACHE_SIZE_MB);
+
+  uint64_t size_mb = SWARM_DEFAULT_REMOTE_CACHE_SIZE_MB;
+  if (size_mb_c != nullptr) {
+    size_mb = std::strtoull(size_mb_c, nullptr, 10);
+  }
+
+  // A zero size disables the cache
+  if (size_mb == 0) {
+    return nullptr;
+  }
+
+  return std::make_shared<remote_cache_impl>(session, compiler, size_mb * 1024UL * 1024UL);
+}
+
+swarm::cache::local::ptr swarm::cache::local::make()
+{
+  const char* directory_c = getenv(SWARM_ENV_VAR_CACHE_DIR);
+  const char* size_mb_c   = getenv(SWARM_ENV_VAR_CACHE_SIZE_MB);
+
+  uint64_t size_mb = SWARM_DEFAULT_CACHE_SIZE_MB;
+  if (size_mb_c != nullptr) {
+    size_mb = std::strtoull(size_mb_c, nullptr, 10);
+  }
+
+  // A zero size disables the cache
+  if (size_mb == 0) {
+    return nullptr;
+  }
+
+  std::string directory = (directory_c != nullptr) ? directory_c : SWARM_DEFAULT_CACHE_DIR;
+
+  return std::make_shared<local_cache_impl>(directory, size_mb * 1024UL * 1024UL);
+}
+
+std::string swarm::cache::compiler_identity(const std::string& compiler)
+{
+  std::vector<std::string> candidates;
+
+  // Resolve the compiler through PATH unless it is already a path
+  if (compiler.find('/') != std::string::npos) {
+    candidates.emplace_back(compiler);
+  } else {
+    const char* path_c = getenv("PATH");
+    if (path_c != nullptr) {
+      for (const std::string& dir : string_helpers::split(path_c, ':')) {
+        candidates.emplace_back(dir + "/" + compiler);
+      }
+    }
+  }
+
+  for (const std::string& candidate : candidates) {
+    struct stat st = {};
+    if (stat(candidate.c_str(), &st) == 0 and S_ISREG(st.st_mode)) {
+      return candidate + ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtime);
+    }
+  }
+
+  return compiler;
+}
+
+std::string swarm::cache::make_key(const std::string& preprocessed_path,
+                                   const std::string& compile_command,
+                                   const std::string& compiler_id)
+{
+  std::string source_hash = hash::file(preprocessed_path);
+  if (source_hash.empty()) {
+    return "";
+  }
+
+  hash::sha256 h;
+  h.update(make_key_prefix(compile_command, compiler_id));
+  h.update(source_hash);
+
+  return h.hex_digest();
+}
+
+std::string swarm::cache::make_key_prefix(const std::string& compile_command, const std::string& compiler_id)
+{
+  return compiler_id + "\n" + compile_command + "\n";
+}
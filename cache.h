@@ -0,0 +1,92 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_CACHE_H
+#define SWARM_CACHE_H
+
+#include "ssh.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace swarm {
+namespace cache {
+
+struct stats {
+  uint64_t hits   = 0;
+  uint64_t misses = 0;
+  uint64_t size   = 0; ///< Bytes currently stored
+};
+
+class local
+{
+public:
+  // Restores the object stored under the key into path, returns true on hit
+  virtual bool fetch(const std::string& key, const std::string& path) = 0;
+
+  // Stores the object in path under the key, evicting the least recently used objects if required
+  virtual void store(const std::string& key, const std::string& path) = 0;
+
+  virtual stats get_stats() = 0;
+
+  typedef std::shared_ptr<local> ptr;
+
+  // Creates the cache from the environment, returns nullptr if it is disabled
+  static ptr make();
+};
+
+class remote
+{
+public:
+  // Downloads the object stored under the key in the remote host into local_path, returns true on hit
+  virtual bool fetch(const std::string& key, const std::string& local_path) = 0;
+
+  // Shell command that writes the object stored under the key into its standard output, it fails on miss
+  virtual std::string fetch_command(const std::string& key) = 0;
+
+  // Shell command that stores the remote object under the key, meant to be chained after the remote compilation. The
+  // key may be a shell variable.
+  virtual std::string store_command(const std::string& key, const std::string& remote_path) = 0;
+
+  // Shell command setting the variable K to the key of a source already in the remote host, from the prefix given by
+  // make_key_prefix. K is left empty if the host cannot hash.
+  virtual std::string key_command(const std::string& prefix, const std::string& remote_path) = 0;
+
+  typedef std::shared_ptr<remote> ptr;
+
+  static bool is_enabled();
+
+  // Creates the cache for the session host from the environment, returns nullptr if it is disabled. Without session
+  // the cache only builds commands. The host keeps the objects apart by the identity of its own compiler, the one the
+  // job runs, so a compiler upgrade in the host never serves the objects of the previous one.
+  static ptr make(const ssh::session_ptr& session, const std::string& compiler);
+};
+
+// Identity of the local compiler built from the resolved executable path, size and modification time
+std::string compiler_identity(const std::string& compiler);
+
+// Cache key from the preprocessed source content, the normalized compile command and the compiler identity
+std::string
+make_key(const std::string& preprocessed_path, const std::string& compile_command, const std::string& compiler_id);
+
+// Part of the key hashed before the source hash, so a host can compute the key of a source it received
+std::string make_key_prefix(const std::string& compile_command, const std::string& compiler_id);
+
+} // namespace cache
+} // namespace swarm
+
+#endif // SWARM_CACHE_H
@@ -0,0 +1,163 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "cluster.h"
+#include "config.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class sampler_impl : public swarm::cluster::sampler
+{
+private:
+  std::vector<std::string>                  hostnames;
+  double                                    measure_time_s;
+  std::size_t                               interval_us;
+  callback_t                                callback;
+  std::mutex                                mutex;
+  std::condition_variable                   cvar;
+  std::vector<swarm::cluster::host_state_t> states;
+  std::vector<std::thread>                  threads;
+  std::atomic<bool>                         quit = {false};
+
+  void sample_host(std::size_t idx)
+  {
+    swarm::ssh::session_ptr session      = nullptr;
+    uint32_t                nof_failures = 0;
+    double                  smoothed     = -1.0; ///< Negative until the first valid sample
+
+    while (not quit) {
+      // Get the current of the beginning
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+      // Connect on first use and after the session failed
+      if (session == nullptr) {
+        session = swarm::ssh::make_session(hostnames[idx]);
+      }
+
+      swarm::cluster::host_state_t state = {};
+      state.hostname                     = hostnames[idx];
+      state.cpu_percent                  = -1;
+      if (session != nullptr) {
+        state.fitness = session->fitness(measure_time_s, &state.cpu_percent, &state.latency_ms);
+
+        swarm::ssh::telemetry_sample_t sample = session->get_last_sample();
+        state.nof_cores                       = sample.nof_cores;
+        state.mem_total_kb                    = sample.mem_total_kb;
+        state.mem_available_kb                = sample.mem_available_kb;
+
+        // Drop the session if the host keeps not answering, a CPU not measured yet is not a failure
+        state.reachable = (state.latency_ms >= 0);
+        nof_failures    = state.reachable ? 0 : nof_failures + 1;
+        if (nof_failures >= SWARM_SAMPLER_MAX_FAILURES) {
+          session      = nullptr;
+          nof_failures = 0;
+        }
+      }
+      state.valid     = (state.fitness > 0.0);
+      state.timestamp = std::chrono::steady_clock::now();
+
+      // Smooth once per sample, the invalid samples keep the last smoothed fitness
+      if (state.valid) {
+        smoothed = (smoothed < 0.0) ? state.fitness : smoothed + SWARM_POLICY_EWMA_ALPHA * (state.fitness - smoothed);
+      }
+      state.smoothed_fitness = std::max(smoothed, 0.0);
+
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        state.nof_samples = states[idx].nof_samples + 1;
+        states[idx]       = state;
+      }
+      cvar.notify_all();
+
+      if (callback != nullptr) {
+        callback(idx, state);
+      }
+
+      // Sleep to match interval
+      std::size_t elapsed_us =
+          std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+      if (not quit and elapsed_us < interval_us) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cvar.wait_for(lock, std::chrono::microseconds(interval_us - elapsed_us), [this] { return quit.load(); });
+      }
+    }
+  }
+
+public:
+  sampler_impl(const std::vector<std::string>& hostnames_,
+               double                          measure_time_s_,
+               std::size_t                     interval_us_,
+               const callback_t&               callback_) :
+    hostnames(hostnames_),
+    measure_time_s(measure_time_s_),
+    interval_us(interval_us_),
+    callback(callback_),
+    states(hostnames_.size())
+  {
+    for (std::size_t i = 0; i < hostnames.size(); i++) {
+      states[i].hostname = hostnames[i];
+    }
+
+    // A session is not thread-safe, so each one is owned by a single thread
+    for (std::size_t i = 0; i < hostnames.size(); i++) {
+      threads.emplace_back(&sampler_impl::sample_host, this, i);
+    }
+  }
+
+  ~sampler_impl()
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      quit = true;
+    }
+    cvar.notify_all();
+
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+  std::vector<swarm::cluster::host_state_t> get_states() override
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    return states;
+  }
+
+  bool wait_first_samples(int timeout_ms) override
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    return cvar.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+      for (const swarm::cluster::host_state_t& state : states) {
+        if (state.nof_samples == 0) {
+          return false;
+        }
+      }
+      return true;
+    });
+  }
+};
+
+swarm::cluster::sampler::ptr swarm::cluster::sampler::make(const std::vector<std::string>& hostnames,
+                                                           double                          measure_time_s,
+                                                           std::size_t                     interval_us,
+                                                           const callback_t&               callback)
+{
+  return ptr(new sampler_impl(hostnames, measure_time_s, interval_us, callback));
+}
@@ -0,0 +1,76 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_CLUSTER_H
+#define SWARM_CLUSTER_H
+
+#include "ssh.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace swarm {
+namespace cluster {
+
+// Last known state of a host
+struct host_state_t {
+  std::string                           hostname;
+  bool                                  valid            = false; ///< The last sample succeeded
+  bool                                  reachable        = false; ///< The host answered the last sample
+  double                                fitness          = 0.0;
+  double                                smoothed_fitness = 0.0; ///< Fitness exponentially smoothed over the valid samples
+  int                                   cpu_percent      = 0;
+  int                                   latency_ms       = 0;
+  int                                   nof_cores        = 0;
+  uint64_t                              mem_total_kb     = 0;
+  uint64_t                              mem_available_kb = 0;
+  uint64_t                              nof_samples      = 0;
+  std::chrono::steady_clock::time_point timestamp        = {}; ///< Time the last sample was taken
+};
+
+// Samples every host concurrently, one thread per host, so the freshness does not depend on the number of hosts. The
+// hosts that cannot be reached are connected again at every interval.
+class sampler
+{
+public:
+  typedef std::function<void(std::size_t, const host_state_t&)> callback_t;
+
+  virtual ~sampler() = default;
+
+  // Copy of the last state of every host, in the hostnames order
+  virtual std::vector<host_state_t> get_states() = 0;
+
+  // Waits until every host has been sampled at least once, returns false on timeout
+  virtual bool wait_first_samples(int timeout_ms) = 0;
+
+  typedef std::unique_ptr<sampler> ptr;
+
+  // Samples each host every interval, the callback is called from the sampling threads. A host sampled more often
+  // than the measuring time keeps its previous CPU between measurements.
+  static ptr make(const std::vector<std::string>& hostnames,
+                  double                          measure_time_s,
+                  std::size_t                     interval_us,
+                  const callback_t&               callback = nullptr);
+};
+
+} // namespace cluster
+} // namespace swarm
+
+#endif // SWARM_CLUSTER_H
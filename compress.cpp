@@ -0,0 +1,155 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "compress.h"
+#include "config.h"
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef SWARM_HAVE_ZSTD
+#include <zstd.h>
+
+class zstd_compressor : public swarm::compress::stream
+{
+private:
+  ZSTD_CCtx* cctx = nullptr;
+
+  void run(const char* data, std::size_t nbytes, std::vector<char>& output, ZSTD_EndDirective mode)
+  {
+    ZSTD_inBuffer in        = {data, nbytes, 0};
+    std::size_t   remaining = 0;
+    do {
+      // Make room for a complete output block
+      std::size_t offset = output.size();
+      output.resize(offset + ZSTD_CStreamOutSize());
+
+      ZSTD_outBuffer out = {output.data() + offset, ZSTD_CStreamOutSize(), 0};
+      remaining          = ZSTD_compressStream2(cctx, &out, &in, mode);
+      SWARM_ASSERT(not ZSTD_isError(remaining), "Error compressing: %s", ZSTD_getErrorName(remaining));
+
+      output.resize(offset + out.pos);
+    } while ((mode == ZSTD_e_end) ? (remaining != 0) : (in.pos < in.size));
+  }
+
+public:
+  explicit zstd_compressor(int level)
+  {
+    cctx = ZSTD_createCCtx();
+    SWARM_ASSERT(cctx != nullptr, "Error creating compression context");
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+  }
+
+  ~zstd_compressor() override { ZSTD_freeCCtx(cctx); }
+
+  bool process(const char* data, std::size_t nbytes, std::vector<char>& output) override
+  {
+    run(data, nbytes, output, ZSTD_e_continue);
+    return true;
+  }
+
+  bool finish(std::vector<char>& output) override
+  {
+    run(nullptr, 0, output, ZSTD_e_end);
+    return true;
+  }
+};
+
+class zstd_decompressor : public swarm::compress::stream
+{
+private:
+  ZSTD_DCtx*  dctx      = nullptr;
+  std::size_t last_hint = 0;     ///< Zero once a frame has been completely decoded
+  bool        corrupted = false; ///< The stream cannot be decoded anymore
+
+public:
+  zstd_decompressor()
+  {
+    dctx = ZSTD_createDCtx();
+    SWARM_ASSERT(dctx != nullptr, "Error creating decompression context");
+  }
+
+  ~zstd_decompressor() override { ZSTD_freeDCtx(dctx); }
+
+  // A corrupted remote stream fails the job only, never the process
+  bool process(const char* data, std::size_t nbytes, std::vector<char>& output) override
+  {
+    ZSTD_inBuffer in = {data, nbytes, 0};
+    while (not corrupted and in.pos < in.size) {
+      std::size_t offset = output.size();
+      output.resize(offset + ZSTD_DStreamOutSize());
+
+      ZSTD_outBuffer out = {output.data() + offset, ZSTD_DStreamOutSize(), 0};
+      std::size_t    ret = ZSTD_decompressStream(dctx, &out, &in);
+      if (ZSTD_isError(ret)) {
+        fprintf(stderr, "Error decompressing: %s\n", ZSTD_getErrorName(ret));
+        output.resize(offset);
+        corrupted = true;
+        break;
+      }
+      last_hint = ret;
+
+      output.resize(offset + out.pos);
+    }
+
+    return not corrupted;
+  }
+
+  bool finish(std::vector<char>&) override { return not corrupted and last_hint == 0; }
+};
+#endif // SWARM_HAVE_ZSTD
+
+swarm::compress::stream::ptr swarm::compress::stream::make_compressor(int level)
+{
+#ifdef SWARM_HAVE_ZSTD
+  return ptr(new zstd_compressor(level));
+#else  // SWARM_HAVE_ZSTD
+  (void)level;
+  return nullptr;
+#endif // SWARM_HAVE_ZSTD
+}
+
+swarm::compress::stream::ptr swarm::compress::stream::make_decompressor()
+{
+#ifdef SWARM_HAVE_ZSTD
+  return ptr(new zstd_decompressor());
+#else  // SWARM_HAVE_ZSTD
+  return nullptr;
+#endif // SWARM_HAVE_ZSTD
+}
+
+int swarm::compress::get_level()
+{
+#ifdef SWARM_HAVE_ZSTD
+  const char* level_c = getenv(SWARM_ENV_VAR_COMPRESSION_LEVEL);
+  if (level_c == nullptr) {
+    return SWARM_DEFAULT_COMPRESSION_LEVEL;
+  }
+  return std::min(std::max(0, std::atoi(level_c)), SWARM_MAX_COMPRESSION_LEVEL);
+#else  // SWARM_HAVE_ZSTD
+  return 0;
+#endif // SWARM_HAVE_ZSTD
+}
+
+std::string swarm::compress::get_remote_compress_command(int level)
+{
+  return "zstd -q -c -" + std::to_string(level);
+}
+
+std::string swarm::compress::get_remote_decompress_command()
+{
+  return "zstd -q -d -c";
+}
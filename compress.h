@@ -0,0 +1,57 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_COMPRESS_H
+#define SWARM_COMPRESS_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace swarm {
+namespace compress {
+
+// Streaming compression stage
+class stream
+{
+public:
+  virtual ~stream() = default;
+
+  // Processes the input bytes appending the result into output, returns false if a decompressed stream is corrupted
+  virtual bool process(const char* data, std::size_t nbytes, std::vector<char>& output) = 0;
+
+  // Flushes the end of the stream into output, returns false if a decompressed stream was truncated
+  virtual bool finish(std::vector<char>& output) = 0;
+
+  typedef std::unique_ptr<stream> ptr;
+
+  // Both return nullptr if swarm was built without compression support
+  static ptr make_compressor(int level);
+  static ptr make_decompressor();
+};
+
+// Compression level selected in the environment, 0 if it is disabled or not supported
+int get_level();
+
+// Remote shell commands that compress and decompress between stdin and stdout
+std::string get_remote_compress_command(int level);
+std::string get_remote_decompress_command();
+
+} // namespace compress
+} // namespace swarm
+
+#endif // SWARM_COMPRESS_H
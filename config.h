@@ -18,6 +18,9 @@
 #ifndef SWARM__CONFIG_H_
 #define SWARM__CONFIG_H_
 
+#include <cstdio>
+#include <cstdlib>
+
 #define SWARM_API __attribute__((__visibility__("default")))
 
 #define SWARM_ENV_VAR_HOSTNAME_LIST "SWARM_HOSTNAMES"
@@ -25,11 +28,117 @@
 #define SWARM_HOSTNAME_LIST_DELIMITER ','
 #define SWARM_HOSTNAME_MAX_LENGTH 253
 #define SWARM_HOSTNAME_IPC_FILENAME "/swarm-lb-hostname"
+#define SWARM_IPC_QUEUE_SIZE 64
+#define SWARM_IPC_SERVE_TIMEOUT_MS 100
+#define SWARM_IPC_CALL_TIMEOUT_MS 1000
+#define SWARM_IPC_LIVENESS_MS 10
+#define SWARM_IPC_CLAIM_LEASE_MS 200
+#define SWARM_LB_NOF_THREADS 4
+#define SWARM_LB_SNAPSHOT_FILENAME "/swarm-lb-snapshot"
+#define SWARM_LB_MAX_HOSTS 64
+#define SWARM_SNAPSHOT_MAX_TRIALS 1000
+#define SWARM_SNAPSHOT_MAX_AGE_MS 10000
+#define SWARM_ENV_VAR_POLICY "SWARM_POLICY"
+#define SWARM_DEFAULT_POLICY "p2c"
+#define SWARM_POLICY_EWMA_ALPHA 0.3
+#define SWARM_FITNESS_LATENCY_FACTOR 0.1
+#define SWARM_ENV_VAR_OVERCOMMIT "SWARM_OVERCOMMIT"
+#define SWARM_DEFAULT_OVERCOMMIT 1.0
+#define SWARM_ENV_VAR_LB_METRICS "SWARM_LB_METRICS"
+#define SWARM_LB_METRICS_INTERVAL_MS 5000
+#define SWARM_LEASE_TIMEOUT_S 600
+#define SWARM_LEASE_RETRY_US 10000
+#define SWARM_LEASE_MAX_WAIT_MS 60000
+#define SWARM_BREAKER_ALPHA 0.2
+#define SWARM_BREAKER_MAX_FAILURES 3
+#define SWARM_BREAKER_MIN_OUTCOMES 10
+#define SWARM_BREAKER_MAX_FAILURE_RATE 0.5
+#define SWARM_BREAKER_MIN_BACKOFF_MS 1000
+#define SWARM_BREAKER_MAX_BACKOFF_MS 60000
+#define SWARM_BREAKER_OUTLIER_FACTOR 5
+#define SWARM_BREAKER_MIN_OUTLIER_MS 100
 
 #define SWARM_REMOTE_PATH std::string("/tmp/swarm/")
+// Transfer buffer sizes, they can be given at build time to compare them with swarm-bench
+#ifndef SWARM_SCP_BUFFER_SZ
 #define SWARM_SCP_BUFFER_SZ (1024 * 1024)
+#endif // SWARM_SCP_BUFFER_SZ
+#ifndef SWARM_SFTP_CHUNK_SZ
+#define SWARM_SFTP_CHUNK_SZ (64 * 1024)
+#endif // SWARM_SFTP_CHUNK_SZ
+#define SWARM_SFTP_MAX_INFLIGHT 16
 #define SWARM_MAX_NOF_TRIALS 10
+#define SWARM_JOB_MAX_RETRIES 2
+#define SWARM_SESSION_SELECT_TIMEOUT_MS 1000
+#define SWARM_SESSION_SELECT_NOF_CANDIDATES 3
+#define SWARM_SESSION_CONNECT_TIMEOUT_MS 10000
+#define SWARM_CHANNEL_POLL_TIMEOUT_MS 100
+#define SWARM_STREAM_MAX_PENDING_SZ (4 * 1024 * 1024)
+#define SWARM_TELEMETRY_INTERVAL_S 1.0
+#define SWARM_TELEMETRY_TIMEOUT_MS 1000
+#define SWARM_SAMPLER_MAX_FAILURES 3
 #define SWARM_PRECOMPILER_EXPECTED_STATUS 0
+#define SWARM_ENV_VAR_STREAM "SWARM_STREAM"
+#define SWARM_ENV_VAR_COMPRESSION_LEVEL "SWARM_COMPRESSION_LEVEL"
+#define SWARM_DEFAULT_COMPRESSION_LEVEL 0
+#define SWARM_MAX_COMPRESSION_LEVEL 19
+
+#define SWARM_ENV_VAR_CACHE_DIR "SWARM_CACHE_DIR"
+#define SWARM_DEFAULT_CACHE_DIR "/tmp/swarm-cache"
+#define SWARM_ENV_VAR_CACHE_SIZE_MB "SWARM_CACHE_SIZE_MB"
+#define SWARM_DEFAULT_CACHE_SIZE_MB 5120
+#define SWARM_CACHE_EVICT_TARGET 0.9
+#define SWARM_REMOTE_CACHE_PATH (SWARM_REMOTE_PATH + "cache/")
+#define SWARM_ENV_VAR_REMOTE_CACHE_SIZE_MB "SWARM_REMOTE_CACHE_SIZE_MB"
+#define SWARM_DEFAULT_REMOTE_CACHE_SIZE_MB 10240
+#define SWARM_REMOTE_CACHE_EVICT_RATIO 32
+
+#define SWARM_ENV_VAR_ADAPTIVE "SWARM_ADAPTIVE"
+#define SWARM_HISTORY_PATH std::string("/tmp/swarm-history-")
+#define SWARM_HISTORY_NOF_BUCKETS 40
+#define SWARM_HISTORY_MAX_HOSTS 64
+#define SWARM_HISTORY_MIN_SAMPLES 3
+#define SWARM_HISTORY_EWMA_ALPHA 0.2
+#define SWARM_HISTORY_EXPLORE_RATIO 0.1
+#define SWARM_ENV_VAR_HEDGE "SWARM_HEDGE"
+#define SWARM_HEDGE_NOF_SAMPLES 256U
+#define SWARM_HEDGE_MIN_SAMPLES 20
+#define SWARM_HEDGE_PERCENTILE 0.95
+#define SWARM_HEDGE_MIN_DELAY_MS 1000
+#define SWARM_HEDGE_POLL_MS 10
+
+#define SWARM_DAEMON_SOCKET_PATH std::string("/tmp/swarm-daemon-")
+#define SWARM_DAEMON_SOCKET_NAME std::string("swarm-daemon.sock")
+#define SWARM_DAEMON_MAX_FIELD_SZ (64 * 1024 * 1024)
+
+#define SWARM_ENV_VAR_WORKER "SWARM_WORKER"
+#define SWARM_ENV_VAR_WORKER_SLOTS "SWARM_WORKER_SLOTS"
+#define SWARM_WORKER_COMMAND "swarm-worker"
+#define SWARM_WORKER_PROTOCOL_VERSION 1
+#define SWARM_WORKER_START_TIMEOUT_MS 5000
+#define SWARM_WORKER_RETRY_S 60
+#define SWARM_WORKER_CHUNK_SZ (64 * 1024)
+#define SWARM_WORKER_MAX_FRAME_SZ (16 * 1024 * 1024)
+#define SWARM_WORKER_MAX_OUTPUT_SZ (16 * 1024 * 1024)
+#define SWARM_WORKER_MAX_INPUT_SZ (64 * 1024 * 1024)
+#define SWARM_WORKER_POLL_MS 10
+
+#define SWARM_ENV_VAR_PUMP "SWARM_PUMP"
+#define SWARM_PUMP_PATH (SWARM_REMOTE_PATH + "pump/")
+#define SWARM_PUMP_LOCAL_STATUS 125
+#define SWARM_PUMP_MAX_AGE_MIN 1440
+#define SWARM_PUMP_EVICT_RATIO 32
+
+#define SWARM_ENV_VAR_TRACE "SWARM_TRACE"
+
+#define SWARM_ENV_VAR_MOCK "SWARM_MOCK"
+#define SWARM_MOCK_PATH std::string("/tmp/swarm-mock/")
+#define SWARM_MOCK_CONNECT_RTTS 3
+#define SWARM_MOCK_CORE_POLL_US 1000
+#define SWARM_MOCK_MEM_PER_CORE_KB (2UL * 1024 * 1024)
+#define SWARM_MOCK_JIFFIES_PER_S 100.0
+#define SWARM_ENV_VAR_RECORD "SWARM_RECORD"
+#define SWARM_SIM_LB_START_TIMEOUT_MS 10000
 
 #define SWARM_ENABLE_DEBUG_TRACE 0
 
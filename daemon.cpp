@@ -0,0 +1,288 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "daemon.h"
+#include "config.h"
+#include "string_helpers.h"
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static bool send_all(int sock, const void* data, std::size_t nbytes)
+{
+  const char* ptr = static_cast<const char*>(data);
+  while (nbytes > 0) {
+    ssize_t n = send(sock, ptr, nbytes, MSG_NOSIGNAL);
+    if (n < 0 and errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    ptr += n;
+    nbytes -= n;
+  }
+  return true;
+}
+
+static bool receive_all(int sock, void* data, std::size_t nbytes)
+{
+  char* ptr = static_cast<char*>(data);
+  while (nbytes > 0) {
+    ssize_t n = recv(sock, ptr, nbytes, 0);
+    if (n < 0 and errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    ptr += n;
+    nbytes -= n;
+  }
+  return true;
+}
+
+static bool send_string(int sock, const std::string& str)
+{
+  uint32_t len = static_cast<uint32_t>(str.size());
+  return send_all(sock, &len, sizeof(len)) and send_all(sock, str.data(), str.size());
+}
+
+static bool receive_string(int sock, std::string& str)
+{
+  uint32_t len = 0;
+  if (not receive_all(sock, &len, sizeof(len)) or len > SWARM_DAEMON_MAX_FIELD_SZ) {
+    return false;
+  }
+  str.resize(len);
+  return receive_all(sock, &str[0], len);
+}
+
+// The runtime directory is private to the user, the fallback directory is created private by the daemon
+static std::string get_socket_directory()
+{
+  const char* runtime_c = getenv("XDG_RUNTIME_DIR");
+  if (runtime_c != nullptr and runtime_c[0] == '/') {
+    return runtime_c;
+  }
+  return SWARM_DAEMON_SOCKET_PATH + std::to_string(getuid());
+}
+
+std::string swarm::daemon::get_socket_path()
+{
+  return get_socket_directory() + "/" + SWARM_DAEMON_SOCKET_NAME;
+}
+
+bool swarm::daemon::make_socket_directory()
+{
+  std::string directory = get_socket_directory();
+  if (mkdir(directory.c_str(), S_IRWXU) != 0 and errno != EEXIST) {
+    return false;
+  }
+
+  // Another user may have created the directory first
+  struct stat st = {};
+  return lstat(directory.c_str(), &st) == 0 and S_ISDIR(st.st_mode) and st.st_uid == getuid() and
+         (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+bool swarm::daemon::is_same_user(int sock)
+{
+  struct ucred cred = {};
+  socklen_t    len  = sizeof(cred);
+
+  return getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 and len == sizeof(cred) and
+         cred.uid == getuid();
+}
+
+bool swarm::daemon::send_request(int sock, const job::description& job, int stdin_fd, int stdout_fd, int stderr_fd)
+{
+  // Pass the input and output file descriptors along with the first byte
+  char          tag                              = 'J';
+  int           fds[3]                           = {stdin_fd, stdout_fd, stderr_fd};
+  char          control[CMSG_SPACE(sizeof(fds))] = {};
+  struct iovec  iov                              = {&tag, sizeof(tag)};
+  struct msghdr msg                              = {};
+  msg.msg_iov                                    = &iov;
+  msg.msg_iovlen                                 = 1;
+  msg.msg_control                                = control;
+  msg.msg_controllen                             = sizeof(control);
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level     = SOL_SOCKET;
+  cmsg->cmsg_type      = SCM_RIGHTS;
+  cmsg->cmsg_len       = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(tag)) {
+    return false;
+  }
+
+  // Serialize the job fields
+  std::string hostnames;
+  for (const std::string& hostname : job.hostnames) {
+    hostnames += hostname + SWARM_HOSTNAME_LIST_DELIMITER;
+  }
+
+  uint8_t stream = job.stream ? 1 : 0;
+
+  return send_string(sock, hostnames) and send_string(sock, job.cache_key) and send_string(sock, job.cache_prefix) and
+         send_all(sock, &stream, 1) and send_string(sock, job.local_source) and send_string(sock, job.remote_source) and
+         send_string(sock, job.command) and send_string(sock, job.remote_target) and
+         send_string(sock, job.local_target) and send_string(sock, job.partial_target) and
+         send_string(sock, job.pump_manifest) and send_string(sock, job.pump_directory);
+}
+
+bool swarm::daemon::receive_request(int sock, job::description& job, int& stdin_fd, int& stdout_fd, int& stderr_fd)
+{
+  char          tag                              = 0;
+  int           fds[3]                           = {-1, -1, -1};
+  char          control[CMSG_SPACE(sizeof(fds))] = {};
+  struct iovec  iov                              = {&tag, sizeof(tag)};
+  struct msghdr msg                              = {};
+  msg.msg_iov                                    = &iov;
+  msg.msg_iovlen                                 = 1;
+  msg.msg_control                                = control;
+  msg.msg_controllen                             = sizeof(control);
+
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(tag) or tag != 'J') {
+    return false;
+  }
+
+  // Extract the file descriptors
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == nullptr or cmsg->cmsg_level != SOL_SOCKET or cmsg->cmsg_type != SCM_RIGHTS or
+      cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    return false;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  stdin_fd  = fds[0];
+  stdout_fd = fds[1];
+  stderr_fd = fds[2];
+
+  // Deserialize the job fields
+  std::string hostnames;
+  uint8_t     stream = 0;
+  if (not(receive_string(sock, hostnames) and receive_string(sock, job.cache_key) and
+          receive_string(sock, job.cache_prefix) and receive_all(sock, &stream, 1) and
+          receive_string(sock, job.local_source) and receive_string(sock, job.remote_source) and
+          receive_string(sock, job.command) and receive_string(sock, job.remote_target) and
+          receive_string(sock, job.local_target) and receive_string(sock, job.partial_target) and
+          receive_string(sock, job.pump_manifest) and receive_string(sock, job.pump_directory))) {
+    close(stdin_fd);
+    close(stdout_fd);
+    close(stderr_fd);
+    return false;
+  }
+  job.hostnames = string_helpers::split(hostnames, SWARM_HOSTNAME_LIST_DELIMITER);
+  job.stream    = (stream != 0);
+
+  return true;
+}
+
+bool swarm::daemon::send_reply(int sock, int status, const std::string& hostname)
+{
+  int32_t status_ = status;
+  return send_all(sock, &status_, sizeof(status_)) and send_string(sock, hostname);
+}
+
+bool swarm::daemon::receive_reply(int sock, int& status, std::string& hostname)
+{
+  int32_t status_ = 0;
+  if (not receive_all(sock, &status_, sizeof(status_)) or not receive_string(sock, hostname)) {
+    return false;
+  }
+  status = status_;
+  return true;
+}
+
+// The daemon runs in its own working directory, the relative paths are resolved in the current one
+static std::string get_absolute_path(const std::string& path)
+{
+  if (path.empty() or path.front() == '/') {
+    return path;
+  }
+
+  char cwd[PATH_MAX] = {};
+  SWARM_ASSERT(getcwd(cwd, sizeof(cwd)) != nullptr, "Error getting working directory: %s", strerror(errno));
+  return std::string(cwd) + "/" + path;
+}
+
+class daemon_client_impl : public swarm::daemon::client
+{
+private:
+  int sock = -1;
+
+public:
+  explicit daemon_client_impl(int sock_) : sock(sock_) {}
+
+  ~daemon_client_impl() { close(sock); }
+
+  bool submit(const swarm::job::description& job,
+              int                            stdin_fd,
+              int                            stdout_fd,
+              int                            stderr_fd,
+              int&                           status,
+              std::string&                   hostname) override
+  {
+    // The partial object is named after this process, so it can remove it if it leaves the job behind
+    swarm::job::description request = job;
+    request.local_source            = get_absolute_path(job.local_source);
+    request.local_target            = get_absolute_path(job.local_target);
+    request.partial_target          = get_absolute_path(
+        job.partial_target.empty() ? swarm::job::get_partial_target(job.local_target) : job.partial_target);
+
+    return swarm::daemon::send_request(sock, request, stdin_fd, stdout_fd, stderr_fd) and
+           swarm::daemon::receive_reply(sock, status, hostname);
+  }
+};
+
+swarm::daemon::client::ptr swarm::daemon::client::make()
+{
+  std::string path = get_socket_path();
+
+  struct sockaddr_un addr = {};
+  addr.sun_family         = AF_UNIX;
+  SWARM_ASSERT(path.size() < sizeof(addr.sun_path), "Daemon socket path '%s' is too long", path.c_str());
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    return nullptr;
+  }
+
+  // The daemon is not running
+  if (connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(sock);
+    return nullptr;
+  }
+
+  // The descriptors are only handed over to a daemon of the same user
+  if (not is_same_user(sock)) {
+    fprintf(stderr, "Warning: the daemon socket '%s' belongs to another user, ignoring it\n", path.c_str());
+    close(sock);
+    return nullptr;
+  }
+
+  return std::make_shared<daemon_client_impl>(sock);
+}
@@ -0,0 +1,69 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_DAEMON_H
+#define SWARM_DAEMON_H
+
+#include "job.h"
+#include <memory>
+#include <string>
+
+namespace swarm {
+namespace daemon {
+
+// UNIX socket path of the current user daemon, in XDG_RUNTIME_DIR or else in a private directory under /tmp
+std::string get_socket_path();
+
+// Creates the directory of the socket only the current user can access, returns false if it exists and other users own
+// it or can write into it
+bool make_socket_directory();
+
+// True if the process at the other end of the connection runs as the current user
+bool is_same_user(int sock);
+
+// Sends a job together with the input and output file descriptors, which are passed to the daemon process
+bool send_request(int sock, const job::description& job, int stdin_fd, int stdout_fd, int stderr_fd);
+
+// Receives a job and the input and output file descriptors, the caller owns the received descriptors
+bool receive_request(int sock, job::description& job, int& stdin_fd, int& stdout_fd, int& stderr_fd);
+
+// The reply carries the host that ran the job, empty if no host did
+bool send_reply(int sock, int status, const std::string& hostname);
+bool receive_reply(int sock, int& status, std::string& hostname);
+
+class client
+{
+public:
+  // Runs the job in the daemon, returns false if the daemon did not complete the job. The hostname is the host that
+  // ran the job.
+  virtual bool submit(const job::description& job,
+                      int                     stdin_fd,
+                      int                     stdout_fd,
+                      int                     stderr_fd,
+                      int&                    status,
+                      std::string&            hostname) = 0;
+
+  typedef std::shared_ptr<client> ptr;
+
+  // Connects to the local daemon, returns nullptr if the daemon is not running
+  static ptr make();
+};
+
+} // namespace daemon
+} // namespace swarm
+
+#endif // SWARM_DAEMON_H
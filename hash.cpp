@@ -0,0 +1,177 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "hash.h"
+#include "config.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t rotr(uint32_t x, uint32_t n)
+{
+  return (x >> n) | (x << (32 - n));
+}
+
+swarm::hash::sha256::sha256()
+{
+  state = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+}
+
+void swarm::hash::sha256::transform(const uint8_t* data)
+{
+  uint32_t w[64];
+
+  // Load big-endian words and extend the message schedule
+  for (std::size_t i = 0; i < 16; i++) {
+    w[i] = (uint32_t)data[4 * i] << 24 | (uint32_t)data[4 * i + 1] << 16 | (uint32_t)data[4 * i + 2] << 8 |
+           (uint32_t)data[4 * i + 3];
+  }
+  for (std::size_t i = 16; i < 64; i++) {
+    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i]        = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+  // Compression rounds
+  for (std::size_t i = 0; i < 64; i++) {
+    uint32_t s1    = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+    uint32_t ch    = (e & f) ^ (~e & g);
+    uint32_t temp1 = h + s1 + ch + k[i] + w[i];
+    uint32_t s0    = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+    uint32_t maj   = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t temp2 = s0 + maj;
+
+    h = g;
+    g = f;
+    f = e;
+    e = d + temp1;
+    d = c;
+    c = b;
+    b = a;
+    a = temp1 + temp2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+void swarm::hash::sha256::update(const void* data, std::size_t nbytes)
+{
+  const uint8_t* ptr = static_cast<const uint8_t*>(data);
+
+  total_len += nbytes;
+
+  // Complete a previously started block
+  if (block_len > 0) {
+    std::size_t n = std::min(nbytes, block.size() - block_len);
+    memcpy(block.data() + block_len, ptr, n);
+    block_len += n;
+    ptr += n;
+    nbytes -= n;
+
+    if (block_len < block.size()) {
+      return;
+    }
+
+    transform(block.data());
+    block_len = 0;
+  }
+
+  // Process whole blocks straight from the input
+  while (nbytes >= block.size()) {
+    transform(ptr);
+    ptr += block.size();
+    nbytes -= block.size();
+  }
+
+  // Keep the remainder for later
+  memcpy(block.data(), ptr, nbytes);
+  block_len = nbytes;
+}
+
+std::string swarm::hash::sha256::hex_digest()
+{
+  uint64_t total_bits = total_len * 8;
+
+  // Append padding and message length in bits
+  uint8_t pad = 0x80;
+  update(&pad, 1);
+  pad = 0x00;
+  while (block_len != 56) {
+    update(&pad, 1);
+  }
+  uint8_t len_be[8];
+  for (std::size_t i = 0; i < 8; i++) {
+    len_be[i] = static_cast<uint8_t>(total_bits >> (56 - 8 * i));
+  }
+  update(len_be, sizeof(len_be));
+
+  // Convert state to hexadecimal string
+  static const char* hex = "0123456789abcdef";
+  std::string        ret;
+  ret.reserve(64);
+  for (uint32_t word : state) {
+    for (int shift = 28; shift >= 0; shift -= 4) {
+      ret += hex[(word >> shift) & 0xf];
+    }
+  }
+
+  return ret;
+}
+
+std::string swarm::hash::file(const std::string& path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return "";
+  }
+
+  sha256            h;
+  std::vector<char> buffer(SWARM_SCP_BUFFER_SZ);
+  ssize_t           n = 0;
+  while ((n = read(fd, buffer.data(), buffer.size())) > 0) {
+    h.update(buffer.data(), n);
+  }
+  close(fd);
+
+  if (n < 0) {
+    return "";
+  }
+
+  return h.hex_digest();
+}
@@ -0,0 +1,55 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_HASH_H
+#define SWARM_HASH_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace swarm {
+namespace hash {
+
+// Incremental SHA-256, used for content addressing objects and sources
+class sha256
+{
+private:
+  std::array<uint32_t, 8> state     = {};
+  std::array<uint8_t, 64> block     = {};
+  std::size_t             block_len = 0;
+  uint64_t                total_len = 0;
+
+  void transform(const uint8_t* data);
+
+public:
+  sha256();
+
+  void update(const void* data, std::size_t nbytes);
+  void update(const std::string& str) { update(str.data(), str.size()); }
+
+  // Finalises the hash and returns the digest as lower case hexadecimal string
+  std::string hex_digest();
+};
+
+// Hash a whole file, returns an empty string if the file cannot be read
+std::string file(const std::string& path);
+
+} // namespace hash
+} // namespace swarm
+
+#endif // SWARM_HASH_H
@@ -0,0 +1,291 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "history.h"
+#include "config.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Persistent file layout, rewritten whole under an exclusive lock
+struct history_bucket_t {
+  double   local_ms;    ///< Smoothed local compile time
+  uint32_t nof_samples; ///< Number of local compilations
+};
+
+struct history_host_t {
+  char     hostname[SWARM_HOSTNAME_MAX_LENGTH];
+  double   overhead_ms; ///< Smoothed remote time minus the local estimate
+  uint32_t nof_samples;
+};
+
+struct history_file_t {
+  uint32_t         version;
+  history_bucket_t buckets[SWARM_HISTORY_NOF_BUCKETS]; ///< Indexed by the base 2 logarithm of the preprocessed size
+  history_host_t   hosts[SWARM_HISTORY_MAX_HOSTS];
+  double           remote_ms_per_byte[SWARM_HEDGE_NOF_SAMPLES]; ///< Circular buffer of the latest remote jobs
+  uint32_t         remote_next;
+  uint32_t         nof_remote;
+};
+
+static const uint32_t history_version = 2;
+
+static uint32_t get_bucket(uint64_t size)
+{
+  uint32_t bucket = 0;
+  while (size > 1 and bucket < SWARM_HISTORY_NOF_BUCKETS - 1) {
+    size >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+static void smooth(double& value, uint32_t& nof_samples, double sample)
+{
+  if (nof_samples == 0) {
+    value = sample;
+  } else {
+    value += SWARM_HISTORY_EWMA_ALPHA * (sample - value);
+  }
+  nof_samples++;
+}
+
+// Returns true if some local core is not running any task, from the number of runnable tasks in /proc/loadavg
+static bool is_local_idle()
+{
+  FILE* fp = fopen("/proc/loadavg", "r");
+  if (fp == nullptr) {
+    return false;
+  }
+
+  double   load_1m = 0, load_5m = 0, load_15m = 0;
+  unsigned running = 0, total = 0;
+  int      n       = fscanf(fp, "%lf %lf %lf %u/%u", &load_1m, &load_5m, &load_15m, &running, &total);
+  fclose(fp);
+
+  if (n != 5) {
+    return false;
+  }
+
+  // The calling process counts as running
+  return running <= std::max(1U, std::thread::hardware_concurrency());
+}
+
+class history_table_impl : public swarm::history::table
+{
+private:
+  const std::string path;
+  std::mt19937      generator = std::mt19937(std::random_device()());
+
+  // Applies a function to the persistent history while holding an exclusive lock
+  template <class F>
+  void update(F&& function, bool write)
+  {
+    history_file_t file = {};
+
+    // The path is predictable, never follow a link nor use a file another user planted
+    int         fd = open(path.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    struct stat st = {};
+    if (fd >= 0 and (fstat(fd, &st) != 0 or not S_ISREG(st.st_mode) or st.st_uid != getuid())) {
+      close(fd);
+      fd = -1;
+    }
+    if (fd < 0) {
+      function(file);
+      return;
+    }
+
+    flock(fd, write ? LOCK_EX : LOCK_SH);
+
+    // Start from scratch if the file is empty or from another version
+    if (pread(fd, &file, sizeof(file), 0) != sizeof(file) or file.version != history_version) {
+      file         = {};
+      file.version = history_version;
+    }
+
+    function(file);
+
+    if (write and pwrite(fd, &file, sizeof(file), 0) != sizeof(file)) {
+      fprintf(stderr, "Warning: cannot write compile history in '%s'\n", path.c_str());
+    }
+
+    flock(fd, LOCK_UN);
+    close(fd);
+  }
+
+  // Local compile time from the nearest bucket with samples assuming it grows linearly with the size, negative if
+  // there are no local samples at all
+  static double estimate_local(const history_file_t& file, uint32_t bucket)
+  {
+    for (uint32_t distance = 0; distance < SWARM_HISTORY_NOF_BUCKETS; distance++) {
+      if (bucket >= distance and file.buckets[bucket - distance].nof_samples >= SWARM_HISTORY_MIN_SAMPLES) {
+        return std::ldexp(file.buckets[bucket - distance].local_ms, static_cast<int>(distance));
+      }
+      if (bucket + distance < SWARM_HISTORY_NOF_BUCKETS and
+          file.buckets[bucket + distance].nof_samples >= SWARM_HISTORY_MIN_SAMPLES) {
+        return std::ldexp(file.buckets[bucket + distance].local_ms, -static_cast<int>(distance));
+      }
+    }
+    return -1.0;
+  }
+
+  // Host entry, an empty hostname or a full table return nullptr
+  static history_host_t* find_host(history_file_t& file, const std::string& hostname, bool create)
+  {
+    if (hostname.empty()) {
+      return nullptr;
+    }
+
+    for (history_host_t& host : file.hosts) {
+      if (strncmp(host.hostname, hostname.c_str(), sizeof(host.hostname)) == 0) {
+        return &host;
+      }
+      if (host.hostname[0] == '\0') {
+        if (not create) {
+          return nullptr;
+        }
+        strncpy(host.hostname, hostname.c_str(), sizeof(host.hostname) - 1);
+        return &host;
+      }
+    }
+
+    return nullptr;
+  }
+
+  // Overhead of the host, or the average of every known host if it is not known, negative if there are no samples
+  static double estimate_overhead(history_file_t& file, const std::string& hostname)
+  {
+    history_host_t* host = find_host(file, hostname, false);
+    if (host != nullptr and host->nof_samples >= SWARM_HISTORY_MIN_SAMPLES) {
+      return host->overhead_ms;
+    }
+
+    double   sum   = 0.0;
+    uint32_t count = 0;
+    for (const history_host_t& h : file.hosts) {
+      if (h.nof_samples >= SWARM_HISTORY_MIN_SAMPLES) {
+        sum += h.overhead_ms;
+        count++;
+      }
+    }
+    return (count > 0) ? sum / count : -1.0;
+  }
+
+public:
+  explicit history_table_impl(std::string path_) : path(std::move(path_)) {}
+
+  swarm::history::placement_t decide(uint64_t size, const std::string& hostname) override
+  {
+    // Never queue behind other local jobs
+    if (not is_local_idle()) {
+      return swarm::history::PLACEMENT_REMOTE;
+    }
+
+    double local_ms    = -1.0;
+    double overhead_ms = -1.0;
+    update(
+        [&](history_file_t& file) {
+          local_ms    = estimate_local(file, get_bucket(size));
+          overhead_ms = estimate_overhead(file, hostname);
+        },
+        false);
+
+    // Without enough history, compile locally once in a while to learn both sides
+    if (local_ms < 0.0 or overhead_ms < 0.0) {
+      bool explore = std::uniform_real_distribution<double>(0.0, 1.0)(generator) < SWARM_HISTORY_EXPLORE_RATIO;
+      return explore ? swarm::history::PLACEMENT_LOCAL : swarm::history::PLACEMENT_REMOTE;
+    }
+
+    // A job is cheap if compiling it takes less than shipping it to the host, large jobs leave the local cores free
+    return (local_ms < overhead_ms) ? swarm::history::PLACEMENT_LOCAL : swarm::history::PLACEMENT_REMOTE;
+  }
+
+  void record(swarm::history::placement_t placement,
+              uint64_t                    size,
+              const std::string&          hostname,
+              double                      elapsed_ms) override
+  {
+    uint32_t bucket = get_bucket(size);
+
+    update(
+        [&](history_file_t& file) {
+          if (placement == swarm::history::PLACEMENT_LOCAL) {
+            smooth(file.buckets[bucket].local_ms, file.buckets[bucket].nof_samples, elapsed_ms);
+            return;
+          }
+
+          if (size != 0) {
+            file.remote_ms_per_byte[file.remote_next] = elapsed_ms / static_cast<double>(size);
+            file.remote_next                          = (file.remote_next + 1) % SWARM_HEDGE_NOF_SAMPLES;
+            file.nof_remote                           = std::min(file.nof_remote + 1, SWARM_HEDGE_NOF_SAMPLES);
+          }
+
+          // The overhead needs a local estimate for the same size
+          double          local_ms = estimate_local(file, bucket);
+          history_host_t* host     = find_host(file, hostname, true);
+          if (local_ms >= 0.0 and host != nullptr) {
+            smooth(host->overhead_ms, host->nof_samples, elapsed_ms - local_ms);
+          }
+        },
+        true);
+  }
+
+  double get_hedge_delay_ms(uint64_t size) override
+  {
+    std::vector<double> samples;
+    update(
+        [&samples](history_file_t& file) {
+          samples.assign(file.remote_ms_per_byte, file.remote_ms_per_byte + file.nof_remote);
+        },
+        false);
+
+    if (samples.size() < SWARM_HEDGE_MIN_SAMPLES) {
+      return -1.0;
+    }
+
+    // Percentile of the time per byte, the large jobs are not late just because they are large
+    std::size_t idx = static_cast<std::size_t>(SWARM_HEDGE_PERCENTILE * static_cast<double>(samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+
+    return std::max(samples[idx] * static_cast<double>(size), static_cast<double>(SWARM_HEDGE_MIN_DELAY_MS));
+  }
+};
+
+swarm::history::table::ptr swarm::history::table::make()
+{
+  return std::make_shared<history_table_impl>(SWARM_HISTORY_PATH + std::to_string(getuid()));
+}
+
+bool swarm::history::table::is_adaptive()
+{
+  const char* adaptive_c = getenv(SWARM_ENV_VAR_ADAPTIVE);
+  return adaptive_c == nullptr or std::string(adaptive_c) != "0";
+}
+
+bool swarm::history::table::is_hedging()
+{
+  const char* hedge_c = getenv(SWARM_ENV_VAR_HEDGE);
+  return hedge_c != nullptr and std::string(hedge_c) != "0";
+}
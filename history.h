@@ -0,0 +1,61 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_HISTORY_H
+#define SWARM_HISTORY_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace swarm {
+namespace history {
+
+enum placement_t { PLACEMENT_LOCAL, PLACEMENT_REMOTE };
+
+// Persistent compile time history shared by every swarm-cc of the user. The local compile time is modelled per
+// preprocessed size and every host adds a measured overhead (session, transfers and its own speed) on top of it. The
+// latest remote times per byte give the distribution used for hedging.
+class table
+{
+public:
+  virtual ~table() = default;
+
+  // Decides where a job of the given preprocessed size runs, hostname is empty if the host is not known yet
+  virtual placement_t decide(uint64_t size, const std::string& hostname) = 0;
+
+  // Records the wall time of a successful job, the remote overhead is not learnt if the hostname is empty
+  virtual void record(placement_t placement, uint64_t size, const std::string& hostname, double elapsed_ms) = 0;
+
+  // Time after which a remote job of the given size is late, negative if there is not enough history
+  virtual double get_hedge_delay_ms(uint64_t size) = 0;
+
+  typedef std::shared_ptr<table> ptr;
+
+  static ptr make();
+
+  // Cheap jobs are compiled locally unless it is disabled in the environment
+  static bool is_adaptive();
+
+  // Late remote jobs are compiled locally too if it is enabled in the environment
+  static bool is_hedging();
+};
+
+} // namespace history
+} // namespace swarm
+
+#endif // SWARM_HISTORY_H
@@ -17,9 +17,11 @@
 
 #include "hostnames.h"
 #include "config.h"
+#include "lb.h"
 #include "shared.h"
 #include "string_helpers.h"
 #include <cerrno>
+#include <chrono>
 #include <cstring>
 #include <unistd.h>
 
@@ -50,17 +52,118 @@ std::string swarm::hostname::get_local()
   return hostname_c;
 }
 
-std::string swarm::hostname::get_lb()
+std::string swarm::hostname::get_lb(uint64_t& lease_id)
 {
-  swarm::shared::request<char[SWARM_HOSTNAME_MAX_LENGTH]> request(SWARM_HOSTNAME_IPC_FILENAME);
+  swarm::shared::request<swarm::lb::request_t, swarm::lb::reply_t> request(SWARM_HOSTNAME_IPC_FILENAME);
 
-  char hostname[SWARM_HOSTNAME_MAX_LENGTH] = {};
+  // Place the job from the published cluster table, the load balancer grants the slot unless the host filled up since
+  // the table was published
+  swarm::lb::snapshot_t snapshot = {};
+  if (swarm::lb::read_snapshot(snapshot)) {
+    int host_idx = swarm::lb::select_host(snapshot, swarm::policy::placement::get());
+    if (host_idx >= 0) {
+      swarm::lb::request_t req = {swarm::lb::MESSAGE_TYPE_LEASE,
+                                  getpid(),
+                                  swarm::lb::make_lease_id(),
+                                  static_cast<uint32_t>(host_idx),
+                                  0,
+                                  swarm::lb::get_time_ns()};
+      swarm::lb::reply_t   rep = {};
+      if (request.call(req, rep) and not rep.busy) {
+        lease_id = req.lease_id;
+        snapshot.hosts[host_idx].hostname[SWARM_HOSTNAME_MAX_LENGTH - 1] = '\0';
+        return snapshot.hosts[host_idx].hostname;
+      }
+    }
 
-  request.send_request();
+    // Do not wait for a job slot if every host is out of rotation
+    bool any_closed = false;
+    for (uint32_t i = 0; i < snapshot.nof_hosts; i++) {
+      any_closed = any_closed or snapshot.hosts[i].breaker == swarm::lb::BREAKER_CLOSED;
+    }
+    if (not any_closed) {
+      return "";
+    }
+  }
+
+  // Otherwise ask the load balancer for a job slot
+  swarm::lb::request_t req = {swarm::lb::MESSAGE_TYPE_ACQUIRE, getpid(), 0, 0, 0, 0};
+  swarm::lb::reply_t   rep = {};
+
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(SWARM_LEASE_MAX_WAIT_MS);
+
+  // Wait for a free job slot
+  while (true) {
+    // If the load balance cannot be read, then return an empty string
+    req.send_time_ns = swarm::lb::get_time_ns();
+    if (not request.call(req, rep)) {
+      return "";
+    }
+
+    if (not rep.busy) {
+      break;
+    }
+
+    if (std::chrono::steady_clock::now() > deadline) {
+      return "";
+    }
+
+    usleep(SWARM_LEASE_RETRY_US);
+  }
+
+  lease_id                                    = rep.lease_id;
+  rep.hostname[SWARM_HOSTNAME_MAX_LENGTH - 1] = '\0';
+  return rep.hostname;
+}
+
+void swarm::hostname::release_lb(uint64_t lease_id, bool failed)
+{
+  swarm::shared::request<swarm::lb::request_t, swarm::lb::reply_t> request(SWARM_HOSTNAME_IPC_FILENAME);
+
+  swarm::lb::request_t req = {
+      swarm::lb::MESSAGE_TYPE_RELEASE, getpid(), lease_id, 0, failed ? 1U : 0U, swarm::lb::get_time_ns()};
+  request.post(req);
+}
 
-  // Read hostname from the load balancer
-  request.read(hostname);
+void swarm::hostname::report_lb(const std::string& hostname, bool failed)
+{
+  swarm::lb::snapshot_t snapshot = {};
+  if (not swarm::lb::read_snapshot(snapshot)) {
+    return;
+  }
 
-  // If the load balance cannot be read, then return an empty string
-  return hostname;
+  int host_idx = swarm::lb::find_host(snapshot, hostname);
+  if (host_idx < 0) {
+    return;
+  }
+
+  swarm::shared::request<swarm::lb::request_t, swarm::lb::reply_t> request(SWARM_HOSTNAME_IPC_FILENAME);
+
+  swarm::lb::request_t req = {swarm::lb::MESSAGE_TYPE_REPORT,
+                              getpid(),
+                              0,
+                              static_cast<uint32_t>(host_idx),
+                              failed ? 1U : 0U,
+                              swarm::lb::get_time_ns()};
+  request.post(req);
+}
+
+swarm::hostname::vector_t swarm::hostname::get_available()
+{
+  vector_t all = get_all();
+
+  swarm::lb::snapshot_t snapshot = {};
+  if (not swarm::lb::read_snapshot(snapshot)) {
+    return all;
+  }
+
+  vector_t available;
+  for (const std::string& hostname : all) {
+    int host_idx = swarm::lb::find_host(snapshot, hostname);
+    if (host_idx < 0 or snapshot.hosts[host_idx].breaker == swarm::lb::BREAKER_CLOSED) {
+      available.push_back(hostname);
+    }
+  }
+  return available;
 }
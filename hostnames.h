@@ -19,6 +19,7 @@
 #define SWARM__HOSTNAMES_H_
 
 #include "config.h"
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -29,7 +30,19 @@ typedef std::vector<std::string> vector_t;
 
 vector_t    get_all();
 std::string get_local();
-std::string get_lb();
+
+// Takes a job slot from the load balancer waiting while all of them are taken, returns an empty string if the load
+// balancer is not available
+std::string get_lb(uint64_t& lease_id);
+
+// Returns the job slot to the load balancer, failed reports that the host failed the job
+void release_lb(uint64_t lease_id, bool failed = false);
+
+// Reports the outcome of a job in a host without job slot
+void report_lb(const std::string& hostname, bool failed);
+
+// All the hostnames except the ones the load balancer pulled from rotation
+vector_t get_available();
 
 } // namespace hostname
 } // namespace swarm
@@ -0,0 +1,375 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "job.h"
+#include "cache.h"
+#include "compress.h"
+#include "string_helpers.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <unistd.h>
+
+// Runs a remote command streaming stdin_fd into it and its output into stdout_fd, with the given compression level
+typedef std::function<int(const std::string& command, int stdin_fd, int stdout_fd, int compression_level)> executor_t;
+
+typedef std::unique_ptr<FILE, decltype(&fclose)> file_ptr;
+
+// Compiler the job runs in the host, the first word of its command
+static std::string get_compiler(const swarm::job::description& job)
+{
+  return job.command.substr(0, job.command.find(' '));
+}
+
+// Remote command removing the pump blobs and the mirrored roots nobody used for a while. The blobs a job uses are
+// touched before it mirrors them.
+static std::string get_pump_evict_command()
+{
+  return "find " + SWARM_PUMP_PATH + " -mindepth 1 -maxdepth 1 -mmin +" + std::to_string(SWARM_PUMP_MAX_AGE_MIN) +
+         " -exec rm -rf {} + 2>/dev/null";
+}
+
+// Remote command reading the source from stdin and writing the object into stdout
+static std::string get_stream_command(const swarm::job::description&   job,
+                                      const swarm::cache::remote::ptr& remote_cache,
+                                      int                              compression_level)
+{
+  // The compiler cannot write objects into a pipe, so the object goes through a remote temporary file. Only the object
+  // is written into stdout, whatever the compiler prints goes to stderr.
+  std::string command = "T=$(mktemp) && (" + job.command + " -o $T >&2)";
+  if (compression_level > 0) {
+    command =
+        "T=$(mktemp) && (" + swarm::compress::get_remote_decompress_command() + " | " + job.command + " -o $T >&2)";
+  }
+  if (remote_cache != nullptr and not job.cache_key.empty()) {
+    command += " && { " + remote_cache->store_command(job.cache_key, "$T") + "; true; }";
+  }
+
+  // Without key the source was streamed while preprocessing, the host keeps it until it knows the key and a hit skips
+  // the compilation
+  if (remote_cache != nullptr and job.cache_key.empty()) {
+    std::string input   = (compression_level > 0) ? swarm::compress::get_remote_decompress_command() : "cat";
+    std::string hit     = "[ -n \"$K\" ] && " + remote_cache->fetch_command("$K") + " > $T";
+    std::string compile = "(" + job.command + " -o $T < $I >&2) && { [ -z \"$K\" ] || " +
+                          remote_cache->store_command("$K", "$T") + "; true; }";
+    std::string key     = remote_cache->key_command(job.cache_prefix, "$I");
+    command = "T=$(mktemp) && I=$(mktemp) && " + input + " > $I && " + key + " && if " + hit + "; then true; else " +
+              compile + "; fi";
+  }
+  if (compression_level > 0) {
+    command += " && " + swarm::compress::get_remote_compress_command(compression_level) + " < $T";
+  } else {
+    command += " && cat $T";
+  }
+  command += "; S=$?; rm -f $T $I; exit $S";
+
+  return command;
+}
+
+std::string swarm::job::get_partial_target(const std::string& local_target)
+{
+  return local_target + ".tmp." + std::to_string(getpid());
+}
+
+// Runs the command writing its output into the job target, which is only replaced if the command succeeds. A target
+// that cannot be written fails the job, the error goes to stderr_fd.
+static int run_into_target(const swarm::job::description& job,
+                           int                            stderr_fd,
+                           const std::function<int(int)>& execute)
+{
+  // Write the object in a temporary file so a failed compilation never leaves a partial target
+  std::string tmp_target =
+      job.partial_target.empty() ? swarm::job::get_partial_target(job.local_target) : job.partial_target;
+  int target_fd = open(tmp_target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (target_fd < 0) {
+    dprintf(stderr_fd, "Error opening '%s': %s\n", tmp_target.c_str(), strerror(errno));
+    return 1;
+  }
+
+  int status = execute(target_fd);
+
+  close(target_fd);
+
+  if (status != 0) {
+    unlink(tmp_target.c_str());
+    return status;
+  }
+
+  // The client may have removed the temporary file, for instance once its hedged compilation won
+  if (rename(tmp_target.c_str(), job.local_target.c_str()) != 0) {
+    dprintf(stderr_fd, "Error renaming '%s': %s\n", tmp_target.c_str(), strerror(errno));
+    unlink(tmp_target.c_str());
+    return 1;
+  }
+
+  return status;
+}
+
+// Temporary file with the given content, ready to be read from the beginning
+static file_ptr make_tmp_file(const std::string& content)
+{
+  file_ptr file(tmpfile(), &fclose);
+  SWARM_ASSERT(file != nullptr, "Error creating temporary file: %s", strerror(errno));
+  SWARM_ASSERT(fwrite(content.data(), 1, content.size(), file.get()) == content.size() and fflush(file.get()) == 0,
+               "Error writing temporary file: %s",
+               strerror(errno));
+  rewind(file.get());
+  return file;
+}
+
+static std::string read_tmp_file(FILE* file)
+{
+  std::string content;
+  char        buffer[4096];
+  size_t      n = 0;
+  rewind(file);
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    content.append(buffer, n);
+  }
+  return content;
+}
+
+// Remote command mirroring the manifest files under a private root from the stored blobs, then compiling in the
+// mirrored working directory and writing the object into stdout. A failed compilation whose preprocessor fails too
+// exits with SWARM_PUMP_LOCAL_STATUS, the remote headers may be the cause. A failed mirror exits with it too, so only the
+// status of the compiler reaches the build.
+static std::string get_pump_command(const swarm::job::description& job, int compression_level)
+{
+  // Hard links are enough since the blobs are never modified
+  std::string blob   = SWARM_PUMP_PATH + "$h";
+  std::string link   = "{ ln -f " + blob + " \"$R$p\" 2>/dev/null || cp " + blob + " \"$R$p\"; }";
+  std::string mirror = "while read -r h p; do mkdir -p \"$R${p%/*}\" && " + link + " || exit 1; done";
+  if (compression_level > 0) {
+    mirror = swarm::compress::get_remote_decompress_command() + " | (" + mirror + ")";
+  } else {
+    mirror = "(" + mirror + ")";
+  }
+
+  std::string directory    = "\"$R\"" + swarm::string_helpers::quote(job.pump_directory);
+  std::string local_status = std::to_string(SWARM_PUMP_LOCAL_STATUS);
+  std::string command      = "S=0; { R=$(mktemp -d " + SWARM_PUMP_PATH + "root.XXXXXX) && T=$(mktemp) && " + mirror +
+                        " && mkdir -p " + directory + " && cd " + directory + "; } || S=" + local_status;
+  command += "; [ $S -ne 0 ] || { ( (" + job.command + " -o $T >&2) || { S=$?; (" + job.command +
+             " -E -o /dev/null) >/dev/null 2>&1 || S=" + local_status + "; exit $S; } )";
+  if (compression_level > 0) {
+    command += " && " + swarm::compress::get_remote_compress_command(compression_level) + " < $T";
+  } else {
+    command += " && cat $T";
+  }
+  command += "; S=$?; }; rm -rf $R $T; exit $S";
+
+  return command;
+}
+
+// Compiles in pump mode: uploads the files whose content the host does not have yet, then the host preprocesses and
+// compiles from a mirror of the local files
+static int run_pump(const executor_t& execute, const swarm::job::description& job, int stderr_fd)
+{
+  std::string pump_path = SWARM_PUMP_PATH;
+
+  // The host lists the blobs it is missing and touches the others, so they are known to be in use
+  std::string check = "mkdir -p " + pump_path + " && cd " + pump_path +
+                      " && while read -r h p; do if [ -f $h ]; then touch $h; else echo $h; fi; done";
+
+  // Only a fraction of the jobs evict the old blobs, the hash of the first file is uniformly distributed
+  if (job.pump_manifest.size() >= 2 and
+      std::stoul(job.pump_manifest.substr(0, 2), nullptr, 16) % SWARM_PUMP_EVICT_RATIO == 0) {
+    check += " && { " + get_pump_evict_command() + "; true; }";
+  }
+
+  file_ptr manifest = make_tmp_file(job.pump_manifest);
+  file_ptr missing  = make_tmp_file("");
+  int      status   = execute(check, fileno(manifest.get()), fileno(missing.get()), 0);
+  if (status != 0) {
+    return status;
+  }
+
+  // Upload every missing blob in a single command, each one preceded by its hash and size
+  std::map<std::string, std::string> paths;
+  for (const std::string& line : swarm::string_helpers::split(job.pump_manifest, '\n')) {
+    std::size_t pos = line.find(' ');
+    if (pos != std::string::npos) {
+      paths[line.substr(0, pos)] = line.substr(pos + 1);
+    }
+  }
+
+  file_ptr    upload       = make_tmp_file("");
+  std::size_t nof_uploaded = 0;
+  for (const std::string& hash : swarm::string_helpers::split(read_tmp_file(missing.get()), '\n')) {
+    auto it = paths.find(hash);
+    if (it == paths.end()) {
+      continue;
+    }
+
+    std::ifstream file(it->second, std::ios::binary);
+    std::string   content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    SWARM_ASSERT(not file.bad(), "Error reading '%s'", it->second.c_str());
+
+    std::string header = hash + " " + std::to_string(content.size()) + "\n";
+    SWARM_ASSERT(fwrite(header.data(), 1, header.size(), upload.get()) == header.size() and
+                     fwrite(content.data(), 1, content.size(), upload.get()) == content.size(),
+                 "Error writing temporary file: %s",
+                 strerror(errno));
+    paths.erase(it);
+    nof_uploaded++;
+  }
+
+  if (nof_uploaded > 0) {
+    SWARM_ASSERT(fflush(upload.get()) == 0, "Error writing temporary file: %s", strerror(errno));
+    rewind(upload.get());
+
+    // The blob only appears under its hash once complete
+    status = execute("cd " + pump_path + " && while read -r h n; do head -c $n > $h.tmp.$$ && mv -f $h.tmp.$$ $h" +
+                         " || exit 1; done",
+                     fileno(upload.get()),
+                     fileno(missing.get()),
+                     0);
+    if (status != 0) {
+      return status;
+    }
+  }
+
+  // The manifest goes again into the compilation, which mirrors the files
+  int         compression_level = swarm::compress::get_level();
+  std::string command           = get_pump_command(job, compression_level);
+  rewind(manifest.get());
+
+  return run_into_target(job, stderr_fd, [&](int target_fd) {
+    return execute(command, fileno(manifest.get()), target_fd, compression_level);
+  });
+}
+
+// Compiles in a single channel, the source goes through stdin and the object comes back through stdout
+static int run_stream(const swarm::ssh::session_ptr&    session,
+                      const swarm::job::description&   job,
+                      const swarm::cache::remote::ptr& remote_cache,
+                      int                              stdin_fd,
+                      int                              stderr_fd)
+{
+  int         compression_level = swarm::compress::get_level();
+  std::string command           = get_stream_command(job, remote_cache, compression_level);
+
+  return run_into_target(job, stderr_fd, [&](int target_fd) {
+    return session->make_channel()->execute_stream(command, stdin_fd, target_fd, stderr_fd, compression_level);
+  });
+}
+
+int swarm::job::run(const ssh::session_ptr& session,
+                    const description&      job,
+                    int                     stdin_fd,
+                    int                     stdout_fd,
+                    int                     stderr_fd)
+{
+  // Remote object cache shared by all the clients of the host, nullptr if it is disabled. A streamed source without key
+  // is looked up by the host once received.
+  cache::remote::ptr remote_cache = nullptr;
+  if (not job.cache_key.empty() or (job.stream and not job.cache_prefix.empty())) {
+    remote_cache = cache::remote::make(session, get_compiler(job));
+  }
+
+  // On remote hit skip the upload and the compilation
+  if (remote_cache != nullptr and not job.cache_key.empty() and remote_cache->fetch(job.cache_key, job.local_target)) {
+    return 0;
+  }
+
+  if (not job.pump_manifest.empty()) {
+    return run_pump(
+        [&](const std::string& command, int in_fd, int out_fd, int compression_level) {
+          return session->make_channel()->execute_stream(command, in_fd, out_fd, stderr_fd, compression_level);
+        },
+        job,
+        stderr_fd);
+  }
+
+  if (job.stream) {
+    return run_stream(session, job, remote_cache, stdin_fd, stderr_fd);
+  }
+
+  // Write the preprocessed file in remote machine
+  if (not session->sftp_copy_local_to_remote(job.local_source, job.remote_source)) {
+    return ssh::transport_error;
+  }
+
+  // Store the object in the remote cache right after compiling, without changing the compiler exit status
+  std::string command = job.command;
+  if (remote_cache != nullptr) {
+    command = "(" + command + ") && { " + remote_cache->store_command(job.cache_key, job.remote_target) + "; true; }";
+  }
+
+  // Execute compilation command in remote machine
+  int status = session->make_channel()->execute(command, stdout_fd, stderr_fd);
+  if (status != 0) {
+    return status;
+  }
+
+  // Copy remote file to local
+  if (not session->sftp_copy_remote_to_local(job.remote_target, job.local_target)) {
+    return ssh::transport_error;
+  }
+
+  return status;
+}
+
+int swarm::job::run(const worker::client::ptr& worker,
+                    const description&         job,
+                    int                        stdin_fd,
+                    int                        stdout_fd,
+                    int                        stderr_fd)
+{
+  SWARM_ASSERT(job.stream, "The worker only runs streaming jobs");
+
+  // The object comes back through the standard output
+  (void)stdout_fd;
+
+  // The worker fetches the object itself, the cache only builds the commands
+  cache::remote::ptr remote_cache = nullptr;
+  if (not job.cache_key.empty() or not job.cache_prefix.empty()) {
+    remote_cache = cache::remote::make(nullptr, get_compiler(job));
+  }
+
+  // On remote hit skip the upload and the compilation
+  if (remote_cache != nullptr and not job.cache_key.empty()) {
+    int status = run_into_target(job, stderr_fd, [&](int target_fd) {
+      return worker->execute(remote_cache->fetch_command(job.cache_key), -1, target_fd, stderr_fd);
+    });
+    if (status == 0 or status == ssh::transport_error) {
+      return status;
+    }
+  }
+
+  if (not job.pump_manifest.empty()) {
+    return run_pump(
+        [&](const std::string& command, int in_fd, int out_fd, int compression_level) {
+          return worker->execute(command, in_fd, out_fd, stderr_fd, compression_level);
+        },
+        job,
+        stderr_fd);
+  }
+
+  int         compression_level = compress::get_level();
+  std::string command           = get_stream_command(job, remote_cache, compression_level);
+
+  return run_into_target(job, stderr_fd, [&](int target_fd) {
+    return worker->execute(command, stdin_fd, target_fd, stderr_fd, compression_level);
+  });
+}
@@ -0,0 +1,68 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_JOB_H
+#define SWARM_JOB_H
+
+#include "hostnames.h"
+#include "ssh.h"
+#include "worker.h"
+#include <string>
+
+namespace swarm {
+namespace job {
+
+// Remote compilation job
+struct description {
+  hostname::vector_t hostnames;      ///< Host candidates
+  std::string        cache_key;      ///< Remote object cache key, empty to skip the cache
+  std::string        cache_prefix;   ///< Key prefix the host hashes with the streamed source if the key is unknown
+  bool               stream = false; ///< Source through stdin and object through stdout
+  std::string        local_source;   ///< Preprocessed source in the local host, unused when streaming
+  std::string        remote_source;  ///< Preprocessed source in the remote host, unused when streaming
+  std::string        command;        ///< Remote compilation command, without input nor output when streaming
+  std::string        remote_target;  ///< Object in the remote host, unused when streaming
+  std::string        local_target;   ///< Object in the local host
+  std::string        partial_target; ///< Object being written in the local host, get_partial_target() if empty
+  std::string        pump_manifest;  ///< Pump mode files to mirror in the remote host, empty if not pumping
+  std::string        pump_directory; ///< Pump mode working directory, mirrored in the remote host
+};
+
+// Temporary file the object is written into before it is renamed to the job local target, unique to the process
+std::string get_partial_target(const std::string& local_target);
+
+// Runs the job in the session host forwarding the compiler output, returns the compiler exit status or
+// ssh::transport_error if the host failed, in which case the job can be retried elsewhere. When streaming, the
+// preprocessed source is read from stdin_fd. In pump mode the source and its headers are mirrored in the host, which
+// preprocesses them itself.
+int run(const ssh::session_ptr& session,
+        const description&      job,
+        int                     stdin_fd  = 0,
+        int                     stdout_fd = 1,
+        int                     stderr_fd = 2);
+
+// Runs a streaming job through the host worker, which serves several jobs at a time
+int run(const worker::client::ptr& worker,
+        const description&         job,
+        int                        stdin_fd  = 0,
+        int                        stdout_fd = 1,
+        int                        stderr_fd = 2);
+
+} // namespace job
+} // namespace swarm
+
+#endif // SWARM_JOB_H
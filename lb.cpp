@@ -0,0 +1,87 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "lb.h"
+#include "shared.h"
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+uint64_t swarm::lb::get_time_ns()
+{
+  struct timespec ts = {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000UL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+uint64_t swarm::lb::make_lease_id()
+{
+  static std::atomic<uint32_t> count = {0};
+  return (1ULL << 63U) | (static_cast<uint64_t>(getpid()) << 24U) | (count++ & 0xffffffU);
+}
+
+bool swarm::lb::read_snapshot(snapshot_t& snapshot)
+{
+  swarm::shared::subscriber<snapshot_t> subscriber(SWARM_LB_SNAPSHOT_FILENAME);
+  if (not subscriber.read(snapshot)) {
+    return false;
+  }
+
+  // Discard the table of a dead or stuck load balancer
+  if (snapshot.server_pid <= 0 or (kill(snapshot.server_pid, 0) != 0 and errno == ESRCH)) {
+    return false;
+  }
+  if (get_time_ns() > snapshot.update_time_ns + SWARM_SNAPSHOT_MAX_AGE_MS * 1000000UL) {
+    return false;
+  }
+
+  return snapshot.nof_hosts > 0 and snapshot.nof_hosts <= SWARM_LB_MAX_HOSTS;
+}
+
+int swarm::lb::select_host(const snapshot_t& snapshot, policy::placement& policy)
+{
+  std::vector<policy::host_view_t> hosts(snapshot.nof_hosts);
+  for (uint32_t i = 0; i < snapshot.nof_hosts; i++) {
+    const host_entry_t& host = snapshot.hosts[i];
+    hosts[i].valid            = host.valid;
+    hosts[i].fitness          = host.fitness;
+    hosts[i].free_slots       = (host.inflight < host.capacity) ? host.capacity - host.inflight : 0;
+    hosts[i].smoothed_fitness = host.smoothed_fitness;
+    hosts[i].credit           = host.credit;
+
+    // The hosts out of rotation take no job, even if no host is valid
+    if (host.breaker != BREAKER_CLOSED) {
+      hosts[i].free_slots = 0;
+    }
+  }
+
+  return policy.select(hosts);
+}
+
+int swarm::lb::find_host(const snapshot_t& snapshot, const std::string& hostname)
+{
+  for (uint32_t i = 0; i < snapshot.nof_hosts; i++) {
+    if (strncmp(snapshot.hosts[i].hostname, hostname.c_str(), sizeof(snapshot.hosts[i].hostname)) == 0) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,103 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_LB_H
+#define SWARM_LB_H
+
+#include "config.h"
+#include "policy.h"
+#include <cstdint>
+#include <string>
+
+namespace swarm {
+namespace lb {
+
+// Messages exchanged with swarm-lb through the shared memory queue, both sides must be built from the same sources
+enum message_type_t : uint32_t {
+  MESSAGE_TYPE_ACQUIRE = 0, ///< Takes a job slot in the best fitted host
+  MESSAGE_TYPE_RELEASE = 1, ///< Returns a job slot, posted without reply
+  MESSAGE_TYPE_LEASE   = 2, ///< Takes a job slot in the host chosen by the client, busy if the host has none left
+  MESSAGE_TYPE_REPORT  = 3, ///< Reports the outcome of a job in a host without lease, posted without reply
+};
+
+struct request_t {
+  message_type_t type;
+  int32_t        pid;          ///< Lease holder, its leases are reclaimed when it dies
+  uint64_t       lease_id;     ///< Lease to release or taken by the client
+  uint32_t       host_idx;     ///< Host of the lease taken by the client or of the report
+  uint32_t       failed;       ///< The host failed the job of the released lease or the report
+  uint64_t       send_time_ns; ///< CLOCK_MONOTONIC time the request was sent, for the queue latency
+};
+
+// Circuit breaker of a host, only the closed hosts take jobs
+enum breaker_state_t : uint32_t {
+  BREAKER_CLOSED    = 0, ///< Healthy
+  BREAKER_OPEN      = 1, ///< Pulled from rotation until its backoff expires
+  BREAKER_HALF_OPEN = 2, ///< Waiting for a probe to decide whether it is back
+};
+
+struct reply_t {
+  char     hostname[SWARM_HOSTNAME_MAX_LENGTH];
+  uint64_t lease_id; ///< Zero if no lease was granted
+  bool     busy;     ///< All the job slots are taken, the client shall retry later
+};
+
+// Host state published by swarm-lb
+struct host_entry_t {
+  char            hostname[SWARM_HOSTNAME_MAX_LENGTH];
+  bool            valid; ///< The last sample succeeded
+  double          fitness;
+  double          smoothed_fitness; ///< Fitness exponentially smoothed over the valid samples
+  int64_t         credit;           ///< Weighted round robin credit kept by swarm-lb
+  int32_t         cpu_percent;
+  int32_t         latency_ms;
+  int32_t         nof_cores;
+  uint32_t        capacity; ///< Maximum number of job slots
+  uint32_t        inflight; ///< Job slots taken
+  uint64_t        mem_total_kb;
+  uint64_t        mem_available_kb;
+  uint64_t        sample_time_ns; ///< CLOCK_MONOTONIC time of the last sample
+  breaker_state_t breaker;
+};
+
+// Cluster table, read wait-free by the clients so they place the jobs themselves
+struct snapshot_t {
+  int32_t      server_pid;
+  uint32_t     nof_hosts;
+  uint64_t     update_time_ns; ///< CLOCK_MONOTONIC time of the last update
+  host_entry_t hosts[SWARM_LB_MAX_HOSTS];
+};
+
+// Current CLOCK_MONOTONIC time, comparable between processes
+uint64_t get_time_ns();
+
+// Client-side lease identifier, distinct from the ones granted by swarm-lb
+uint64_t make_lease_id();
+
+// Reads the cluster table, returns false if swarm-lb is not running or the table is stale
+bool read_snapshot(snapshot_t& snapshot);
+
+// Selects a closed host with free job slots through the placement policy, returns -1 if all of them are taken
+int select_host(const snapshot_t& snapshot, policy::placement& policy);
+
+// Index of the host in the table, -1 if it is not there
+int find_host(const snapshot_t& snapshot, const std::string& hostname);
+
+} // namespace lb
+} // namespace swarm
+
+#endif // SWARM_LB_H
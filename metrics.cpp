@@ -0,0 +1,183 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "metrics.h"
+#include "config.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+
+static std::string format_value(double value)
+{
+  char buffer[32];
+  if (std::isinf(value)) {
+    return value > 0 ? "+Inf" : "-Inf";
+  }
+  snprintf(buffer, sizeof(buffer), "%.12g", value);
+  return buffer;
+}
+
+// Series name with its labels, and an extra label for the histogram buckets
+static std::string format_series(const std::string& name, const std::string& labels, const std::string& extra = "")
+{
+  std::string all = labels;
+  if (not extra.empty()) {
+    all += (all.empty() ? "" : ",") + extra;
+  }
+  return all.empty() ? name : name + "{" + all + "}";
+}
+
+static const char* get_type_name(swarm::metrics::type_t type)
+{
+  switch (type) {
+    case swarm::metrics::TYPE_COUNTER:
+      return "counter";
+    case swarm::metrics::TYPE_GAUGE:
+      return "gauge";
+    case swarm::metrics::TYPE_HISTOGRAM:
+      return "histogram";
+  }
+  return "untyped";
+}
+
+swarm::metrics::registry::series_t&
+swarm::metrics::registry::get_series(const std::string& name, const std::string& labels, type_t type)
+{
+  auto it = families.find(name);
+  SWARM_ASSERT(it != families.end() and it->second.type == type, "Error. Metric '%s' is not declared", name.c_str());
+
+  series_t& series = it->second.series[labels];
+  if (type == TYPE_HISTOGRAM and series.buckets.empty()) {
+    series.buckets.resize(it->second.bounds.size() + 1, 0);
+  }
+  return series;
+}
+
+void swarm::metrics::registry::declare(const std::string&         name,
+                                       type_t                     type,
+                                       const std::string&         help,
+                                       const std::vector<double>& bounds)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  family_t& family = families[name];
+  family.type      = type;
+  family.help      = help;
+  family.bounds    = bounds;
+}
+
+void swarm::metrics::registry::add(const std::string& name, const std::string& labels, double value)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  get_series(name, labels, TYPE_COUNTER).value += value;
+}
+
+void swarm::metrics::registry::set(const std::string& name, const std::string& labels, double value)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  get_series(name, labels, TYPE_GAUGE).value = value;
+}
+
+void swarm::metrics::registry::observe(const std::string& name, const std::string& labels, double value)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  series_t&                  series = get_series(name, labels, TYPE_HISTOGRAM);
+  const std::vector<double>& bounds = families[name].bounds;
+
+  // The last bucket takes the observations above every bound
+  std::size_t idx = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+  series.buckets[idx]++;
+  series.value += value;
+  series.count++;
+}
+
+std::string swarm::metrics::registry::render()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  std::string text;
+  for (const auto& entry : families) {
+    const std::string& name   = entry.first;
+    const family_t&    family = entry.second;
+
+    text += "# HELP " + name + " " + family.help + "\n";
+    text += "# TYPE " + name + " " + get_type_name(family.type) + "\n";
+
+    for (const auto& series_entry : family.series) {
+      const std::string& labels = series_entry.first;
+      const series_t&    series = series_entry.second;
+
+      if (family.type != TYPE_HISTOGRAM) {
+        text += format_series(name, labels) + " " + format_value(series.value) + "\n";
+        continue;
+      }
+
+      // The buckets are cumulative in the exposition format
+      uint64_t cumulative = 0;
+      for (std::size_t i = 0; i < series.buckets.size(); i++) {
+        double bound = (i < family.bounds.size()) ? family.bounds[i] : INFINITY;
+        cumulative += series.buckets[i];
+        text += format_series(name + "_bucket", labels, "le=\"" + format_value(bound) + "\"") + " " +
+                std::to_string(cumulative) + "\n";
+      }
+      text += format_series(name + "_sum", labels) + " " + format_value(series.value) + "\n";
+      text += format_series(name + "_count", labels) + " " + std::to_string(series.count) + "\n";
+    }
+  }
+
+  return text;
+}
+
+bool swarm::metrics::registry::write(const std::string& path)
+{
+  std::string text     = render();
+  std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+
+  {
+    std::ofstream file(tmp_path, std::ios::trunc);
+    file << text;
+    if (not file.good()) {
+      unlink(tmp_path.c_str());
+      return false;
+    }
+  }
+
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::string swarm::metrics::label(const std::string& name, const std::string& value)
+{
+  std::string ret = name + "=\"";
+  for (char c : value) {
+    if (c == '\\' or c == '"') {
+      ret += '\\';
+      ret += c;
+    } else if (c == '\n') {
+      ret += "\\n";
+    } else {
+      ret += c;
+    }
+  }
+  return ret + "\"";
+}
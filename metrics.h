@@ -0,0 +1,80 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_METRICS_H
+#define SWARM_METRICS_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace swarm {
+namespace metrics {
+
+enum type_t { TYPE_COUNTER, TYPE_GAUGE, TYPE_HISTOGRAM };
+
+// Metric families exported in the Prometheus text format, thread-safe. Every series of a family is identified by its
+// labels, written as in the exposition format, for instance host="node1".
+class registry
+{
+private:
+  struct series_t {
+    double                value = 0.0; ///< Counter or gauge value, sum of the observations of a histogram
+    uint64_t              count = 0;   ///< Number of observations of a histogram
+    std::vector<uint64_t> buckets;     ///< Observations per bucket, not cumulative
+  };
+
+  struct family_t {
+    type_t                          type;
+    std::string                     help;
+    std::vector<double>             bounds; ///< Upper bounds of the histogram buckets
+    std::map<std::string, series_t> series;
+  };
+
+  std::mutex                      mutex;
+  std::map<std::string, family_t> families;
+
+  series_t& get_series(const std::string& name, const std::string& labels, type_t type);
+
+public:
+  // Declares a family, a histogram takes the increasing upper bounds of its buckets
+  void declare(const std::string& name, type_t type, const std::string& help, const std::vector<double>& bounds = {});
+
+  // Increases a counter
+  void add(const std::string& name, const std::string& labels = "", double value = 1.0);
+
+  // Sets a gauge
+  void set(const std::string& name, const std::string& labels, double value);
+
+  // Records an observation in a histogram
+  void observe(const std::string& name, const std::string& labels, double value);
+
+  std::string render();
+
+  // Rewrites the file through a temporary one, so a reader never finds it half written. Returns false on failure.
+  bool write(const std::string& path);
+};
+
+// Label with its value escaped
+std::string label(const std::string& name, const std::string& value);
+
+} // namespace metrics
+} // namespace swarm
+
+#endif // SWARM_METRICS_H
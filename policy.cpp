@@ -0,0 +1,210 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "policy.h"
+#include "config.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+
+double swarm::policy::compute_fitness(int cpu_percent, int latency_ms)
+{
+  // Protect zero division, which it should be impossible, even with a localhost
+  if (cpu_percent < 0) {
+    return 0.0;
+  }
+
+  return (100.0 - static_cast<double>(cpu_percent)) /
+         (SWARM_FITNESS_LATENCY_FACTOR * static_cast<double>(std::max(latency_ms, 1)));
+}
+
+// Hosts that can take a job: free slots and a successful sample, unless no sample succeeded yet
+static std::vector<int> get_eligible(const std::vector<swarm::policy::host_view_t>& hosts)
+{
+  bool any_valid = false;
+  for (const swarm::policy::host_view_t& host : hosts) {
+    any_valid |= host.valid;
+  }
+
+  std::vector<int> eligible;
+  for (std::size_t i = 0; i < hosts.size(); i++) {
+    if ((hosts[i].valid or not any_valid) and hosts[i].free_slots > 0) {
+      eligible.push_back(static_cast<int>(i));
+    }
+  }
+  return eligible;
+}
+
+// Returns true if host a is less loaded than host b
+static bool is_less_loaded(const swarm::policy::host_view_t& a, const swarm::policy::host_view_t& b)
+{
+  if (a.free_slots != b.free_slots) {
+    return a.free_slots > b.free_slots;
+  }
+  return a.fitness > b.fitness;
+}
+
+// Always the host with more free slots, the fitness breaks ties
+class least_loaded_policy : public swarm::policy::placement
+{
+public:
+  int select(const std::vector<swarm::policy::host_view_t>& hosts) override
+  {
+    int best = -1;
+    for (int i : get_eligible(hosts)) {
+      if (best < 0 or is_less_loaded(hosts[i], hosts[best])) {
+        best = i;
+      }
+    }
+    return best;
+  }
+};
+
+void swarm::policy::update_credits(const std::vector<host_view_t>& hosts, int selected, std::vector<int64_t>& credits)
+{
+  credits.resize(hosts.size(), 0);
+  if (selected < 0 or static_cast<std::size_t>(selected) >= hosts.size()) {
+    return;
+  }
+
+  // Every eligible host earns its weight and the selected one pays for all of them, the credits always add up to zero
+  bool    earned = false;
+  int64_t total  = 0;
+  for (int i : get_eligible(hosts)) {
+    credits[i] += hosts[i].free_slots;
+    total += hosts[i].free_slots;
+    earned = earned or (i == selected);
+  }
+  if (not earned) {
+    credits[selected] += hosts[selected].free_slots;
+    total += hosts[selected].free_slots;
+  }
+  credits[selected] -= total;
+}
+
+// Smooth weighted round robin, every host is selected in proportion to its free slots. The host with most credit once
+// every host earned its weight is selected, update_credits charges it afterwards.
+class wrr_policy : public swarm::policy::placement
+{
+public:
+  int select(const std::vector<swarm::policy::host_view_t>& hosts) override
+  {
+    int best = -1;
+    for (int i : get_eligible(hosts)) {
+      if (best < 0 or hosts[i].credit + hosts[i].free_slots > hosts[best].credit + hosts[best].free_slots) {
+        best = i;
+      }
+    }
+    return best;
+  }
+};
+
+// Power of two random choices, the less loaded of two random hosts avoids sending every job to the same best host
+class p2c_policy : public swarm::policy::placement
+{
+private:
+  std::mt19937 generator = std::mt19937(std::random_device()());
+
+public:
+  int select(const std::vector<swarm::policy::host_view_t>& hosts) override
+  {
+    std::vector<int> eligible = get_eligible(hosts);
+    if (eligible.empty()) {
+      return -1;
+    }
+
+    std::uniform_int_distribution<std::size_t> distribution(0, eligible.size() - 1);
+    int                                        a = eligible[distribution(generator)];
+    int                                        b = eligible[distribution(generator)];
+    return is_less_loaded(hosts[b], hosts[a]) ? b : a;
+  }
+};
+
+// Highest exponentially smoothed fitness, filters out the noise of single samples
+class ewma_policy : public swarm::policy::placement
+{
+public:
+  int select(const std::vector<swarm::policy::host_view_t>& hosts) override
+  {
+    int best = -1;
+    for (int i : get_eligible(hosts)) {
+      if (best < 0 or hosts[i].smoothed_fitness > hosts[best].smoothed_fitness) {
+        best = i;
+      }
+    }
+    return best;
+  }
+};
+
+swarm::policy::placement::ptr swarm::policy::placement::make(const std::string& name)
+{
+  if (name == "least-loaded") {
+    return ptr(new least_loaded_policy);
+  }
+  if (name == "wrr") {
+    return ptr(new wrr_policy);
+  }
+  if (name == "p2c") {
+    return ptr(new p2c_policy);
+  }
+  if (name == "ewma") {
+    return ptr(new ewma_policy);
+  }
+  return nullptr;
+}
+
+swarm::policy::placement::ptr swarm::policy::placement::make()
+{
+  const char* name_c = getenv(SWARM_ENV_VAR_POLICY);
+  if (name_c == nullptr) {
+    name_c = SWARM_DEFAULT_POLICY;
+  }
+
+  ptr policy = make(name_c);
+  if (policy == nullptr) {
+    fprintf(stderr, "Warning: unknown placement policy '%s', using '%s'\n", name_c, SWARM_DEFAULT_POLICY);
+    policy = make(SWARM_DEFAULT_POLICY);
+  }
+
+  return policy;
+}
+
+// Serializes the selections of the process policy, the random generator of p2c is not thread-safe
+class shared_policy : public swarm::policy::placement
+{
+private:
+  std::mutex mutex;
+  ptr        policy;
+
+public:
+  explicit shared_policy(ptr policy_) : policy(std::move(policy_)) {}
+
+  int select(const std::vector<swarm::policy::host_view_t>& hosts) override
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    return policy->select(hosts);
+  }
+};
+
+swarm::policy::placement& swarm::policy::placement::get()
+{
+  // Never destroyed, detached threads may still select hosts while the process exits
+  static placement* policy = new shared_policy(make());
+  return *policy;
+}
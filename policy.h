@@ -0,0 +1,69 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_POLICY_H
+#define SWARM_POLICY_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace swarm {
+namespace policy {
+
+// Host as seen by the placement policies
+struct host_view_t {
+  bool     valid;            ///< The last sample succeeded
+  double   fitness;          ///< Higher is better
+  uint32_t free_slots;       ///< Job slots left, a policy never selects a host without free slots
+  double   smoothed_fitness; ///< Fitness exponentially smoothed over the samples
+  int64_t  credit;           ///< Weighted round robin credit of the selections so far
+};
+
+// Fitness of a host from its CPU utilization and latency, higher is better
+double compute_fitness(int cpu_percent, int latency_ms);
+
+// Advances the weighted round robin credits once the selected host takes a job
+void update_credits(const std::vector<host_view_t>& hosts, int selected, std::vector<int64_t>& credits);
+
+// Most selections happen in short-lived swarm-cc processes, so the policies keep no state between selections. The
+// smoothed fitness and the credits are kept by swarm-lb and come with the hosts.
+class placement
+{
+public:
+  virtual ~placement() = default;
+
+  // Returns the index of the selected host, -1 if no host is eligible
+  virtual int select(const std::vector<host_view_t>& hosts) = 0;
+
+  typedef std::unique_ptr<placement> ptr;
+
+  // Creates a policy by name: least-loaded, wrr, p2c or ewma. Returns nullptr for unknown names
+  static ptr make(const std::string& name);
+
+  // Creates the policy selected in the environment, an unknown name falls back to the default policy
+  static ptr make();
+
+  // Policy selected in the environment, created once per process. Thread-safe.
+  static placement& get();
+};
+
+} // namespace policy
+} // namespace swarm
+
+#endif // SWARM_POLICY_H
@@ -0,0 +1,429 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "pump.h"
+#include "config.h"
+#include "hash.h"
+#include "string_helpers.h"
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Include search paths given in the compiler arguments
+struct search_path_t {
+  std::vector<std::string> quote;   ///< -iquote, only for quoted includes
+  std::vector<std::string> bracket; ///< -I
+  std::vector<std::string> system;  ///< -isystem and -idirafter, left out of the -MMD dependencies
+  std::vector<std::string> forced;  ///< -include and -imacros files
+};
+
+static bool is_file(const std::string& path)
+{
+  struct stat st = {};
+  return stat(path.c_str(), &st) == 0 and S_ISREG(st.st_mode);
+}
+
+// Joins the directory and the name the way the preprocessor names the file
+static std::string join_path(const std::string& dir, const std::string& name)
+{
+  if (name.front() == '/' or dir.empty() or dir == ".") {
+    return name;
+  }
+  return (dir.back() == '/') ? dir + name : dir + "/" + name;
+}
+
+static std::string get_dirname(const std::string& path)
+{
+  std::size_t pos = path.find_last_of('/');
+  if (pos == std::string::npos) {
+    return ".";
+  }
+  return (pos == 0) ? "/" : path.substr(0, pos);
+}
+
+// Parses an include directive, returns false if the line is not one. A name that is not between quotes nor angle
+// brackets is computed by a macro.
+static bool parse_include(const std::string& line, std::string& name, bool& quoted, bool& next, bool& computed)
+{
+  std::size_t i = line.find_first_not_of(" \t");
+  if (i == std::string::npos or line[i] != '#') {
+    return false;
+  }
+  i = line.find_first_not_of(" \t", i + 1);
+  if (i == std::string::npos) {
+    return false;
+  }
+
+  static const std::vector<std::string> directives = {"include_next", "include", "import"};
+  std::size_t                           length     = 0;
+  for (const std::string& directive : directives) {
+    if (line.compare(i, directive.size(), directive) == 0) {
+      length = directive.size();
+      next   = (directive == "include_next");
+      break;
+    }
+  }
+  if (length == 0) {
+    return false;
+  }
+
+  computed = true;
+  i        = line.find_first_not_of(" \t", i + length);
+  if (i == std::string::npos or (line[i] != '"' and line[i] != '<')) {
+    return true;
+  }
+
+  quoted          = (line[i] == '"');
+  std::size_t end = line.find(quoted ? '"' : '>', i + 1);
+  if (end == std::string::npos) {
+    return true;
+  }
+
+  name     = line.substr(i + 1, end - i - 1);
+  computed = false;
+  return true;
+}
+
+// Follows the includes of every file. The conditions are not evaluated, so a file may be listed even if the
+// preprocessor skips it. The includes not found in the given paths are expected in the remote system headers.
+class scanner
+{
+private:
+  const search_path_t&  paths;
+  std::set<std::string> visited;
+
+public:
+  std::vector<std::string> files;
+  std::set<std::string>    system_files;
+  bool                     computed = false;
+
+  explicit scanner(const search_path_t& paths_) : paths(paths_) {}
+
+  // Resolves the include of the current file, an include_next takes every match
+  void resolve(const std::string& current,
+               const std::string& name,
+               bool               quoted,
+               bool               next,
+               std::vector<std::pair<std::string, bool>>& found)
+  {
+    if (name.empty()) {
+      return;
+    }
+
+    if (name.front() == '/') {
+      if (is_file(name)) {
+        found.emplace_back(name, false);
+      }
+      return;
+    }
+
+    std::vector<std::pair<std::string, bool>> dirs;
+    if (quoted) {
+      dirs.emplace_back(get_dirname(current), false);
+      for (const std::string& dir : paths.quote) {
+        dirs.emplace_back(dir, false);
+      }
+    }
+    for (const std::string& dir : paths.bracket) {
+      dirs.emplace_back(dir, false);
+    }
+    for (const std::string& dir : paths.system) {
+      dirs.emplace_back(dir, true);
+    }
+
+    for (const std::pair<std::string, bool>& dir : dirs) {
+      std::string candidate = join_path(dir.first, name);
+      if (is_file(candidate)) {
+        found.emplace_back(candidate, dir.second);
+        if (not next) {
+          return;
+        }
+      }
+    }
+  }
+
+  void scan(const std::string& path, bool is_system)
+  {
+    if (not visited.insert(path).second) {
+      return;
+    }
+
+    files.push_back(path);
+    if (is_system) {
+      system_files.insert(path);
+    }
+
+    std::ifstream file(path);
+    std::string   line;
+    while (std::getline(file, line)) {
+      std::string name;
+      bool        quoted = false, next = false, computed_ = false;
+      if (not parse_include(line, name, quoted, next, computed_)) {
+        continue;
+      }
+      if (computed_) {
+        computed = true;
+        continue;
+      }
+
+      std::vector<std::pair<std::string, bool>> found;
+      resolve(path, name, quoted, next, found);
+      for (const std::pair<std::string, bool>& include : found) {
+        scan(include.first, is_system or include.second);
+      }
+    }
+  }
+};
+
+// Escapes a file name for a dependency file
+static std::string escape_dep(const std::string& name)
+{
+  std::string ret;
+  for (char c : name) {
+    if (c == ' ' or c == '#') {
+      ret += '\\';
+    } else if (c == '$') {
+      ret += '$';
+    }
+    ret += c;
+  }
+  return ret;
+}
+
+// Absolute paths are moved under the remote root, the relative ones follow the working directory. The path is quoted
+// for the remote shell.
+static std::string get_remote_path(const std::string& path)
+{
+  std::string quoted = swarm::string_helpers::quote(path);
+  return (not path.empty() and path.front() == '/') ? "\"$R\"" + quoted : quoted;
+}
+
+bool swarm::pump::is_enabled()
+{
+  const char* pump_c = getenv(SWARM_ENV_VAR_PUMP);
+
+  return pump_c != nullptr and std::string(pump_c) != "0";
+}
+
+// Splits the argument into the option, the longest of the given ones it starts with, and its value, either joined or
+// the following argument. Returns false if the argument is none of the options.
+static bool get_option(const swarm::args&              args,
+                       std::size_t&                    i,
+                       const std::vector<std::string>& options,
+                       std::string&                    option,
+                       std::string&                    value)
+{
+  const std::string& arg = args.at(i);
+
+  option.clear();
+  for (const std::string& candidate : options) {
+    if (candidate.size() > option.size() and arg.compare(0, candidate.size(), candidate) == 0) {
+      option = candidate;
+    }
+  }
+  if (option.empty()) {
+    return false;
+  }
+
+  value.clear();
+  if (arg.size() > option.size()) {
+    value = arg.substr(option.size());
+  } else if (i + 1 < args.size() and args.kind(i + 1) == swarm::ARG_VALUE) {
+    value = args.at(++i);
+  }
+  return true;
+}
+
+bool swarm::pump::prepare(const args&        args,
+                          const std::string& source_file,
+                          const std::string& object_file,
+                          unit_t&            unit)
+{
+  // Preprocessor options pump mode understands, the others need the local preprocessor
+  static const std::vector<std::string> path_options = {
+      "-iquote", "-isystem", "-idirafter", "-include", "-imacros", "-I"};
+  static const std::vector<std::string> dep_options   = {"-MD", "-MMD", "-MP", "-MF", "-MT", "-MQ"};
+  static const std::vector<std::string> macro_options = {"-D", "-U", "-nostdinc", "-nostdinc++", "-undef"};
+
+  search_path_t paths;
+  std::string   command = args.at(0);
+  bool          md = false, mmd = false, mp = false;
+  std::string   depfile, deptarget;
+
+  for (std::size_t i = 1; i < args.size(); i++) {
+    const std::string& arg = args.at(i);
+    std::string        option, value;
+
+    // The output is added by the job, its separate value follows
+    if (args.kind(i) == ARG_OUTPUT) {
+      if (arg.size() == 2 and i + 1 < args.size() and args.kind(i + 1) == ARG_VALUE) {
+        i++;
+      }
+      continue;
+    }
+
+    // Only the compilations into objects are pumped
+    if (arg == "-E" or arg == "-S" or arg == "-I-") {
+      return false;
+    }
+
+    if (args.kind(i) == ARG_SOURCE) {
+      command += " " + get_remote_path(arg);
+      continue;
+    }
+
+    if (args.kind(i) != ARG_PREPROCESSOR) {
+      command += " " + arg;
+      continue;
+    }
+
+    // The dependencies are written locally, -Wp,-MD,<file> and -Wp,-MMD,<file> name the file too
+    if (arg.compare(0, 4, "-Wp,") == 0) {
+      std::vector<std::string> wp = string_helpers::split(arg.substr(4), ',');
+      if (wp.size() != 2 or (wp[0] != "-MD" and wp[0] != "-MMD")) {
+        return false;
+      }
+      md      = md or wp[0] == "-MD";
+      mmd     = mmd or wp[0] == "-MMD";
+      depfile = wp[1];
+      continue;
+    }
+    if (get_option(args, i, dep_options, option, value)) {
+      md  = md or option == "-MD";
+      mmd = mmd or option == "-MMD";
+      mp  = mp or option == "-MP";
+      if (option == "-MF") {
+        depfile = value;
+      } else if (option == "-MT" or option == "-MQ") {
+        deptarget += (deptarget.empty() ? "" : " ") + value;
+      }
+      continue;
+    }
+
+    // Include paths and forced includes
+    if (get_option(args, i, path_options, option, value)) {
+      if (option == "-iquote") {
+        paths.quote.push_back(value);
+      } else if (option == "-isystem" or option == "-idirafter") {
+        paths.system.push_back(value);
+      } else if (option == "-include" or option == "-imacros") {
+        paths.forced.push_back(value);
+      } else {
+        paths.bracket.push_back(value);
+      }
+
+      command += " " + option + " " + get_remote_path(value);
+      continue;
+    }
+
+    // Macros go as they are, with their separate value
+    std::size_t first = i;
+    if (get_option(args, i, macro_options, option, value)) {
+      for (; first <= i; first++) {
+        command += " " + args.at(first);
+      }
+      continue;
+    }
+
+    // Anything else, for instance -M, -MG or -Xpreprocessor, needs the local preprocessor
+    return false;
+  }
+
+  // The remote root never shows in the object
+  command += " \"-ffile-prefix-map=$R=\"";
+
+  // Follow the includes from the source and the forced includes, which are searched from the working directory
+  scanner scan(paths);
+  scan.scan(source_file, false);
+  for (const std::string& forced : paths.forced) {
+    std::vector<std::pair<std::string, bool>> found;
+    if (is_file(forced)) {
+      found.emplace_back(forced, false);
+    } else {
+      scan.resolve(source_file, forced, true, false, found);
+    }
+    for (const std::pair<std::string, bool>& include : found) {
+      scan.scan(include.first, include.second);
+    }
+  }
+  if (scan.computed) {
+    return false;
+  }
+
+  char cwd[PATH_MAX] = {};
+  SWARM_ASSERT(getcwd(cwd, sizeof(cwd)) != nullptr, "Error getting working directory: %s", strerror(errno));
+
+  // Content address every file
+  unit.manifest.clear();
+  for (const std::string& file : scan.files) {
+    std::string path = (file.front() == '/') ? file : std::string(cwd) + "/" + file;
+    std::string hash = swarm::hash::file(path);
+    if (hash.empty() or path.find('\n') != std::string::npos) {
+      return false;
+    }
+    unit.manifest += hash + " " + path + "\n";
+  }
+
+  unit.directory = cwd;
+  unit.command   = command;
+  unit.files     = scan.files;
+
+  // Dependency file as the preprocessor writes it, by default next to the object
+  unit.depfile.clear();
+  unit.deps.clear();
+  if (md or mmd) {
+    unit.depfile = depfile;
+    if (unit.depfile.empty()) {
+      std::size_t pos = object_file.find_last_of('.');
+      unit.depfile    = object_file.substr(0, pos) + ".d";
+    }
+
+    unit.deps = (deptarget.empty() ? escape_dep(object_file) : deptarget) + ":";
+    for (const std::string& file : scan.files) {
+      if (not md and scan.system_files.count(file) != 0) {
+        continue;
+      }
+      unit.deps += " \\\n " + escape_dep(file);
+    }
+    unit.deps += "\n";
+
+    // Phony target for every header
+    for (std::size_t i = 1; mp and i < scan.files.size(); i++) {
+      if (md or scan.system_files.count(scan.files[i]) == 0) {
+        unit.deps += "\n" + escape_dep(scan.files[i]) + ":\n";
+      }
+    }
+  }
+
+  return true;
+}
+
+void swarm::pump::write_deps(const unit_t& unit)
+{
+  if (unit.depfile.empty()) {
+    return;
+  }
+
+  std::ofstream file(unit.depfile, std::ios::trunc);
+  file << unit.deps;
+  SWARM_ASSERT(file.good(), "Error writing '%s'", unit.depfile.c_str());
+}
@@ -0,0 +1,52 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_PUMP_H
+#define SWARM_PUMP_H
+
+#include "args.h"
+#include <string>
+#include <vector>
+
+namespace swarm {
+namespace pump {
+
+// Translation unit preprocessed in the remote host. The source and the headers found in the include paths are mirrored
+// under a remote root, the system headers are the ones of the remote host.
+struct unit_t {
+  std::string              manifest;  ///< Lines "<hash> <absolute path>" of the files to mirror
+  std::string              directory; ///< Working directory, mirrored too
+  std::string              command;   ///< Remote compile command without output, its paths under the root $R
+  std::string              depfile;   ///< Dependency file requested by the arguments, empty if none
+  std::string              deps;      ///< Content of the dependency file
+  std::vector<std::string> files;     ///< Mirrored files as named by the preprocessor
+};
+
+// Pump mode is disabled unless SWARM_PUMP is set to other than 0
+bool is_enabled();
+
+// Scans the includes of the source and builds the remote command. Returns false if the arguments or some include need
+// the local preprocessor, for instance an include computed by a macro.
+bool prepare(const args& args, const std::string& source_file, const std::string& object_file, unit_t& unit);
+
+// Writes the dependency file, if requested, as the local preprocessor would have done
+void write_deps(const unit_t& unit);
+
+} // namespace pump
+} // namespace swarm
+
+#endif // SWARM_PUMP_H
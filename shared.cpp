@@ -17,175 +17,487 @@
 
 #include "shared.h"
 #include "config.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
 #include <cstring>
 #include <fcntl.h>
-#include <semaphore.h>
+#include <linux/futex.h>
+#include <mutex>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
 #include <unistd.h>
 
-class shared_memory_impl : public swarm::shared::memory
+#define SWARM_IPC_MAGIC 0x53574d51U
+#define SWARM_IPC_CACHE_LINE 64
+
+// Slot reply states, the futex word the client waits on
+#define SLOT_PENDING 0U
+#define SLOT_REPLIED 1U
+#define SLOT_ABANDONED 2U
+
+static int futex_wait(std::atomic<uint32_t>* word, uint32_t value, int timeout_ms)
+{
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+  return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, value, &ts, nullptr, 0);
+}
+
+static void futex_wake(std::atomic<uint32_t>* word, int count)
+{
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, count, nullptr, nullptr, 0);
+}
+
+static bool is_process_alive(pid_t pid)
+{
+  return pid > 0 and (kill(pid, 0) == 0 or errno != ESRCH);
+}
+
+// Segment header, written once by the server before it publishes its PID
+struct queue_header_t {
+  uint32_t                                    magic;
+  uint32_t                                    capacity;
+  uint64_t                                    request_size;
+  uint64_t                                    reply_size;
+  uint64_t                                    slot_stride;
+  std::atomic<int32_t>                        server_pid;
+  std::atomic<uint32_t>                       server_futex;
+  alignas(SWARM_IPC_CACHE_LINE) std::atomic<uint64_t> enqueue_pos;
+  alignas(SWARM_IPC_CACHE_LINE) std::atomic<uint64_t> dequeue_pos;
+};
+
+// Slot header, followed by the request and the reply. The sequence follows Vyukov's bounded queue: it equals the
+// position when the slot is free and the position plus one once the request is published. The slot is released by
+// whoever consumes the reply. The owner is zero from the release until the next client claims the slot.
+struct queue_slot_t {
+  alignas(SWARM_IPC_CACHE_LINE) std::atomic<uint64_t> sequence;
+  std::atomic<uint32_t>                               state;
+  std::atomic<int32_t>                                owner_pid;
+};
+
+static std::size_t align_up(std::size_t n)
+{
+  return (n + SWARM_IPC_CACHE_LINE - 1) / SWARM_IPC_CACHE_LINE * SWARM_IPC_CACHE_LINE;
+}
+
+class shared_queue_impl : public swarm::shared::queue
 {
 private:
   const std::string filename;
-  const std::string semaphore_req_filename;
-  const std::string semaphore_rep_filename;
-  std::size_t       size;
-  bool              unlink_after_use;
-  int               fd      = 0;
-  void*             sh_ptr  = nullptr;
-  sem_t*            sem_req = nullptr;
-  sem_t*            sem_rep = nullptr;
+  bool              is_server;
+  std::size_t       size   = 0;
+  void*             sh_ptr = nullptr;
+  queue_header_t*   header = nullptr;
 
-public:
-  shared_memory_impl(const std::string& filename_, std::size_t size_, bool unlink_after_use_) :
-    filename(filename_),
-    semaphore_req_filename(filename_ + ".req"),
-    semaphore_rep_filename(filename_ + ".rep"),
-    size(size_),
-    unlink_after_use(unlink_after_use_)
+  // Claimed slot the server is waiting for its request to be published
+  std::mutex                            stalled_mutex;
+  uint64_t                              stalled_pos = UINT64_MAX;
+  std::chrono::steady_clock::time_point stalled_since;
+
+  queue_slot_t* get_slot(uint64_t pos)
   {
-    fd = shm_open(filename.c_str(), O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
-    SWARM_ASSERT(fd >= 0, "Error opening shared memory with file name '%s': %s", filename.c_str(), strerror(errno));
+    uint8_t* base = static_cast<uint8_t*>(sh_ptr) + align_up(sizeof(queue_header_t));
+    return reinterpret_cast<queue_slot_t*>(base + (pos % header->capacity) * header->slot_stride);
+  }
 
-    SWARM_ASSERT(ftruncate(fd, size) >= 0, "Error running truncate: %s", strerror(errno));
+  static uint8_t* get_request(queue_slot_t* slot) { return reinterpret_cast<uint8_t*>(slot) + sizeof(queue_slot_t); }
 
-    sh_ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    SWARM_ASSERT(sh_ptr != MAP_FAILED and sh_ptr != nullptr, "Error mapping shared memory: %s", strerror(errno));
+  uint8_t* get_reply(queue_slot_t* slot) { return get_request(slot) + header->request_size; }
 
-    // Open request semaphore
-    sem_req = sem_open(semaphore_req_filename.c_str(), O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, 0);
-    SWARM_ASSERT(sem_req != SEM_FAILED and sem_req != nullptr, "Error mapping request semaphore: %s", strerror(errno));
+  void release(queue_slot_t* slot, uint64_t pos)
+  {
+    slot->owner_pid.store(0, std::memory_order_relaxed);
+    slot->sequence.store(pos + header->capacity, std::memory_order_release);
+  }
 
-    // Flush semaphore
-    if (unlink_after_use) {
-      struct timespec ts = {};
-      while (sem_timedwait(sem_req, &ts) == 0) {
-        ; // Do nothing
+  // Skips a slot whose client claimed it and died before publishing its request, the stalled position would block
+  // every following request. The client gets a lease to publish and then only a dead or unknown owner is skipped.
+  // Returns true if the slot was skipped.
+  bool reclaim(queue_slot_t* slot, uint64_t pos)
+  {
+    {
+      std::unique_lock<std::mutex> lock(stalled_mutex);
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (stalled_pos != pos) {
+        stalled_pos   = pos;
+        stalled_since = now;
+        return false;
+      }
+      if (now - stalled_since < std::chrono::milliseconds(SWARM_IPC_CLAIM_LEASE_MS)) {
+        return false;
       }
     }
 
-    // Open reply semaphore
-    sem_rep = sem_open(semaphore_rep_filename.c_str(), O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, 0);
-    SWARM_ASSERT(sem_rep != SEM_FAILED and sem_rep != nullptr, "Error mapping reply semaphore: %s", strerror(errno));
+    int32_t owner = slot->owner_pid.load(std::memory_order_relaxed);
+    if (owner != 0 and is_process_alive(owner)) {
+      return false;
+    }
 
-    // Flush semaphore
-    if (unlink_after_use) {
-      struct timespec ts = {};
-      while (sem_timedwait(sem_rep, &ts) == 0) {
-        ; // Do nothing
-      }
+    // The client publishes with a compare and swap too, only one of both wins
+    uint64_t expected = pos;
+    if (not slot->sequence.compare_exchange_strong(expected, pos + header->capacity, std::memory_order_acq_rel)) {
+      return false;
     }
+    header->dequeue_pos.compare_exchange_strong(pos, pos + 1, std::memory_order_relaxed);
+    return true;
   }
 
-  ~shared_memory_impl()
+  // Claims a slot and publishes the request, returns false if the ring stays full
+  bool enqueue(const void* request, uint32_t initial_state, uint64_t& pos)
   {
-    if (fd >= 0) {
-      memset(sh_ptr, 0, size);
-      munmap(sh_ptr, size);
-      if (unlink_after_use) {
-        shm_unlink(filename.c_str());
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(SWARM_IPC_CALL_TIMEOUT_MS);
+
+    pos = header->enqueue_pos.load(std::memory_order_relaxed);
+    while (true) {
+      queue_slot_t* slot     = get_slot(pos);
+      uint64_t      sequence = slot->sequence.load(std::memory_order_acquire);
+
+      if (sequence == pos) {
+        // The slot is free, try to claim it
+        if (header->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          slot->owner_pid.store(getpid(), std::memory_order_relaxed);
+          memcpy(get_request(slot), request, header->request_size);
+          slot->state.store(initial_state, std::memory_order_relaxed);
+
+          // The server skipped the slot if this process was stalled past the lease
+          uint64_t expected = pos;
+          if (not slot->sequence.compare_exchange_strong(expected, pos + 1, std::memory_order_release)) {
+            return false;
+          }
+          break;
+        }
+      } else if (sequence < pos) {
+        // The ring is full, recover the slot if its client died after being replied
+        uint64_t owned = pos - header->capacity + 1;
+        if (sequence == owned and slot->state.load(std::memory_order_acquire) == SLOT_REPLIED and
+            not is_process_alive(slot->owner_pid.load(std::memory_order_relaxed))) {
+          slot->sequence.compare_exchange_strong(owned, pos, std::memory_order_acq_rel);
+        } else if (std::chrono::steady_clock::now() > deadline or not is_server_alive()) {
+          return false;
+        } else {
+          std::this_thread::yield();
+        }
+        pos = header->enqueue_pos.load(std::memory_order_relaxed);
+      } else {
+        pos = header->enqueue_pos.load(std::memory_order_relaxed);
       }
-      close(fd);
     }
 
-    if (sem_req) {
-      if (unlink_after_use) {
-        sem_unlink(semaphore_req_filename.c_str());
+    // Wake up a server thread
+    header->server_futex.fetch_add(1, std::memory_order_release);
+    futex_wake(&header->server_futex, 1);
+
+    return true;
+  }
+
+  bool is_server_alive() { return is_process_alive(header->server_pid.load(std::memory_order_acquire)); }
+
+public:
+  shared_queue_impl(const std::string& filename_, std::size_t request_size, std::size_t reply_size, bool is_server_) :
+    filename(filename_), is_server(is_server_)
+  {
+    std::size_t slot_stride = align_up(sizeof(queue_slot_t) + request_size + reply_size);
+    size                    = align_up(sizeof(queue_header_t)) + SWARM_IPC_QUEUE_SIZE * slot_stride;
+
+    // The server replaces any previous segment so stale slots are discarded
+    int fd = -1;
+    if (is_server) {
+      shm_unlink(filename.c_str());
+      fd = shm_open(filename.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+      SWARM_ASSERT(fd >= 0, "Error opening shared memory with file name '%s': %s", filename.c_str(), strerror(errno));
+      SWARM_ASSERT(ftruncate(fd, size) >= 0, "Error running truncate: %s", strerror(errno));
+    } else {
+      fd = shm_open(filename.c_str(), O_RDWR, 0);
+      if (fd < 0) {
+        return;
+      }
+
+      // Skip segments that the server has not sized yet
+      struct stat st = {};
+      if (fstat(fd, &st) != 0 or static_cast<std::size_t>(st.st_size) < size) {
+        close(fd);
+        return;
       }
-      sem_close(sem_req);
     }
-    if (sem_rep) {
-      if (unlink_after_use) {
-        sem_unlink(semaphore_rep_filename.c_str());
+
+    sh_ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    SWARM_ASSERT(sh_ptr != MAP_FAILED and sh_ptr != nullptr, "Error mapping shared memory: %s", strerror(errno));
+
+    header = static_cast<queue_header_t*>(sh_ptr);
+
+    if (is_server) {
+      header->magic        = SWARM_IPC_MAGIC;
+      header->capacity     = SWARM_IPC_QUEUE_SIZE;
+      header->request_size = request_size;
+      header->reply_size   = reply_size;
+      header->slot_stride  = slot_stride;
+      header->enqueue_pos.store(0, std::memory_order_relaxed);
+      header->dequeue_pos.store(0, std::memory_order_relaxed);
+      header->server_futex.store(0, std::memory_order_relaxed);
+      for (uint64_t pos = 0; pos < SWARM_IPC_QUEUE_SIZE; pos++) {
+        get_slot(pos)->sequence.store(pos, std::memory_order_relaxed);
       }
-      sem_close(sem_rep);
+
+      // Publish the queue
+      header->server_pid.store(getpid(), std::memory_order_release);
     }
   }
 
-  bool available() override
+  ~shared_queue_impl()
   {
-    struct timespec ts = {};
-    SWARM_ASSERT(clock_gettime(CLOCK_REALTIME, &ts) >= 0, "Error getting getting time");
+    if (sh_ptr == nullptr) {
+      return;
+    }
 
-    ts.tv_sec += 1;
+    if (is_server) {
+      header->server_pid.store(0, std::memory_order_release);
+      shm_unlink(filename.c_str());
+    }
 
-    int ret = sem_timedwait(sem_req, &ts);
-    SWARM_ASSERT((ret == -1 and errno == ETIMEDOUT) or ret == 0,
-                 "Unexpected semaphore wait return value (%d): %s",
-                 ret,
-                 strerror(errno));
+    munmap(sh_ptr, size);
+  }
 
-#if SWARM_SWARM_ENABLE_DEBUG_TRACE_TRACE
-    if (ret == 0) {
-      printf(" -- Request received\n");
+  // Checks the client and the server agree on the segment layout
+  bool is_valid(std::size_t request_size, std::size_t reply_size)
+  {
+    return header != nullptr and header->server_pid.load(std::memory_order_acquire) != 0 and
+           header->magic == SWARM_IPC_MAGIC and header->capacity == SWARM_IPC_QUEUE_SIZE and
+           header->request_size == request_size and header->reply_size == reply_size;
+  }
+
+  bool call(const void* request, void* reply) override
+  {
+    uint64_t pos = 0;
+    if (not is_server_alive() or not enqueue(request, SLOT_PENDING, pos)) {
+      return false;
+    }
+
+    // Wait for the reply while the server is alive
+    queue_slot_t*                         slot     = get_slot(pos);
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(SWARM_IPC_CALL_TIMEOUT_MS);
+    while (slot->state.load(std::memory_order_acquire) == SLOT_PENDING) {
+      if (std::chrono::steady_clock::now() > deadline or not is_server_alive()) {
+        // Leave the slot to the server unless the reply arrived meanwhile
+        uint32_t expected = SLOT_PENDING;
+        if (slot->state.compare_exchange_strong(expected, SLOT_ABANDONED, std::memory_order_acq_rel)) {
+          return false;
+        }
+        break;
+      }
+      futex_wait(&slot->state, SLOT_PENDING, SWARM_IPC_LIVENESS_MS);
     }
-#endif /* SWARM_ENABLE_DEBUG_TRACE */
 
-    return (ret == 0);
+    memcpy(reply, get_reply(slot), header->reply_size);
+    release(slot, pos);
+
+    return true;
   }
 
-  void write(const void* data) override
+  bool post(const void* request) override
+  {
+    uint64_t pos = 0;
+    return is_server_alive() and enqueue(request, SLOT_ABANDONED, pos);
+  }
+
+  bool serve(const handler_t& handler, int timeout_ms) override
   {
-    // Actual copy
-    memcpy(sh_ptr, data, size);
+    uint32_t      futex_value = header->server_futex.load(std::memory_order_acquire);
+    queue_slot_t* slot        = nullptr;
+    uint64_t      pos         = header->dequeue_pos.load(std::memory_order_relaxed);
+
+    // Take the oldest published request
+    while (true) {
+      slot              = get_slot(pos);
+      uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+
+      if (sequence == pos + 1) {
+        if (header->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (sequence == pos and header->enqueue_pos.load(std::memory_order_relaxed) > pos) {
+        // Claimed but not published yet
+        if (reclaim(slot, pos)) {
+          pos = header->dequeue_pos.load(std::memory_order_relaxed);
+          continue;
+        }
+        futex_wait(&header->server_futex, futex_value, timeout_ms);
+        return false;
+      } else if (sequence < pos + 1) {
+        // Empty, sleep until a client posts a request
+        futex_wait(&header->server_futex, futex_value, timeout_ms);
+        return false;
+      } else {
+        pos = header->dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
 
-#if SWARM_SWARM_ENABLE_DEBUG_TRACE_TRACE
-    printf(" -- Data written: %s\n", (const char*)data);
-#endif /* SWARM_ENABLE_DEBUG_TRACE */
+    handler(get_request(slot), get_reply(slot));
 
-    // Send reply signal
-    sem_post(sem_rep);
+    // Hand the reply over to the client, or release the slot if nobody is waiting for it
+    uint32_t expected = SLOT_PENDING;
+    if (slot->state.compare_exchange_strong(expected, SLOT_REPLIED, std::memory_order_acq_rel)) {
+      futex_wake(&slot->state, 1);
+    } else {
+      release(slot, pos);
+    }
 
-#if SWARM_SWARM_ENABLE_DEBUG_TRACE_TRACE
-    printf(" -- Reply posted\n");
-#endif /* SWARM_ENABLE_DEBUG_TRACE */
+    return true;
   }
+};
 
-  void send_request() override {}
+swarm::shared::queue::ptr
+swarm::shared::queue::make_server(const std::string& filename, std::size_t request_size, std::size_t reply_size)
+{
+  return std::make_shared<shared_queue_impl>(filename, request_size, reply_size, true);
+}
 
-  bool read(void* data) override
+swarm::shared::queue::ptr
+swarm::shared::queue::make_client(const std::string& filename, std::size_t request_size, std::size_t reply_size)
+{
+  std::shared_ptr<shared_queue_impl> q =
+      std::make_shared<shared_queue_impl>(filename, request_size, reply_size, false);
+  if (not q->is_valid(request_size, reply_size)) {
+    return nullptr;
+  }
+  return q;
+}
+
+// Snapshot segment header, the data follows as 64-bit words so the concurrent copies are atomic accesses
+struct snapshot_header_t {
+  uint32_t              magic;
+  uint64_t              size;
+  std::atomic<uint64_t> sequence; ///< Odd while the writer is updating the data
+};
+
+class shared_snapshot_impl : public swarm::shared::snapshot
+{
+private:
+  const std::string      filename;
+  bool                   is_writer;
+  std::size_t            size      = 0;
+  std::size_t            nof_words = 0;
+  void*                  sh_ptr    = nullptr;
+  snapshot_header_t*     header    = nullptr;
+  std::atomic<uint64_t>* words     = nullptr;
+
+public:
+  shared_snapshot_impl(const std::string& filename_, std::size_t data_size, bool is_writer_) :
+    filename(filename_), is_writer(is_writer_)
   {
-    // Send request signal
-    sem_post(sem_req);
+    nof_words = (data_size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    size      = align_up(sizeof(snapshot_header_t)) + nof_words * sizeof(uint64_t);
 
-#if SWARM_SWARM_ENABLE_DEBUG_TRACE_TRACE
-    printf(" -- Request posted\n");
-#endif /* SWARM_ENABLE_DEBUG_TRACE */
+    // The writer replaces any previous segment
+    int fd = -1;
+    if (is_writer) {
+      shm_unlink(filename.c_str());
+      fd = shm_open(filename.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+      SWARM_ASSERT(fd >= 0, "Error opening shared memory with file name '%s': %s", filename.c_str(), strerror(errno));
+      SWARM_ASSERT(ftruncate(fd, size) >= 0, "Error running truncate: %s", strerror(errno));
+    } else {
+      fd = shm_open(filename.c_str(), O_RDONLY, 0);
+      if (fd < 0) {
+        return;
+      }
 
-    struct timespec ts = {};
-    SWARM_ASSERT(clock_gettime(CLOCK_REALTIME, &ts) >= 0, "Error getting getting time");
+      // Skip segments that the writer has not sized yet
+      struct stat st = {};
+      if (fstat(fd, &st) != 0 or static_cast<std::size_t>(st.st_size) != size) {
+        close(fd);
+        return;
+      }
+    }
+
+    sh_ptr = mmap(nullptr, size, is_writer ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    SWARM_ASSERT(sh_ptr != MAP_FAILED and sh_ptr != nullptr, "Error mapping shared memory: %s", strerror(errno));
 
-    // Set timeout
-    ts.tv_nsec += 1UL /* ms */ * 1000UL /* to us */ * 1000UL /* to ns*/;
-    while (ts.tv_nsec > 1000UL * 1000UL * 1000UL) {
-      ts.tv_nsec -= 1000UL * 1000UL * 1000UL;
-      ts.tv_sec++;
+    header = static_cast<snapshot_header_t*>(sh_ptr);
+    words  = reinterpret_cast<std::atomic<uint64_t>*>(static_cast<uint8_t*>(sh_ptr) +
+                                                      align_up(sizeof(snapshot_header_t)));
+
+    if (is_writer) {
+      header->size = data_size;
+      header->sequence.store(0, std::memory_order_relaxed);
+      header->magic = SWARM_IPC_MAGIC;
     }
+  }
 
-    int ret = sem_timedwait(sem_rep, &ts);
-    SWARM_ASSERT(errno == ETIMEDOUT or ret == 0, "Unexpected semaphore wait return value (%d)", ret);
+  ~shared_snapshot_impl()
+  {
+    if (sh_ptr == nullptr) {
+      return;
+    }
 
-    if (ret == 0) {
-#if SWARM_SWARM_ENABLE_DEBUG_TRACE_TRACE
-      printf(" -- Reply received\n");
-#endif /* SWARM_ENABLE_DEBUG_TRACE */
+    if (is_writer) {
+      shm_unlink(filename.c_str());
+    }
 
-      memcpy(data, sh_ptr, size);
-#if SWARM_SWARM_ENABLE_DEBUG_TRACE_TRACE
-      printf(" -- Data read: %s\n", (const char*)data);
-#endif /* SWARM_ENABLE_DEBUG_TRACE */
-    } else {
-#if SWARM_SWARM_ENABLE_DEBUG_TRACE_TRACE
-      printf(" -- No reply\n");
-#endif /* SWARM_ENABLE_DEBUG_TRACE */
+    munmap(sh_ptr, size);
+  }
+
+  bool is_valid(std::size_t data_size) { return header != nullptr and header->size == data_size; }
+
+  void write(const void* data) override
+  {
+    uint64_t sequence = header->sequence.load(std::memory_order_relaxed);
+    header->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (std::size_t i = 0; i < nof_words; i++) {
+      uint64_t word = 0;
+      memcpy(&word, static_cast<const uint8_t*>(data) + i * sizeof(uint64_t),
+             std::min(sizeof(uint64_t), header->size - i * sizeof(uint64_t)));
+      words[i].store(word, std::memory_order_relaxed);
     }
 
-    return (ret == 0);
+    header->sequence.store(sequence + 2, std::memory_order_release);
+  }
+
+  bool read(void* data) override
+  {
+    for (uint32_t trial = 0; trial < SWARM_SNAPSHOT_MAX_TRIALS; trial++) {
+      uint64_t begin = header->sequence.load(std::memory_order_acquire);
+
+      // The first snapshot is not written yet, or the writer is in the middle of an update
+      if (begin == 0 or (begin & 1U) != 0) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      for (std::size_t i = 0; i < nof_words; i++) {
+        uint64_t word = words[i].load(std::memory_order_relaxed);
+        memcpy(static_cast<uint8_t*>(data) + i * sizeof(uint64_t),
+               &word,
+               std::min(sizeof(uint64_t), header->size - i * sizeof(uint64_t)));
+      }
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (header->sequence.load(std::memory_order_relaxed) == begin) {
+        return true;
+      }
+    }
+
+    return false;
   }
 };
 
-swarm::shared::memory::ptr
-swarm::shared::memory::make(const std::string& filename, std::size_t size, bool unlink_after_use)
+swarm::shared::snapshot::ptr swarm::shared::snapshot::make_writer(const std::string& filename, std::size_t size)
 {
-  return std::make_shared<shared_memory_impl>(filename, size, unlink_after_use);
-}
\ No newline at end of file
+  return std::make_shared<shared_snapshot_impl>(filename, size, true);
+}
+
+swarm::shared::snapshot::ptr swarm::shared::snapshot::make_reader(const std::string& filename, std::size_t size)
+{
+  std::shared_ptr<shared_snapshot_impl> s = std::make_shared<shared_snapshot_impl>(filename, size, false);
+  if (not s->is_valid(size)) {
+    return nullptr;
+  }
+  return s;
+}
@@ -18,49 +18,119 @@
 #ifndef SWARM_SHARED_H
 #define SWARM_SHARED_H
 
+#include "config.h"
+#include <functional>
 #include <memory>
+#include <string>
 
 namespace swarm {
 
 namespace shared {
 
-class memory
+// Multi-producer multi-consumer request queue in a shared memory segment. Every request owns a slot of the ring until
+// its reply has been read, so concurrent clients never see each other's replies.
+class queue
 {
 public:
-  virtual bool available()        = 0;
-  virtual void write(const void*) = 0;
+  typedef std::function<void(const void*, void*)> handler_t;
 
-  virtual void send_request() = 0;
-  virtual bool read(void*)    = 0;
+  virtual ~queue() = default;
 
-  typedef std::shared_ptr<memory> ptr;
+  // Enqueues a request and waits for its reply, returns false if the server is not running or did not reply in time
+  virtual bool call(const void* request, void* reply) = 0;
 
-  static ptr make(const std::string& filename, std::size_t size, bool unlink_after_use);
+  // Enqueues a request without waiting for any reply
+  virtual bool post(const void* request) = 0;
+
+  // Serves at most one request waiting up to timeout_ms for it, returns false if no request was served
+  virtual bool serve(const handler_t& handler, int timeout_ms) = 0;
+
+  typedef std::shared_ptr<queue> ptr;
+
+  // Creates the queue replacing any previous one, the segment is removed when the server is destroyed
+  static ptr make_server(const std::string& filename, std::size_t request_size, std::size_t reply_size);
+
+  // Attaches to a server queue, returns nullptr if it does not exist
+  static ptr make_client(const std::string& filename, std::size_t request_size, std::size_t reply_size);
 };
 
-template <class T>
+template <class REQ, class REP>
 class reply
 {
 private:
-  memory::ptr m = nullptr;
+  queue::ptr q = nullptr;
 
 public:
-  reply(const std::string& filename) { m = memory::make(filename, sizeof(T), true); }
-  bool         available() { return m->available(); }
-  virtual void write(const T& data) { m->write(&data); }
+  explicit reply(const std::string& filename) { q = queue::make_server(filename, sizeof(REQ), sizeof(REP)); }
+
+  // Thread-safe, several threads may serve the same queue
+  bool serve(const std::function<void(const REQ&, REP&)>& handler, int timeout_ms = SWARM_IPC_SERVE_TIMEOUT_MS)
+  {
+    return q->serve(
+        [&handler](const void* req, void* rep) {
+          handler(*static_cast<const REQ*>(req), *static_cast<REP*>(rep));
+        },
+        timeout_ms);
+  }
 };
 
-template <class T>
+template <class REQ, class REP>
 class request
 {
 private:
-  memory::ptr m = nullptr;
+  queue::ptr q = nullptr;
+
+public:
+  explicit request(const std::string& filename) { q = queue::make_client(filename, sizeof(REQ), sizeof(REP)); }
+
+  bool call(const REQ& req, REP& rep) { return q != nullptr and q->call(&req, &rep); }
+  bool post(const REQ& req) { return q != nullptr and q->post(&req); }
+};
+
+// Single writer snapshot in a shared memory segment protected by a sequence lock. Readers never block the writer nor
+// each other, they retry if the writer updated the snapshot while they were copying it.
+class snapshot
+{
+public:
+  virtual ~snapshot() = default;
+
+  virtual void write(const void* data) = 0;
+
+  // Returns false if no consistent copy could be taken
+  virtual bool read(void* data) = 0;
+
+  typedef std::shared_ptr<snapshot> ptr;
+
+  // Creates the segment replacing any previous one, the segment is removed when the writer is destroyed
+  static ptr make_writer(const std::string& filename, std::size_t size);
+
+  // Attaches to a writer segment, returns nullptr if it does not exist
+  static ptr make_reader(const std::string& filename, std::size_t size);
+};
+
+template <class T>
+class publisher
+{
+private:
+  snapshot::ptr s = nullptr;
+
+public:
+  explicit publisher(const std::string& filename) { s = snapshot::make_writer(filename, sizeof(T)); }
+
+  // Not thread-safe, concurrent writers shall be serialized by the caller
+  void publish(const T& data) { s->write(&data); }
+};
+
+template <class T>
+class subscriber
+{
+private:
+  snapshot::ptr s = nullptr;
 
 public:
-  request(const std::string& filename) { m = memory::make(filename, sizeof(T), false); }
+  explicit subscriber(const std::string& filename) { s = snapshot::make_reader(filename, sizeof(T)); }
 
-  void send_request() { m->send_request(); }
-  bool read(T& data) { return m->read(&data); }
+  bool read(T& data) { return s != nullptr and s->read(&data); }
 };
 
 } // namespace shared
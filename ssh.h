@@ -15,8 +15,13 @@
  *
  */
 
+#include "config.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <sys/types.h>
 #include <vector>
 
 #ifndef SWARM_SSH
@@ -25,53 +30,108 @@
 namespace swarm {
 namespace ssh {
 
+// Status of a command that did not complete because of the connection or the local output, never an exit status
+static const int transport_error = -1;
+
 class channel
 {
 public:
-  virtual int execute(const std::string& command) = 0;
-  virtual int top(double measure_time_s)          = 0;
+  // Executes the command forwarding its standard output and error into the given file descriptors, returns the
+  // command exit status or transport_error
+  virtual int execute(const std::string& command, int stdout_fd = 1, int stderr_fd = 2) = 0;
+
+  // Executes the command streaming stdin_fd into its standard input while forwarding its output. A non-zero
+  // compression level compresses the input and decompresses the standard output.
+  virtual int execute_stream(const std::string& command,
+                             int                stdin_fd,
+                             int                stdout_fd,
+                             int                stderr_fd,
+                             int                compression_level = 0) = 0;
 };
 
 typedef std::shared_ptr<channel> channel_ptr;
 
-class sftp_write
+// Long-lived remote command exchanging raw bytes through its standard input and output
+class stream
 {
 public:
-  virtual void push_directory(const std::string& path) = 0;
+  typedef std::function<void(const char* data, std::size_t nbytes)> handler_t;
+
+  virtual ~stream() = default;
 
-  virtual void push_file(const std::string& filename, const std::size_t& size) = 0;
+  // Queues bytes for the remote standard input waiting while too many are queued, thread-safe. Returns false once the
+  // stream stopped.
+  virtual bool write(const char* data, std::size_t nbytes) = 0;
 
-  virtual void write(const char* buffer, std::size_t nbytes) = 0;
+  // Makes run return, thread-safe
+  virtual void stop() = 0;
+
+  // Exchanges data until stop is called, passing the remote standard output to the handler. Returns false if the
+  // connection failed or the remote command exited. A single thread runs the stream.
+  virtual bool run(const handler_t& handler) = 0;
 };
 
-typedef std::shared_ptr<sftp_write> sftp_write_ptr;
+typedef std::shared_ptr<stream> stream_ptr;
+
+// Host resources snapshot, CPU counters are cumulative jiffies over all cores
+struct telemetry_sample_t {
+  std::chrono::steady_clock::time_point timestamp;
+  int                                   nof_cores;
+  uint64_t                              cpu_busy;
+  uint64_t                              cpu_total;
+  double                                load_1m;
+  uint64_t                              mem_total_kb;
+  uint64_t                              mem_available_kb;
+};
 
-class sftp_read
+class telemetry
 {
 public:
-  virtual bool        is_eof()                               = 0;
-  virtual std::size_t read(void* buffer, std::size_t nbytes) = 0;
+  virtual ~telemetry() = default;
+
+  // Asks the agent for an immediate snapshot
+  virtual void request() = 0;
+
+  // Waits for the next snapshot, returns false on timeout or if the agent stopped
+  virtual bool read(telemetry_sample_t& sample, int timeout_ms) = 0;
+
+  // Discards the snapshots received so far
+  virtual void drain() = 0;
+
+  // CPU utilization percent between two snapshots, -1 if it cannot be computed
+  static int cpu_percent(const telemetry_sample_t& prev, const telemetry_sample_t& curr);
 };
 
-typedef std::shared_ptr<sftp_read> sftp_read_ptr;
+typedef std::shared_ptr<telemetry> telemetry_ptr;
 
+// Sessions never exit on connection errors, the factories return nullptr and the transfers false so the caller can go
+// to another host
 class session
 {
 public:
-  virtual std::string    get_hostname() const                                                                     = 0;
-  virtual channel_ptr    make_channel()                                                                           = 0;
-  virtual sftp_write_ptr make_sftp_write(const std::string& location)                                             = 0;
-  virtual sftp_read_ptr  make_sftp_read(const std::string& location)                                              = 0;
-  virtual void           sftp_copy_local_to_remote(const std::string& local_path, const std::string& remote_path) = 0;
-  virtual void           sftp_copy_remote_to_local(const std::string& remote_path, const std::string& local_path) = 0;
-  virtual int            top(double measure_time_s)                                                               = 0;
-  virtual double         fitness(double measure_time_s, int* cpu_percent, int* latency_ms)                        = 0;
+  virtual std::string   get_hostname() const                                                                     = 0;
+  virtual channel_ptr   make_channel()                                                                           = 0;
+  virtual stream_ptr    make_stream(const std::string& command)                                                  = 0;
+  virtual bool          sftp_copy_local_to_remote(const std::string& local_path, const std::string& remote_path) = 0;
+  virtual bool          sftp_copy_remote_to_local(const std::string& remote_path, const std::string& local_path) = 0;
+  virtual telemetry_ptr make_telemetry(double interval_s)                                                        = 0;
+  virtual int           top(double measure_time_s)                                                               = 0;
+
+  // Samples the host load, the CPU is measured over at least the measuring time and the previous value is kept until
+  // then. The CPU is -1 until the first measurement, the latency is -1 if the host could not be reached. Returns zero
+  // if either of them is unknown.
+  virtual double fitness(double measure_time_s, int* cpu_percent, int* latency_ms) = 0;
+
+  // Last snapshot taken by fitness, all zeros if there is none
+  virtual telemetry_sample_t get_last_sample() const = 0;
 };
 
 typedef std::shared_ptr<session> session_ptr;
 
+// Connects and authenticates, returns nullptr if the host is not reachable
 SWARM_API session_ptr make_session(const std::string& hostname);
 
+// Connects to the least loaded of the hosts, returns nullptr if none of them is reachable
 SWARM_API session_ptr make_session(const std::vector<std::string>& hostnames);
 
 } // namespace ssh
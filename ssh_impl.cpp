@@ -15,32 +15,259 @@
  *
  */
 
+#include "compress.h"
 #include "config.h"
+#include "policy.h"
 #include "ssh.h"
 #include "string_helpers.h"
+#include "trace.h"
+#ifdef SWARM_HAVE_MOCK
+#include "ssh_mock.h"
+#endif // SWARM_HAVE_MOCK
+#include <algorithm>
 #include <cerrno>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
-#include <fstream>
+#include <libssh/callbacks.h>
 #include <libssh/libssh.h>
+#include <libssh/sftp.h>
+#include <mutex>
+#include <poll.h>
+#include <set>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
+// Asynchronous SFTP requests are available from libssh 0.11
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 11, 0)
+#define SWARM_HAVE_SFTP_AIO
+#endif // LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 11, 0)
+
 namespace swarm {
 namespace ssh {
 
+static bool write_all(int fd, const char* buffer, std::size_t nbytes)
+{
+  while (nbytes > 0) {
+    ssize_t n = write(fd, buffer, nbytes);
+    if (n < 0 and errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buffer += n;
+    nbytes -= n;
+  }
+  return true;
+}
+
+// Command driven by the session event from the caller thread, which sleeps in the event until a packet or the input
+// arrives. The channels of a session run one at a time, none of the callers runs several channels of the same session
+// concurrently.
 class channel_impl : public channel
 {
 private:
+  ssh_session session = nullptr;
+  ssh_event   event   = nullptr; ///< Event of the session, the channels of a session take turns polling it
   ssh_channel channel = nullptr;
+  std::string hostname;
+
+  // State shared with the libssh callbacks
+  struct ssh_channel_callbacks_struct callbacks    = {};
+  int                                 stdout_fd    = 1;
+  int                                 stderr_fd    = 2;
+  int                                 stdin_fd     = -1;
+  compress::stream::ptr               compressor   = nullptr;
+  compress::stream::ptr               decompressor = nullptr;
+  std::vector<char>                   input;
+  std::vector<char>                   pending;
+  std::vector<char>                   decompressed;
+  std::size_t                         pending_offset = 0;
+  bool                                input_eof      = false;
+  bool                                remote_eof     = false;
+  bool                                remote_closed  = false;
+  bool                                has_status     = false;
+  int                                 exit_status    = -1;
+  bool                                write_error    = false;
+  bool                                decode_error   = false;
+  bool                                input_error    = false; ///< The input could not be read nor compressed
+  uint64_t                            nof_sent       = 0; ///< Bytes on the wire, after compression
+  uint64_t                            nof_received   = 0;
+
+  static int on_data(ssh_session, ssh_channel, void* data, uint32_t len, int is_stderr, void* userdata)
+  {
+    channel_impl* self   = static_cast<channel_impl*>(userdata);
+    const char*   buffer = static_cast<const char*>(data);
+    std::size_t   nbytes = len;
+    self->nof_received += len;
+
+    // Decompress the standard output before forwarding it
+    if (not is_stderr and self->decompressor != nullptr) {
+      self->decompressed.clear();
+      if (not self->decompressor->process(buffer, nbytes, self->decompressed)) {
+        self->decode_error = true;
+      }
+      buffer = self->decompressed.data();
+      nbytes = self->decompressed.size();
+    }
+
+    if (not write_all(is_stderr ? self->stderr_fd : self->stdout_fd, buffer, nbytes)) {
+      self->write_error = true;
+    }
+
+    // All the bytes are always consumed
+    return static_cast<int>(len);
+  }
+
+  static void on_eof(ssh_session, ssh_channel, void* userdata)
+  {
+    static_cast<channel_impl*>(userdata)->remote_eof = true;
+  }
+
+  static void on_close(ssh_session, ssh_channel, void* userdata)
+  {
+    static_cast<channel_impl*>(userdata)->remote_closed = true;
+  }
+
+  static void on_exit_status(ssh_session, ssh_channel, int status, void* userdata)
+  {
+    channel_impl* self = static_cast<channel_impl*>(userdata);
+    self->exit_status  = status;
+    self->has_status   = true;
+  }
+
+  static int on_input(socket_t fd, int, void* userdata)
+  {
+    channel_impl* self = static_cast<channel_impl*>(userdata);
+
+    self->pending.clear();
+    self->pending_offset = 0;
+
+    ssize_t n = read(fd, self->input.data(), self->input.size());
+    if (n > 0) {
+      if (self->compressor != nullptr) {
+        self->input_error = not self->compressor->process(self->input.data(), n, self->pending);
+      } else {
+        self->pending.assign(self->input.data(), self->input.data() + n);
+      }
+    } else if (n == 0) {
+      self->input_eof = true;
+      if (self->compressor != nullptr) {
+        self->input_error = not self->compressor->finish(self->pending);
+      }
+    } else if (errno != EINTR and errno != EAGAIN) {
+      // A truncated input must never reach the remote command as a complete one
+      fprintf(stderr, "Error reading the input of %s: %s\n", self->hostname.c_str(), strerror(errno));
+      self->input_error = true;
+    }
+
+    return 0;
+  }
+
+  // Runs the command until the remote side finishes, sleeping in the session event while there is nothing to do
+  int run(const std::string& command)
+  {
+    if (channel == nullptr) {
+      fprintf(stderr, "Error creating SSH channel: %s\n", ssh_get_error(session));
+      return transport_error;
+    }
+
+    ssh_callbacks_init(&callbacks);
+    callbacks.userdata                     = this;
+    callbacks.channel_data_function        = on_data;
+    callbacks.channel_eof_function         = on_eof;
+    callbacks.channel_close_function       = on_close;
+    callbacks.channel_exit_status_function = on_exit_status;
+    if (ssh_set_channel_callbacks(channel, &callbacks) != SSH_OK or ssh_channel_open_session(channel) != SSH_OK or
+        ssh_channel_request_exec(channel, command.c_str()) != SSH_OK) {
+      fprintf(stderr, "Error opening SSH channel: %s\n", ssh_get_error(session));
+      return transport_error;
+    }
+
+    if (event == nullptr) {
+      fprintf(stderr, "Error creating SSH event: %s\n", ssh_get_error(session));
+      ssh_remove_channel_callbacks(channel, &callbacks);
+      return transport_error;
+    }
+
+    bool eof_sent      = false;
+    bool polling_input = false;
+    bool failed        = false;
+    input_eof          = (stdin_fd < 0);
+
+    while (not failed and not remote_closed and not(remote_eof and has_status)) {
+      // Send as much input as the remote window allows, the window adjustment wakes up the event
+      if (pending_offset < pending.size()) {
+        uint32_t window = ssh_channel_window_size(channel);
+        if (window > 0) {
+          uint32_t nbytes = std::min<std::size_t>(pending.size() - pending_offset, window);
+          int      n      = ssh_channel_write(channel, pending.data() + pending_offset, nbytes);
+          if (n < 0) {
+            fprintf(stderr, "Error writing in SSH channel: %s\n", ssh_get_error(session));
+            failed = true;
+            break;
+          }
+          pending_offset += n;
+          nof_sent += n;
+        }
+      }
+
+      // Signal the end of the input
+      if (input_eof and pending_offset == pending.size() and not eof_sent) {
+        ssh_channel_send_eof(channel);
+        eof_sent = true;
+      }
+
+      // Listen to the input only once the previous chunk has been sent
+      bool want_input = not input_eof and pending_offset == pending.size();
+      if (want_input and not polling_input) {
+        SWARM_ASSERT(ssh_event_add_fd(event, stdin_fd, POLLIN, on_input, this) == SSH_OK, "Error polling input");
+        polling_input = true;
+      } else if (not want_input and polling_input) {
+        ssh_event_remove_fd(event, stdin_fd);
+        polling_input = false;
+      }
+
+      if (ssh_event_dopoll(event, SWARM_CHANNEL_POLL_TIMEOUT_MS) == SSH_ERROR) {
+        fprintf(stderr, "Error polling SSH channel: %s\n", ssh_get_error(session));
+        failed = true;
+      } else if (write_error) {
+        fprintf(stderr, "Error writing remote output: %s\n", strerror(errno));
+        failed = true;
+      } else if (decode_error) {
+        fprintf(stderr, "Error. Corrupted compressed output from %s\n", hostname.c_str());
+        failed = true;
+      } else if (input_error) {
+        failed = true;
+      }
+    }
+
+    if (polling_input) {
+      ssh_event_remove_fd(event, stdin_fd);
+    }
+
+    ssh_remove_channel_callbacks(channel, &callbacks);
+
+    if (failed) {
+      return transport_error;
+    }
+
+    // A channel closed without exit status lost the command, libssh reports it as -1 too
+    return has_status ? exit_status : ssh_channel_get_exit_status(channel);
+  }
 
 public:
-  explicit channel_impl(ssh_session& session)
+  channel_impl(ssh_session& session_, ssh_event event_, std::string hostname_) :
+    session(session_), event(event_), hostname(std::move(hostname_))
   {
     channel = ssh_channel_new(session);
-    SWARM_ASSERT(channel != nullptr, "Error creating new channel");
   }
 
   ~channel_impl()
@@ -49,8 +276,13 @@ public:
       return;
     }
 
+    // Stop the command instead of ending its input if the input could not be read
     if (ssh_channel_is_open(channel)) {
-      ssh_channel_send_eof(channel);
+      if (input_error) {
+        ssh_channel_request_send_signal(channel, "TERM");
+      } else {
+        ssh_channel_send_eof(channel);
+      }
 
       ssh_channel_close(channel);
     }
@@ -60,206 +292,411 @@ public:
     channel = nullptr;
   }
 
-  int execute(const std::string& command) override
+  int execute(const std::string& command, int stdout_fd_, int stderr_fd_) override
   {
-    char buffer[256];
+    trace::span span("execute");
+    span.set("host", hostname);
 
-    SWARM_ASSERT(ssh_channel_open_session(channel) == SSH_OK, "Error opening SSH channel");
+    stdout_fd = stdout_fd_;
+    stderr_fd = stderr_fd_;
 
-    SWARM_ASSERT(ssh_channel_request_exec(channel, command.c_str()) == SSH_OK, "Error opening SSH session");
-    ssh_channel_send_eof(channel);
+    int status = run(command);
 
-    while (not ssh_channel_is_eof(channel)) {
-      // Read stdout
-      int nbytes = ssh_channel_read(channel, buffer, sizeof(buffer), 0);
-      if (nbytes > 0) {
-        int n = write(1, buffer, nbytes) != (unsigned int)nbytes;
-        SWARM_ASSERT(n != nbytes, "Error writing in stdout");
-        continue;
-      }
+    span.set("bytes_received", nof_received);
+    return status;
+  }
 
-      // Read stderr
-      nbytes = ssh_channel_read(channel, buffer, sizeof(buffer), 1);
-      if (nbytes > 0) {
-        int n = write(2, buffer, nbytes) != (unsigned int)nbytes;
-        SWARM_ASSERT(n != nbytes, "Error writing in stderr");
-        continue;
-      }
+  int execute_stream(const std::string& command,
+                     int                stdin_fd_,
+                     int                stdout_fd_,
+                     int                stderr_fd_,
+                     int                compression_level) override
+  {
+    trace::span span("execute_stream");
+    span.set("host", hostname);
+
+    stdin_fd  = stdin_fd_;
+    stdout_fd = stdout_fd_;
+    stderr_fd = stderr_fd_;
+    input.resize(SWARM_SCP_BUFFER_SZ);
+
+    // Optional compression stages
+    if (compression_level > 0) {
+      compressor   = compress::stream::make_compressor(compression_level);
+      decompressor = compress::stream::make_decompressor();
+      SWARM_ASSERT(compressor != nullptr and decompressor != nullptr, "Compression is not supported in this build");
+    }
 
-      break;
+    int status = run(command);
+
+    // A truncated compressed output is a failure even if the remote command succeeded
+    decompressed.clear();
+    if (status == 0 and decompressor != nullptr and not decompressor->finish(decompressed)) {
+      fprintf(stderr, "Error. Truncated compressed output from %s\n", command.c_str());
+      status = transport_error;
     }
 
-    return ssh_channel_get_exit_status(channel);
+    span.set("bytes_sent", nof_sent);
+    span.set("bytes_received", nof_received);
+    return status;
   }
-  std::string execute_to_str(const std::string& command)
-  {
-    char        buffer[256];
-    std::string ret;
+};
 
-    SWARM_ASSERT(ssh_channel_open_session(channel) == SSH_OK, "Error opening SSH channel");
+// Long-lived command driven by the session event, the writers wake the event up through a pipe
+class stream_impl : public stream
+{
+private:
+  ssh_session session;
+  ssh_event   event        = nullptr; ///< Event of the session
+  ssh_channel channel      = nullptr;
+  int         wake_pipe[2] = {-1, -1};
+
+  // State shared with the libssh callbacks
+  struct ssh_channel_callbacks_struct callbacks     = {};
+  const handler_t*                    handler       = nullptr;
+  std::vector<char>                   early;
+  bool                                remote_closed = false;
+
+  // Bytes queued by the writers
+  std::mutex              mutex;
+  std::condition_variable drained;
+  std::vector<char>       outgoing;
+  bool                    stopped = false;
+
+  static int on_data(ssh_session, ssh_channel, void* data, uint32_t len, int is_stderr, void* userdata)
+  {
+    stream_impl* self   = static_cast<stream_impl*>(userdata);
+    const char*  buffer = static_cast<const char*>(data);
+
+    // The remote diagnostics go straight to the local standard error
+    if (is_stderr) {
+      write_all(STDERR_FILENO, buffer, len);
+    } else if (self->handler == nullptr) {
+      self->early.insert(self->early.end(), buffer, buffer + len);
+    } else {
+      (*self->handler)(buffer, len);
+    }
 
-    SWARM_ASSERT(ssh_channel_request_exec(channel, command.c_str()) == SSH_OK, "Error opening SSH session");
-    ssh_channel_send_eof(channel);
+    return static_cast<int>(len);
+  }
 
-    while (not ssh_channel_is_eof(channel)) {
-      // Read stdout
-      int nbytes = ssh_channel_read(channel, buffer, sizeof(buffer), 0);
-      if (nbytes > 0) {
-        ret += std::string(buffer);
-        continue;
-      }
+  // The remote end of the output is as good as a closed stream
+  static void on_close(ssh_session, ssh_channel, void* userdata)
+  {
+    static_cast<stream_impl*>(userdata)->remote_closed = true;
+  }
 
-      // Read stderr
-      nbytes = ssh_channel_read(channel, buffer, sizeof(buffer), 1);
-      if (nbytes > 0) {
-        ret += std::string(buffer);
-        continue;
-      }
+  static int on_wake(socket_t fd, int, void*)
+  {
+    char buffer[64];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {
+    }
+    return 0;
+  }
 
-      break;
+  void wake()
+  {
+    char c = 0;
+    if (::write(wake_pipe[1], &c, 1) < 0) {
+      // The pipe is full, the event is already awake
     }
+  }
 
-    // Ignore return status
-    //    int status = ssh_channel_get_exit_status(channel);
-    //    SWARM_ASSERT(status == 0, "Error. Remote execution finished with exit code %d", status);
+public:
+  stream_impl(ssh_session& session_, ssh_event event_, const std::string& command) : session(session_), event(event_)
+  {
+    if (pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+      return;
+    }
 
-    ssh_channel_close(channel);
+    channel = ssh_channel_new(session);
+    if (channel == nullptr) {
+      return;
+    }
 
-    return ret;
+    ssh_callbacks_init(&callbacks);
+    callbacks.userdata               = this;
+    callbacks.channel_data_function  = on_data;
+    callbacks.channel_eof_function   = on_close;
+    callbacks.channel_close_function = on_close;
+    if (ssh_set_channel_callbacks(channel, &callbacks) != SSH_OK or ssh_channel_open_session(channel) != SSH_OK or
+        ssh_channel_request_exec(channel, command.c_str()) != SSH_OK) {
+      ssh_channel_free(channel);
+      channel = nullptr;
+    }
   }
 
-  int ncore()
+  ~stream_impl()
   {
-    std::string ncore_str = execute_to_str("grep \"processor\" /proc/cpuinfo | wc -l");
-    return static_cast<int>(std::stof(ncore_str));
+    if (channel != nullptr) {
+      ssh_remove_channel_callbacks(channel, &callbacks);
+      if (ssh_channel_is_open(channel)) {
+        ssh_channel_send_eof(channel);
+        ssh_channel_close(channel);
+      }
+      ssh_channel_free(channel);
+    }
+
+    for (int fd : wake_pipe) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
   }
 
-  int top(double measure_time_s) override
+  bool is_open() const { return channel != nullptr; }
+
+  bool write(const char* data, std::size_t nbytes) override
   {
-    std::string vmstat_str =
-        execute_to_str("stat_cpu() { grep \"cpu \" /proc/stat | grep -o -m 1 \"[0-9]*\" | head -n 1; } ;S=" +
-                       std::to_string(measure_time_s) +
-                       ";C1=$(stat_cpu); sleep $S;C2=$(stat_cpu);N=$(grep \"processor\" /proc/cpuinfo | wc -l);echo "
-                       "\\(\\(100*\\($C2-$C1\\)\\)/\\($S*$N\\)\\)/100 | bc");
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [this]() { return stopped or outgoing.size() < SWARM_STREAM_MAX_PENDING_SZ; });
+    if (stopped) {
+      return false;
+    }
 
-    return std::min(static_cast<int>(std::stof(vmstat_str)), 100);
+    outgoing.insert(outgoing.end(), data, data + nbytes);
+    wake();
+    return true;
   }
-};
-class sftp_write_impl : public sftp_write
-{
-private:
-  ssh_session& session;
-  ssh_scp      scp = nullptr;
 
-public:
-  sftp_write_impl(ssh_session& session_, const std::string& location) : session(session_)
+  void stop() override
   {
-    scp = ssh_scp_new(session, SSH_SCP_WRITE | SSH_SCP_RECURSIVE, location.c_str());
-    SWARM_ASSERT(scp != nullptr, "Error allocating scp session: %s\n", ssh_get_error(session));
-    SWARM_ASSERT(ssh_scp_init(scp) == SSH_OK, "Error initializing scp writer session: %s\n", ssh_get_error(session));
+    std::unique_lock<std::mutex> lock(mutex);
+    stopped = true;
+    drained.notify_all();
+    wake();
   }
 
-  void push_directory(const std::string& path) override
+  bool run(const handler_t& handler_) override
   {
-    std::vector<std::string> dir_list = string_helpers::split(path, '/');
-    for (const std::string& dir : dir_list) {
-      for (int trial = 0; trial < SWARM_MAX_NOF_TRIALS; trial++) {
-        // Try to create directory
-        int err = ssh_scp_push_directory(scp, dir.c_str(), S_IRWXU);
+    handler = &handler_;
+    if (not early.empty()) {
+      handler_(early.data(), early.size());
+      early.clear();
+    }
+
+    if (event == nullptr or ssh_event_add_fd(event, wake_pipe[0], POLLIN, on_wake, this) != SSH_OK) {
+      fprintf(stderr, "Error creating SSH event: %s\n", ssh_get_error(session));
+      stop();
+      return false;
+    }
 
-        // Next trial
-        if (err != SSH_OK and ssh_get_error_code(session) == 1) {
-          usleep(1000);
-          continue;
+    std::vector<char> pending;
+    std::size_t       pending_offset = 0;
+    bool              failed         = false;
+
+    while (not failed and not remote_closed) {
+      // Take the queued bytes once the previous ones have been sent
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopped) {
+          break;
+        }
+        if (pending_offset == pending.size() and not outgoing.empty()) {
+          pending.swap(outgoing);
+          outgoing.clear();
+          pending_offset = 0;
+          drained.notify_all();
         }
+      }
 
-        // Otherwise, fatal error
-        SWARM_ASSERT(err == SSH_OK, "Can't create remote directory: %s\n", ssh_get_error(session));
+      // Send as much as the remote window allows, the window adjustment wakes up the event
+      if (pending_offset < pending.size()) {
+        uint32_t window = ssh_channel_window_size(channel);
+        if (window > 0) {
+          uint32_t nbytes = std::min<std::size_t>(pending.size() - pending_offset, window);
+          int      n      = ssh_channel_write(channel, pending.data() + pending_offset, nbytes);
+          if (n < 0) {
+            fprintf(stderr, "Error writing in SSH channel: %s\n", ssh_get_error(session));
+            failed = true;
+            break;
+          }
+          pending_offset += n;
+        }
+      }
 
-        break;
+      if (ssh_event_dopoll(event, SWARM_CHANNEL_POLL_TIMEOUT_MS) == SSH_ERROR) {
+        fprintf(stderr, "Error polling SSH channel: %s\n", ssh_get_error(session));
+        failed = true;
       }
     }
+
+    ssh_event_remove_fd(event, wake_pipe[0]);
+
+    // Release the writers
+    stop();
+    handler = nullptr;
+
+    return not failed and not remote_closed;
   }
+};
+
+// Long-lived agent streaming a line per snapshot, built on shell builtins so no process is spawned per sample. The
+// agent emits a snapshot every interval or as soon as a line is written into its standard input.
+class telemetry_impl : public telemetry
+{
+private:
+  ssh_session session;
+  ssh_channel channel = nullptr;
+  std::string line;
 
-  void push_file(const std::string& filename, const std::size_t& size) override
+  static std::string get_agent_command(double interval_s)
   {
-    SWARM_ASSERT(ssh_scp_push_file64(scp, filename.c_str(), size, S_IRUSR | S_IWUSR) == SSH_OK,
-                 "Can't create remote file: %s\n",
-                 ssh_get_error(session));
+    return "exec bash -c '"
+           "N=$(getconf _NPROCESSORS_ONLN); "
+           "while :; do "
+           "read -r _ u n s i w q sq st _ < /proc/stat; "
+           "read -r l _ < /proc/loadavg; "
+           "while read -r k v _; do case $k in MemTotal:) mt=$v;; MemAvailable:) ma=$v;; esac; done < /proc/meminfo; "
+           "echo \"$N $u $n $s $i $w $q $sq $st $l $mt $ma\"; "
+           "read -r -t " +
+           std::to_string(interval_s) +
+           " _ || [ $? -gt 128 ] || exit 0; "
+           "done'";
   }
 
-  void write(const char* buffer, std::size_t nbytes) override
+  static bool parse(const std::string& str, telemetry_sample_t& sample)
   {
-    if (nbytes == 0) {
-      return;
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal, mem_total, mem_available;
+
+    int n = sscanf(str.c_str(),
+                   "%d %llu %llu %llu %llu %llu %llu %llu %llu %lf %llu %llu",
+                   &sample.nof_cores,
+                   &user,
+                   &nice,
+                   &system,
+                   &idle,
+                   &iowait,
+                   &irq,
+                   &softirq,
+                   &steal,
+                   &sample.load_1m,
+                   &mem_total,
+                   &mem_available);
+    if (n != 12) {
+      return false;
     }
 
-    SWARM_ASSERT(
-        ssh_scp_write(scp, buffer, nbytes) == SSH_OK, "Can't write to remote file: %s\n", ssh_get_error(session));
+    sample.timestamp        = std::chrono::steady_clock::now();
+    sample.cpu_busy         = user + nice + system + irq + softirq + steal;
+    sample.cpu_total        = sample.cpu_busy + idle + iowait;
+    sample.mem_total_kb     = mem_total;
+    sample.mem_available_kb = mem_available;
+
+    return true;
   }
 
-  ~sftp_write_impl()
+  // Takes the next complete line from the buffer, if any
+  bool pop_line(std::string& str)
   {
-    if (scp == nullptr) {
-      return;
+    std::size_t pos = line.find('\n');
+    if (pos == std::string::npos) {
+      return false;
     }
-
-    ssh_blocking_flush(session, 10);
-
-    ssh_scp_close(scp);
-    ssh_scp_free(scp);
+    str = line.substr(0, pos);
+    line.erase(0, pos + 1);
+    return true;
   }
-};
-
-class sftp_read_impl : public sftp_read
-{
-private:
-  ssh_session& session;
-  ssh_scp      scp = nullptr;
 
 public:
-  sftp_read_impl(ssh_session& session_, const std::string& location) : session(session_)
+  telemetry_impl(ssh_session session_, double interval_s) : session(session_)
   {
-    scp = ssh_scp_new(session, SSH_SCP_READ, location.c_str());
-    SWARM_ASSERT(scp != nullptr, "Error allocating scp session: %s\n", ssh_get_error(session));
-    SWARM_ASSERT(ssh_scp_init(scp) == SSH_OK, "Error initializing scp reader session: %s\n", ssh_get_error(session));
+    channel = ssh_channel_new(session);
+    if (channel == nullptr) {
+      return;
+    }
 
-    SWARM_ASSERT(ssh_scp_pull_request(scp) == SSH_SCP_REQUEST_NEWFILE,
-                 "Error receiving information about file: %s",
-                 ssh_get_error(session));
+    // A session that cannot start the agent is as good as a dead host
+    if (ssh_channel_open_session(channel) != SSH_OK or
+        ssh_channel_request_exec(channel, get_agent_command(interval_s).c_str()) != SSH_OK) {
+      ssh_channel_free(channel);
+      channel = nullptr;
+    }
   }
 
-  bool is_eof() override { return ssh_scp_pull_request(scp) == SSH_SCP_REQUEST_EOF; }
-
-  std::size_t read(void* buffer, std::size_t nbytes) override
+  ~telemetry_impl()
   {
-    ssh_scp_accept_request(scp);
+    if (channel == nullptr) {
+      return;
+    }
+    if (ssh_channel_is_open(channel)) {
+      ssh_channel_send_eof(channel);
+      ssh_channel_close(channel);
+    }
+    ssh_channel_free(channel);
+  }
+
+  bool is_open() const { return channel != nullptr; }
+
+  void request() override { ssh_channel_write(channel, "\n", 1); }
 
-    int ret = ssh_scp_read(scp, buffer, nbytes);
+  bool read(telemetry_sample_t& sample, int timeout_ms) override
+  {
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    std::string str;
+    while (not pop_line(str)) {
+      int remaining_ms = static_cast<int>(
+          std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+      if (remaining_ms <= 0 or ssh_channel_is_eof(channel)) {
+        return false;
+      }
 
-    SWARM_ASSERT(ret != SSH_ERROR, "Error receiving file data: %s\n", ssh_get_error(session));
+      char buffer[256];
+      int  nbytes = ssh_channel_read_timeout(channel, buffer, sizeof(buffer), 0, remaining_ms);
+      if (nbytes < 0) {
+        return false;
+      }
+      line.append(buffer, nbytes);
+    }
 
-    return ret;
+    return parse(str, sample);
   }
 
-  ~sftp_read_impl()
+  void drain() override
   {
-    if (scp == nullptr) {
-      return;
+    char buffer[256];
+    int  nbytes;
+    while ((nbytes = ssh_channel_read_nonblocking(channel, buffer, sizeof(buffer), 0)) > 0) {
+      line.append(buffer, nbytes);
     }
 
-    ssh_scp_close(scp);
-    ssh_scp_free(scp);
+    // Keep only the incomplete line
+    std::size_t pos = line.rfind('\n');
+    if (pos != std::string::npos) {
+      line.erase(0, pos + 1);
+    }
   }
 };
 
+int telemetry::cpu_percent(const telemetry_sample_t& prev, const telemetry_sample_t& curr)
+{
+  if (curr.cpu_total <= prev.cpu_total) {
+    return -1;
+  }
+
+  uint64_t busy  = curr.cpu_busy - prev.cpu_busy;
+  uint64_t total = curr.cpu_total - prev.cpu_total;
+  return std::min(static_cast<int>((100 * busy) / total), 100);
+}
+
 static int top_impl(ssh_session s, double measure_time_s)
 {
   if (not ssh_is_connected(s)) {
     return -1;
   }
 
-  return channel_impl(s).top(measure_time_s);
+  // The agent emits a snapshot right away and the next one after the measuring time
+  telemetry_impl     agent(s, measure_time_s);
+  telemetry_sample_t first  = {};
+  telemetry_sample_t second = {};
+  int                timeout_ms = static_cast<int>(measure_time_s * 1000.0) + SWARM_TELEMETRY_TIMEOUT_MS;
+  if (not agent.is_open() or not agent.read(first, timeout_ms) or not agent.read(second, timeout_ms)) {
+    return -1;
+  }
+
+  return telemetry::cpu_percent(first, second);
 }
 
 class session_impl : public session
@@ -268,6 +705,106 @@ private:
   ssh_session session = nullptr;
   std::string hostname;
 
+  // Single event polling the session for every channel, created on the first channel. libssh dispatches the packets
+  // of every channel of the session from whichever event polls it, so the channels share it.
+  ssh_event event = nullptr;
+
+  // Returns nullptr if the event cannot be created
+  ssh_event get_event()
+  {
+    if (event == nullptr) {
+      event = ssh_event_new();
+      if (event != nullptr and ssh_event_add_session(event, session) != SSH_OK) {
+        ssh_event_free(event);
+        event = nullptr;
+      }
+    }
+    return event;
+  }
+
+  // Telemetry agent for the load measurements, its last snapshot and the snapshot the CPU is measured from
+  telemetry_ptr      agent            = nullptr;
+  telemetry_sample_t last_sample      = {};
+  bool               has_last         = false;
+  telemetry_sample_t cpu_sample       = {};
+  int                last_cpu_percent = -1;
+
+  // Asks the agent for a snapshot and sets its round trip latency, drops the agent if it does not answer
+  bool request_sample(telemetry_sample_t& sample, int& latency_ms)
+  {
+    // Discard periodic snapshots so the next one answers the request
+    agent->drain();
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    agent->request();
+    if (not agent->read(sample, SWARM_TELEMETRY_TIMEOUT_MS)) {
+      agent = nullptr;
+      return false;
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    latency_ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count());
+    return true;
+  }
+
+  // SFTP subsystem, opened on the first transfer
+  sftp_session sftp = nullptr;
+
+  // Remote directories created by this session, forgotten if a file cannot be created in them
+  std::set<std::string> remote_directories;
+
+  // Returns nullptr if the subsystem cannot be started
+  sftp_session get_sftp()
+  {
+    if (sftp == nullptr) {
+      sftp = sftp_new(session);
+      if (sftp == nullptr) {
+        fprintf(stderr, "Error allocating SFTP session: %s\n", ssh_get_error(session));
+      } else if (sftp_init(sftp) != SSH_OK) {
+        fprintf(stderr, "Error initializing SFTP session: %d\n", sftp_get_error(sftp));
+        sftp_free(sftp);
+        sftp = nullptr;
+      }
+    }
+    return sftp;
+  }
+
+  // Creates the remote directory once per session, a session is used by one thread at a time
+  bool make_remote_directory(const std::string& path)
+  {
+    if (remote_directories.count(path) != 0) {
+      return true;
+    }
+
+    int status = make_channel()->execute("mkdir -p " + string_helpers::quote(path));
+    if (status != 0) {
+      fprintf(stderr, "Can't create remote directory '%s' in %s\n", path.c_str(), hostname.c_str());
+      return false;
+    }
+
+    remote_directories.insert(path);
+    return true;
+  }
+
+  // Largest request length accepted by the server
+  std::size_t get_sftp_chunk_size(bool is_read)
+  {
+    std::size_t chunk_size = SWARM_SFTP_CHUNK_SZ;
+#ifdef SWARM_HAVE_SFTP_AIO
+    sftp_limits_t limits = sftp_limits(sftp);
+    if (limits != nullptr) {
+      uint64_t max_length = is_read ? limits->max_read_length : limits->max_write_length;
+      if (max_length != 0) {
+        chunk_size = std::min<uint64_t>(chunk_size, max_length);
+      }
+      sftp_limits_free(limits);
+    }
+#else  // SWARM_HAVE_SFTP_AIO
+    (void)is_read;
+#endif // SWARM_HAVE_SFTP_AIO
+    return chunk_size;
+  }
+
   static int verify_knownhost(ssh_session session)
   {
     enum ssh_known_hosts_e state;
@@ -343,6 +880,92 @@ private:
     return 0;
   }
 
+  struct candidate_t {
+    ssh_session session;
+    std::string hostname;
+    int         cpu_percent;
+  };
+
+  // Shared between the host selection and the connection threads, the threads own it together with the selection so
+  // they never touch anything destroyed when they outlive it
+  struct host_selection_t {
+    std::mutex                  mutex;
+    std::condition_variable     cvar;
+    std::size_t                 nof_pending  = 0;
+    std::vector<candidate_t>    answered     = {};
+    bool                        done         = false;
+    std::shared_ptr<std::mutex> verify_mutex = nullptr; ///< Serializes the known hosts prompts of every selection
+
+    // The selection no longer takes candidates, the late ones give up
+    bool is_done()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      return done;
+    }
+  };
+
+  static void close_session(ssh_session s)
+  {
+    if (ssh_is_connected(s)) {
+      ssh_disconnect(s);
+    }
+    ssh_free(s);
+  }
+
+  // Connects, authenticates and probes a single candidate, unreachable candidates are skipped
+  static void connect_candidate(std::shared_ptr<host_selection_t> selection, std::string candidate)
+  {
+    trace::span span("probe");
+    span.set("host", candidate);
+
+    ssh_session s           = ssh_new();
+    int         cpu_percent = -1;
+
+    if (s != nullptr) {
+      ssh_options_set(s, SSH_OPTIONS_HOST, candidate.c_str());
+
+      // Connect to server
+      for (std::size_t trial = 0; trial < SWARM_MAX_NOF_TRIALS and not selection->is_done(); trial++) {
+        if (ssh_connect(s) == SSH_OK) {
+          break;
+        }
+      }
+
+      // Known hosts verification may prompt the user, one candidate at a time and never once the selection is done
+      bool verified = false;
+      if (ssh_is_connected(s) and not selection->is_done()) {
+        std::unique_lock<std::mutex> lock(*selection->verify_mutex);
+        verified = not selection->is_done() and verify_knownhost(s) >= 0;
+      }
+
+      // Get CPU percent
+      if (verified and not selection->is_done() and
+          ssh_userauth_publickey_auto(s, nullptr, nullptr) == SSH_AUTH_SUCCESS and not selection->is_done()) {
+        cpu_percent = top_impl(s, 0.01);
+      }
+    }
+    if (cpu_percent >= 0) {
+      span.set("cpu_percent", static_cast<uint64_t>(cpu_percent));
+    }
+    span.end();
+
+    // Keep the session only if the load is valid and the selection is still open
+    bool kept = false;
+    {
+      std::unique_lock<std::mutex> lock(selection->mutex);
+      selection->nof_pending--;
+      if (cpu_percent >= 0 and not selection->done) {
+        selection->answered.push_back({s, candidate, cpu_percent});
+        kept = true;
+      }
+      selection->cvar.notify_all();
+    }
+
+    if (not kept and s != nullptr) {
+      close_session(s);
+    }
+  }
+
 public:
   explicit session_impl(const std::string& hostname_) : hostname(hostname_)
   {
@@ -350,10 +973,10 @@ public:
     session = ssh_new();
 
     // Skip if session was not possible to open
-    SWARM_ASSERT(session != nullptr, "Error creating new SSH session");
-
-    SWARM_ASSERT(ssh_options_set(session, SSH_OPTIONS_HOST, hostname.c_str()) == SSH_OK,
-                 "Error setting the SSH hostname");
+    if (session == nullptr or ssh_options_set(session, SSH_OPTIONS_HOST, hostname.c_str()) != SSH_OK) {
+      fprintf(stderr, "Error creating new SSH session for '%s'\n", hostname.c_str());
+      return;
+    }
     //    int nodelay = 1;
     ////    SWARM_ASSERT(ssh_options_set(session, SSH_OPTIONS_NODELAY, &nodelay) == SSH_OK, "Error setting no delay");
     ////    SWARM_ASSERT(ssh_options_set(session, SSH_OPTIONS_COMPRESSION, "yes") == SSH_OK, "Error setting
@@ -366,6 +989,8 @@ public:
     ////                 "Error setting timeout in us");
 
     // Connect to server
+    trace::span connect_span("connect");
+    connect_span.set("host", hostname);
     for (std::size_t trial = 0; trial < SWARM_MAX_NOF_TRIALS; trial++) {
       if (ssh_connect(session) == SSH_OK) {
         break;
@@ -374,97 +999,90 @@ public:
       // Try in 1ms again
       usleep(1000);
     }
-
-    SWARM_ASSERT(ssh_is_connected(session),
-                 "Error connection to hostname '%s' after %d trials: %s (%d)",
-                 hostname.c_str(),
-                 SWARM_MAX_NOF_TRIALS,
-                 ssh_get_error(session),
-                 ssh_get_error_code(session));
+    connect_span.end();
+
+    if (not ssh_is_connected(session)) {
+      fprintf(stderr,
+              "Error connection to hostname '%s' after %d trials: %s (%d)\n",
+              hostname.c_str(),
+              SWARM_MAX_NOF_TRIALS,
+              ssh_get_error(session),
+              ssh_get_error_code(session));
+      return;
+    }
 
     // Verify known host
-    SWARM_ASSERT(verify_knownhost(session) >= 0, "Failed to verify known host");
+    trace::span auth_span("authenticate");
+    auth_span.set("host", hostname);
+    if (verify_knownhost(session) < 0) {
+      fprintf(stderr, "Failed to verify known host '%s'\n", hostname.c_str());
+      ssh_disconnect(session);
+      return;
+    }
 
     // Authenticate user
-    SWARM_ASSERT(ssh_userauth_publickey_auto(session, nullptr, nullptr) == SSH_AUTH_SUCCESS,
-                 "Authentication failed: %s\n",
-                 ssh_get_error(session));
+    if (ssh_userauth_publickey_auto(session, nullptr, nullptr) != SSH_AUTH_SUCCESS) {
+      fprintf(stderr, "Authentication failed in '%s': %s\n", hostname.c_str(), ssh_get_error(session));
+      ssh_disconnect(session);
+    }
   }
 
   explicit session_impl(const std::vector<std::string>& hostnames)
   {
-    std::vector<ssh_session> sessions(hostnames.size());
-    int                      best_percent_cpu = 200;
-
-    // For each hostname create session
-    for (std::size_t i = 0; i < hostnames.size(); i++) {
-      // Create session
-      sessions[i] = ssh_new();
-
-      // Skip if session was not possible to open
-      if (sessions[i] == nullptr) {
-        continue;
-      }
-
-      ssh_options_set(sessions[i], SSH_OPTIONS_HOST, hostnames[i].c_str());
-
-      // Connect to server
-      for (std::size_t trial = 0; trial < SWARM_MAX_NOF_TRIALS; trial++) {
-        if (ssh_connect(sessions[i]) == SSH_OK) {
-          break;
-        }
-        //        usleep(1000);
-      }
-
-      if (not ssh_is_connected(sessions[i])) {
-        ssh_free(sessions[i]);
-        sessions[i] = nullptr;
-        continue;
-      }
-
-      // Verify the server's identity
-      SWARM_ASSERT(verify_knownhost(sessions[i]) >= 0, "Failed to verify known host");
-
-      SWARM_ASSERT(ssh_userauth_publickey_auto(sessions[i], nullptr, nullptr) == SSH_AUTH_SUCCESS,
-                   "Authentication failed: %s\n",
-                   ssh_get_error(sessions[i]));
+    // Never destroyed before the connection threads release it
+    static std::shared_ptr<std::mutex> verify_mutex = std::make_shared<std::mutex>();
 
-      // Get CPU percent
-      int cpu_percent = top_impl(sessions[i], 0.01);
-
-      // Skip if the CPU load is invalid
-      if (cpu_percent < 0) {
-        continue;
-      }
+    std::shared_ptr<host_selection_t> selection = std::make_shared<host_selection_t>();
+    selection->nof_pending                      = hostnames.size();
+    selection->verify_mutex                     = verify_mutex;
 
-      // Compare with the previous best
-      if (cpu_percent < best_percent_cpu) {
-        best_percent_cpu = cpu_percent;
-        session          = sessions[i];
-        hostname         = hostnames[i];
-      }
+    // Connect to every host at once, the threads may outlive the selection and cancel themselves once it is done
+    for (const std::string& candidate : hostnames) {
+      std::thread(connect_candidate, selection, candidate).detach();
     }
 
-    SWARM_ASSERT(best_percent_cpu != 200, "Error connection to host");
-
-    // For each created SSH session close and free the ones that do not match the best
-    for (std::size_t i = 0; i < hostnames.size(); i++) {
-      // Skip invalid
-      if (sessions[i] == nullptr) {
-        continue;
-      }
+    std::vector<candidate_t> candidates;
+    {
+      std::unique_lock<std::mutex> lock(selection->mutex);
+
+      // Wait for the first candidates to answer until the deadline
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SWARM_SESSION_SELECT_TIMEOUT_MS);
+      selection->cvar.wait_until(lock, deadline, [&selection] {
+        return selection->nof_pending == 0 or
+               selection->answered.size() >= SWARM_SESSION_SELECT_NOF_CANDIDATES;
+      });
+
+      // Past the deadline take the first host to answer, but never wait for a host that does not answer at all
+      auto timeout = deadline + std::chrono::milliseconds(SWARM_SESSION_CONNECT_TIMEOUT_MS);
+      selection->cvar.wait_until(lock, timeout, [&selection] {
+        return selection->nof_pending == 0 or not selection->answered.empty();
+      });
+
+      // The late candidates close themselves
+      selection->done = true;
+      candidates      = std::move(selection->answered);
+    }
 
-      // Skip matches
-      if (sessions[i] == session) {
-        continue;
-      }
+    if (candidates.empty()) {
+      fprintf(stderr, "Error connection to any host\n");
+      return;
+    }
 
-      // Close
-      if (ssh_is_connected(sessions[i])) {
-        ssh_disconnect(sessions[i]);
+    // Keep the candidate chosen by the placement policy, the candidates only differ by their CPU load
+    std::vector<policy::host_view_t> hosts(candidates.size());
+    for (std::size_t i = 0; i < candidates.size(); i++) {
+      double fitness = 100.0 - static_cast<double>(candidates[i].cpu_percent);
+      hosts[i]       = {true, fitness, 1, fitness, 0};
+    }
+    std::size_t best = static_cast<std::size_t>(std::max(policy::placement::get().select(hosts), 0));
+    session  = candidates[best].session;
+    hostname = candidates[best].hostname;
+
+    // Close and free the other candidates
+    for (std::size_t i = 0; i < candidates.size(); i++) {
+      if (i != best) {
+        close_session(candidates[i].session);
       }
-
-      ssh_free(sessions[i]);
     }
   }
 
@@ -474,6 +1092,18 @@ public:
       return;
     }
 
+    // The agent channel, the SFTP subsystem and the event belong to the session
+    agent = nullptr;
+    if (sftp != nullptr) {
+      sftp_free(sftp);
+      sftp = nullptr;
+    }
+    if (event != nullptr) {
+      ssh_event_remove_session(event, session);
+      ssh_event_free(event);
+      event = nullptr;
+    }
+
     if (ssh_is_connected(session)) {
       ssh_disconnect(session);
     }
@@ -483,98 +1113,261 @@ public:
     session = nullptr;
   }
 
+  // False if the constructor could not connect or authenticate
+  bool is_connected() const { return session != nullptr and ssh_is_connected(session); }
+
   std::string get_hostname() const override { return hostname; }
 
-  channel_ptr    make_channel() override { return std::make_shared<channel_impl>(session); }
-  sftp_write_ptr make_sftp_write(const std::string& location) override
+  channel_ptr make_channel() override { return std::make_shared<channel_impl>(session, get_event(), hostname); }
+  stream_ptr  make_stream(const std::string& command) override
   {
-    return std::make_shared<sftp_write_impl>(session, location);
-  }
-  sftp_read_ptr make_sftp_read(const std::string& location) override
-  {
-    return std::make_shared<sftp_read_impl>(session, location);
+    std::shared_ptr<stream_impl> stream = std::make_shared<stream_impl>(session, get_event(), command);
+    return stream->is_open() ? stream : nullptr;
   }
 
-  void sftp_copy_local_to_remote(const std::string& local_path, const std::string& remote_path) override
+  bool sftp_copy_local_to_remote(const std::string& local_path, const std::string& remote_path) override
   {
-    swarm::ssh::sftp_write_ptr sftp = make_sftp_write("/");
+    trace::span span("upload");
+    span.set("host", hostname);
 
     // Create directory in remote host
-    std::size_t pos = remote_path.find_last_of('/');
-    if (pos != remote_path.npos) {
-      sftp->push_directory(remote_path.substr(0, pos));
+    std::size_t pos       = remote_path.find_last_of('/');
+    std::string directory = (pos != remote_path.npos) ? remote_path.substr(0, pos) : "";
+    if (not directory.empty() and not make_remote_directory(directory)) {
+      return false;
     }
 
-    // Open local file
-    std::ifstream file;
-    file.open(local_path, std::ifstream::ate | std::ifstream::binary);
+    if (get_sftp() == nullptr) {
+      return false;
+    }
 
-    // Get file size
-    std::size_t remainder = file.tellg();
-    file.seekg(0);
+    // Open local file
+    int fd = open(local_path.c_str(), O_RDONLY | O_CLOEXEC);
+    SWARM_ASSERT(fd >= 0, "Error opening '%s': %s", local_path.c_str(), strerror(errno));
 
     // Create file in remote host
-    sftp->push_file(remote_path, remainder);
+    sftp_file file = sftp_open(sftp, remote_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (file == nullptr) {
+      fprintf(stderr, "Can't create remote file '%s': %s\n", remote_path.c_str(), ssh_get_error(session));
+      remote_directories.erase(directory);
+      close(fd);
+      return false;
+    }
 
-    // Create buffer
-    std::array<char, SWARM_SCP_BUFFER_SZ> buffer = {};
+    std::vector<char> buffer(SWARM_SCP_BUFFER_SZ);
+    std::size_t       chunk_size = get_sftp_chunk_size(false);
+    bool              ok         = true;
+
+#ifdef SWARM_HAVE_SFTP_AIO
+    // The request data is copied when it is sent, so the buffer is reused while the requests are in flight
+    std::deque<sftp_aio> inflight;
+    while (ok) {
+      ssize_t n = read(fd, buffer.data(), buffer.size());
+      SWARM_ASSERT(n >= 0, "Error reading '%s': %s", local_path.c_str(), strerror(errno));
+      if (n == 0) {
+        break;
+      }
 
-    // Copy pipe output into the destination file
-    while (remainder > 0) {
-      // Read
-      std::size_t n = file.readsome(buffer.data(), buffer.size());
+      for (ssize_t offset = 0; ok and offset < n;) {
+        // Wait for the oldest request when the pipeline is full
+        if (inflight.size() == SWARM_SFTP_MAX_INFLIGHT) {
+          ok = (sftp_aio_wait_write(&inflight.front()) >= 0);
+          inflight.pop_front();
+          if (not ok) {
+            break;
+          }
+        }
 
-      // Write remote file
-      sftp->write(buffer.data(), n);
+        sftp_aio    aio    = nullptr;
+        std::size_t nbytes = std::min<std::size_t>(n - offset, chunk_size);
+        ssize_t     queued = sftp_aio_begin_write(file, buffer.data() + offset, nbytes, &aio);
+        if (queued <= 0) {
+          ok = false;
+          break;
+        }
+        inflight.push_back(aio);
+        offset += queued;
+      }
+    }
 
-      // Subtract number of bytes
-      remainder -= n;
+    // Wait for the last requests, the failed ones are still waited for so they are released
+    for (sftp_aio& aio : inflight) {
+      ok = (sftp_aio_wait_write(&aio) >= 0) and ok;
     }
+#else  // SWARM_HAVE_SFTP_AIO
+    while (ok) {
+      ssize_t n = read(fd, buffer.data(), std::min(buffer.size(), chunk_size));
+      SWARM_ASSERT(n >= 0, "Error reading '%s': %s", local_path.c_str(), strerror(errno));
+      if (n == 0) {
+        break;
+      }
 
-    file.close();
+      ok = (::sftp_write(file, buffer.data(), n) == n);
+    }
+#endif // SWARM_HAVE_SFTP_AIO
+
+    if (not ok) {
+      fprintf(stderr, "Can't write to remote file '%s': %s\n", remote_path.c_str(), ssh_get_error(session));
+    }
+
+    struct stat st = {};
+    if (fstat(fd, &st) == 0) {
+      span.set("bytes", static_cast<uint64_t>(st.st_size));
+    }
+
+    sftp_close(file);
+    close(fd);
+
+    return ok;
   }
 
-  void sftp_copy_remote_to_local(const std::string& remote_path, const std::string& local_path) override
+  bool sftp_copy_remote_to_local(const std::string& remote_path, const std::string& local_path) override
   {
-    swarm::ssh::sftp_read_ptr                sftp   = make_sftp_read(remote_path);
-    std::array<uint8_t, SWARM_SCP_BUFFER_SZ> buffer = {};
-    std::ofstream                            local_file;
+    trace::span span("download");
+    span.set("host", hostname);
 
-    local_file.open(local_path);
+    if (get_sftp() == nullptr) {
+      return false;
+    }
 
-    while (not sftp->is_eof()) {
-      std::size_t n = sftp->read(buffer.data(), buffer.size());
-      local_file.write((char*)buffer.data(), (uint32_t)n);
+    // Open remote file
+    sftp_file file = sftp_open(sftp, remote_path.c_str(), O_RDONLY, 0);
+    if (file == nullptr) {
+      fprintf(stderr, "Can't open remote file '%s': %s\n", remote_path.c_str(), ssh_get_error(session));
+      return false;
+    }
+
+    // Open local file
+    int fd = open(local_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    SWARM_ASSERT(fd >= 0, "Error opening '%s': %s", local_path.c_str(), strerror(errno));
+
+    std::size_t       chunk_size = get_sftp_chunk_size(true);
+    std::vector<char> buffer(chunk_size);
+    bool              ok = true;
+
+#ifdef SWARM_HAVE_SFTP_AIO
+    // Get file size so no request is issued past the end
+    uint64_t        size       = 0;
+    sftp_attributes attributes = sftp_stat(sftp, remote_path.c_str());
+    if (attributes != nullptr) {
+      size = attributes->size;
+      sftp_attributes_free(attributes);
+    } else {
+      ok = false;
     }
 
-    local_file.close();
+    // Keep several reads in flight, the replies are consumed in request order
+    std::deque<sftp_aio> inflight;
+    uint64_t             requested = 0;
+    while (true) {
+      while (ok and inflight.size() < SWARM_SFTP_MAX_INFLIGHT and requested < size) {
+        sftp_aio aio    = nullptr;
+        ssize_t  queued = sftp_aio_begin_read(file, std::min<uint64_t>(size - requested, chunk_size), &aio);
+        if (queued <= 0) {
+          ok = false;
+          break;
+        }
+        inflight.push_back(aio);
+        requested += queued;
+      }
+
+      if (inflight.empty()) {
+        break;
+      }
+
+      // Once failed, the requests in flight are only released
+      ssize_t n = sftp_aio_wait_read(&inflight.front(), buffer.data(), buffer.size());
+      inflight.pop_front();
+      ok = ok and n >= 0 and write_all(fd, buffer.data(), n);
+    }
+#else  // SWARM_HAVE_SFTP_AIO
+    while (ok) {
+      ssize_t n = ::sftp_read(file, buffer.data(), buffer.size());
+      if (n == 0) {
+        break;
+      }
+
+      ok = (n > 0 and write_all(fd, buffer.data(), n));
+    }
+#endif // SWARM_HAVE_SFTP_AIO
+
+    if (not ok) {
+      fprintf(stderr, "Can't copy remote file '%s': %s\n", remote_path.c_str(), ssh_get_error(session));
+      unlink(local_path.c_str());
+    }
+
+    struct stat st = {};
+    if (ok and fstat(fd, &st) == 0) {
+      span.set("bytes", static_cast<uint64_t>(st.st_size));
+    }
+
+    close(fd);
+    sftp_close(file);
+
+    return ok;
   }
 
-  int top(double measure_time_s) override { return top_impl(session, measure_time_s); }
+  telemetry_ptr make_telemetry(double interval_s) override
+  {
+    std::shared_ptr<telemetry_impl> telemetry = std::make_shared<telemetry_impl>(session, interval_s);
+    return telemetry->is_open() ? telemetry : nullptr;
+  }
 
-  double fitness(double measure_time_s, int* cpu_percent, int* latency_ms) override
+  telemetry_sample_t get_last_sample() const override { return has_last ? last_sample : telemetry_sample_t{}; }
+
+  int top(double measure_time_s) override
   {
-    // Get initial time for the host command
-    std::chrono::steady_clock::time_point session_begin = std::chrono::steady_clock::now();
+    int cpu_percent = -1;
+    fitness(measure_time_s, &cpu_percent, nullptr);
+    return cpu_percent;
+  }
 
-    // Get CPU utilization percent
-    int cpu_percent_ = top(measure_time_s);
+  double fitness(double measure_time_s, int* cpu_percent, int* latency_ms) override
+  {
+    // Start the agent on first use, it keeps running between calls
+    if (agent == nullptr) {
+      agent            = make_telemetry(SWARM_TELEMETRY_INTERVAL_S);
+      has_last         = false;
+      last_cpu_percent = -1;
+    }
 
-    // Get end time for the host command
-    std::chrono::steady_clock::time_point session_end = std::chrono::steady_clock::now();
+    // Get a snapshot measuring the round trip, the host is unreachable if the agent does not answer
+    telemetry_sample_t sample      = {};
+    int                latency_ms_ = -1;
+    bool               reached     = (agent != nullptr and request_sample(sample, latency_ms_));
 
-    // Calculate command latency in ms
-    int latency_ms_ =
-        static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(session_end - session_begin).count());
-    latency_ms_ = std::max(0, latency_ms_ - static_cast<int>(measure_time_s * 1000.0));
+    // The first call needs a second snapshot to measure the CPU
+    if (reached and not has_last) {
+      cpu_sample = sample;
+      usleep(static_cast<useconds_t>(measure_time_s * 1e6));
+      reached = request_sample(sample, latency_ms_);
+    }
 
-    // Protect zero division, which it should be impossible, even with a localhost
-    if (latency_ms_ == 0 or cpu_percent_ < 0) {
+    if (not reached) {
+      if (cpu_percent != nullptr) {
+        *cpu_percent = -1;
+      }
+      if (latency_ms != nullptr) {
+        *latency_ms = -1;
+      }
       return 0.0;
     }
 
+    // The CPU counters advance in jiffies, so snapshots taken back to back may not differ at all. The CPU is measured
+    // once the measuring time has passed since the previous measurement and the counters moved, in between the
+    // previous value is kept.
+    if (std::chrono::duration<double>(sample.timestamp - cpu_sample.timestamp).count() >= measure_time_s) {
+      int cpu_percent_ = telemetry::cpu_percent(cpu_sample, sample);
+      if (cpu_percent_ >= 0) {
+        last_cpu_percent = cpu_percent_;
+        cpu_sample       = sample;
+      }
+    }
+    last_sample = sample;
+    has_last    = true;
+
     if (cpu_percent != nullptr) {
-      *cpu_percent = cpu_percent_;
+      *cpu_percent = last_cpu_percent;
     }
 
     if (latency_ms != nullptr) {
@@ -582,25 +1375,49 @@ public:
     }
 
     // Return somewhat the host fitness
-    const double latency_factor = 0.1;
-    return (100.0 - static_cast<double>(cpu_percent_)) / (latency_factor * static_cast<double>(latency_ms_));
+    return policy::compute_fitness(last_cpu_percent, latency_ms_);
   }
 };
 
 session_ptr make_session(const std::string& hostname)
 {
-  return std::make_shared<session_impl>(hostname);
+#ifdef SWARM_HAVE_MOCK
+  if (mock::is_enabled()) {
+    return mock::make_session(hostname);
+  }
+#endif // SWARM_HAVE_MOCK
+
+  trace::span span("make_session");
+  span.set("host", hostname);
+
+  std::shared_ptr<session_impl> session = std::make_shared<session_impl>(hostname);
+  return session->is_connected() ? session : nullptr;
 }
 
 session_ptr make_session(const std::vector<std::string>& hostnames)
 {
+#ifdef SWARM_HAVE_MOCK
+  if (mock::is_enabled()) {
+    return mock::make_session(hostnames);
+  }
+#endif // SWARM_HAVE_MOCK
+
   // If there is only one hostname, make the session with it
   if (hostnames.size() == 1) {
     return make_session(hostnames[0]);
   }
 
   // Otherwise select the one with lowest CPU
-  return std::make_shared<session_impl>(hostnames);
+  trace::span span("make_session");
+  span.set("candidates", static_cast<uint64_t>(hostnames.size()));
+
+  std::shared_ptr<session_impl> session = std::make_shared<session_impl>(hostnames);
+  if (not session->is_connected()) {
+    return nullptr;
+  }
+
+  span.set("host", session->get_hostname());
+  return session;
 }
 
 } // namespace ssh
@@ -0,0 +1,861 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "ssh_mock.h"
+#include "compress.h"
+#include "config.h"
+#include "policy.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <poll.h>
+#include <random>
+#include <sstream>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace swarm {
+namespace ssh {
+namespace mock {
+
+typedef std::chrono::steady_clock::time_point time_point_t;
+
+static double get_elapsed_ms(time_point_t begin)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static void sleep_ms(double ms)
+{
+  if (ms > 0.0) {
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(ms));
+  }
+}
+
+// Uniform in [0, 1), thread-safe
+static double get_random()
+{
+  static std::mutex   mutex;
+  static std::mt19937 generator(std::random_device{}() ^ static_cast<unsigned>(getpid()));
+
+  std::unique_lock<std::mutex> lock(mutex);
+  return std::uniform_real_distribution<double>(0.0, 1.0)(generator);
+}
+
+// True with the given probability
+static bool roll(double probability)
+{
+  return get_random() < probability;
+}
+
+static bool write_all(int fd, const char* buffer, std::size_t nbytes)
+{
+  while (nbytes > 0) {
+    ssize_t n = write(fd, buffer, nbytes);
+    if (n < 0 and errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buffer += n;
+    nbytes -= n;
+  }
+  return true;
+}
+
+// Writes into the standard input of a command, which may have exited without reading it
+static bool send_all(int fd, const char* buffer, std::size_t nbytes)
+{
+  while (nbytes > 0) {
+    ssize_t n = send(fd, buffer, nbytes, MSG_NOSIGNAL);
+    if (n < 0 and errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buffer += n;
+    nbytes -= n;
+  }
+  return true;
+}
+
+static void make_directory(const std::string& path)
+{
+  for (std::size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+    mkdir(path.substr(0, pos).c_str(), 0777);
+  }
+  mkdir(path.c_str(), 0777);
+}
+
+// Moves every remote path of a command or a file name under the host root
+static std::string translate(const std::string& hostname, const std::string& str)
+{
+  const std::string remote_path = SWARM_REMOTE_PATH;
+  const std::string mock_path   = get_root(hostname) + remote_path;
+
+  std::string ret = str;
+  for (std::size_t pos = ret.find(remote_path); pos != std::string::npos;
+       pos             = ret.find(remote_path, pos + mock_path.size())) {
+    ret.replace(pos, remote_path.size(), mock_path);
+  }
+  return ret;
+}
+
+// Appends a line "<operation> <elapsed ms> <bytes sent> <bytes received>" into the host log, read by swarm-sim. The
+// elapsed time of a command is the time it held a core.
+static void account(const std::string& hostname, const char* operation, double elapsed_ms, uint64_t sent, uint64_t recv)
+{
+  char line[256];
+  int  n = snprintf(line,
+                   sizeof(line),
+                   "%s %.3f %lu %lu\n",
+                   operation,
+                   elapsed_ms,
+                   static_cast<unsigned long>(sent),
+                   static_cast<unsigned long>(recv));
+
+  // A single write per line, the lines of concurrent processes are not mixed
+  int fd = open((get_root(hostname) + "/log").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+  if (fd >= 0) {
+    write_all(fd, line, static_cast<std::size_t>(n));
+    close(fd);
+  }
+}
+
+// Holds the transfer back to the host bandwidth
+class pacer
+{
+private:
+  const double       bytes_per_s;
+  const time_point_t begin  = std::chrono::steady_clock::now();
+  uint64_t           nbytes = 0;
+
+public:
+  explicit pacer(double bandwidth_mbps) : bytes_per_s(bandwidth_mbps * 1e6 / 8.0) {}
+
+  void add(std::size_t n)
+  {
+    nbytes += n;
+    if (bytes_per_s > 0.0) {
+      std::this_thread::sleep_until(begin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                std::chrono::duration<double>(nbytes / bytes_per_s)));
+    }
+  }
+
+  uint64_t get_nbytes() const { return nbytes; }
+};
+
+// The cores are lock files, so every process of the simulation sees the cores taken by the others
+static std::string get_core_path(const host_t& host, int core)
+{
+  return get_root(host.hostname) + "/cores/" + std::to_string(core);
+}
+
+// Core held while a command runs, waits for a free one
+class core_lock
+{
+private:
+  int fd = -1;
+
+public:
+  explicit core_lock(const host_t& host)
+  {
+    while (true) {
+      for (int i = 0; i < host.nof_cores; i++) {
+        int core_fd = open(get_core_path(host, i).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        SWARM_ASSERT(core_fd >= 0, "Error opening mock core: %s", strerror(errno));
+        if (flock(core_fd, LOCK_EX | LOCK_NB) == 0) {
+          fd = core_fd;
+          return;
+        }
+        close(core_fd);
+      }
+      usleep(SWARM_MOCK_CORE_POLL_US);
+    }
+  }
+
+  ~core_lock() { close(fd); }
+};
+
+static int count_busy_cores(const host_t& host)
+{
+  int nof_busy = 0;
+  for (int i = 0; i < host.nof_cores; i++) {
+    int core_fd = open(get_core_path(host, i).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (core_fd < 0) {
+      continue;
+    }
+    if (flock(core_fd, LOCK_SH | LOCK_NB) != 0) {
+      nof_busy++;
+    }
+    close(core_fd);
+  }
+  return nof_busy;
+}
+
+// Starts the command in the host root with its standard input, if requested, and output through sockets
+static pid_t spawn(const host_t& host, const std::string& command, int* stdin_fd, int* stdout_fd, int stderr_fd)
+{
+  int in[2] = {-1, -1}, out[2] = {-1, -1};
+  SWARM_ASSERT(stdin_fd == nullptr or socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, in) == 0,
+               "Error creating socket pair: %s",
+               strerror(errno));
+  SWARM_ASSERT(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, out) == 0,
+               "Error creating socket pair: %s",
+               strerror(errno));
+
+  std::string root = get_root(host.hostname);
+
+  pid_t pid = fork();
+  SWARM_ASSERT(pid >= 0, "Error forking: %s", strerror(errno));
+
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_RDONLY);
+    dup2((stdin_fd != nullptr) ? in[1] : null_fd, STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    dup2(stderr_fd, STDERR_FILENO);
+    if (chdir(root.c_str()) != 0) {
+      _exit(127);
+    }
+    execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+    _exit(127);
+  }
+
+  if (stdin_fd != nullptr) {
+    close(in[1]);
+    *stdin_fd = in[0];
+  }
+  close(out[1]);
+  *stdout_fd = out[0];
+
+  return pid;
+}
+
+static int wait_status(pid_t pid)
+{
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      return transport_error;
+    }
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : transport_error;
+}
+
+class channel_mock : public channel
+{
+private:
+  const host_t host;
+
+  int run(const std::string& command, int stdin_fd, int stdout_fd, int stderr_fd, int compression_level)
+  {
+    time_point_t begin = std::chrono::steady_clock::now();
+
+    // Opening the channel and requesting the command
+    sleep_ms(host.latency_ms);
+    if (roll(host.failure_rate)) {
+      account(host.hostname, "failure", get_elapsed_ms(begin), 0, 0);
+      return transport_error;
+    }
+
+    compress::stream::ptr compressor   = nullptr;
+    compress::stream::ptr decompressor = nullptr;
+    if (compression_level > 0) {
+      compressor   = compress::stream::make_compressor(compression_level);
+      decompressor = compress::stream::make_decompressor();
+      SWARM_ASSERT(compressor != nullptr and decompressor != nullptr, "Compression is not supported in this build");
+    }
+
+    core_lock    core(host);
+    time_point_t start = std::chrono::steady_clock::now();
+
+    int   in_fd  = -1, out_fd = -1;
+    int*  in_ptr = (stdin_fd >= 0) ? &in_fd : nullptr;
+    pid_t pid    = spawn(host, translate(host.hostname, command), in_ptr, &out_fd, stderr_fd);
+
+    // The input is sent while the output is received
+    uint64_t    nof_sent    = 0;
+    bool        input_error = false;
+    std::thread sender;
+    if (in_fd >= 0) {
+      sender = std::thread([&]() {
+        pacer             link(host.bandwidth_mbps);
+        std::vector<char> buffer(SWARM_SCP_BUFFER_SZ);
+        std::vector<char> chunk;
+        bool              ok = true;
+        while (ok) {
+          ssize_t n = read(stdin_fd, buffer.data(), buffer.size());
+          if (n < 0 and errno == EINTR) {
+            continue;
+          }
+
+          chunk.clear();
+          if (n < 0) {
+            input_error = true;
+          } else if (compressor == nullptr) {
+            chunk.assign(buffer.data(), buffer.data() + n);
+          } else if (n > 0) {
+            input_error = not compressor->process(buffer.data(), n, chunk);
+          } else {
+            input_error = not compressor->finish(chunk);
+          }
+
+          // Stop the command instead of ending its input, like the SSH channel does
+          if (input_error) {
+            fprintf(stderr, "Error reading the input of %s\n", host.hostname.c_str());
+            kill(pid, SIGTERM);
+            break;
+          }
+
+          link.add(chunk.size());
+          ok = send_all(in_fd, chunk.data(), chunk.size()) and n > 0;
+        }
+        close(in_fd);
+        nof_sent = link.get_nbytes();
+      });
+    }
+
+    pacer             link(host.bandwidth_mbps);
+    std::vector<char> buffer(SWARM_SCP_BUFFER_SZ);
+    std::vector<char> decompressed;
+    bool              write_error  = false;
+    bool              decode_error = false;
+    while (true) {
+      ssize_t n = read(out_fd, buffer.data(), buffer.size());
+      if (n < 0 and errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+
+      link.add(static_cast<std::size_t>(n));
+      const char* data   = buffer.data();
+      std::size_t nbytes = static_cast<std::size_t>(n);
+      if (decompressor != nullptr) {
+        decompressed.clear();
+        decode_error = decode_error or not decompressor->process(data, nbytes, decompressed);
+        data         = decompressed.data();
+        nbytes = decompressed.size();
+      }
+      write_error = write_error or not write_all(stdout_fd, data, nbytes);
+    }
+    close(out_fd);
+
+    if (sender.joinable()) {
+      sender.join();
+    }
+    int status = wait_status(pid);
+
+    decompressed.clear();
+    if (write_error or decode_error or input_error or
+        (status == 0 and decompressor != nullptr and not decompressor->finish(decompressed))) {
+      status = transport_error;
+    }
+
+    account(host.hostname, "exec", get_elapsed_ms(start), nof_sent, link.get_nbytes());
+    return status;
+  }
+
+public:
+  explicit channel_mock(const host_t& host_) : host(host_) {}
+
+  int execute(const std::string& command, int stdout_fd, int stderr_fd) override
+  {
+    trace::span span("execute");
+    span.set("host", host.hostname);
+
+    return run(command, -1, stdout_fd, stderr_fd, 0);
+  }
+
+  int execute_stream(const std::string& command,
+                     int                stdin_fd,
+                     int                stdout_fd,
+                     int                stderr_fd,
+                     int                compression_level) override
+  {
+    trace::span span("execute_stream");
+    span.set("host", host.hostname);
+
+    return run(command, stdin_fd, stdout_fd, stderr_fd, compression_level);
+  }
+};
+
+// Long-lived command, it does not hold a core: the workers limit their own jobs
+class stream_mock : public stream
+{
+private:
+  const host_t      host;
+  pid_t             pid    = -1;
+  int               in_fd  = -1;
+  int               out_fd = -1;
+  std::mutex        mutex;
+  pacer             sent;
+  std::atomic<bool> stopped = {false};
+
+public:
+  stream_mock(const host_t& host_, const std::string& command) : host(host_), sent(host_.bandwidth_mbps)
+  {
+    pid = spawn(host, translate(host.hostname, command), &in_fd, &out_fd, STDERR_FILENO);
+  }
+
+  ~stream_mock()
+  {
+    close(in_fd);
+    close(out_fd);
+    kill(pid, SIGKILL);
+    wait_status(pid);
+  }
+
+  bool write(const char* data, std::size_t nbytes) override
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (stopped) {
+      return false;
+    }
+
+    sent.add(nbytes);
+    return send_all(in_fd, data, nbytes);
+  }
+
+  void stop() override { stopped = true; }
+
+  bool run(const handler_t& handler) override
+  {
+    pacer             received(host.bandwidth_mbps);
+    std::vector<char> buffer(SWARM_WORKER_CHUNK_SZ);
+    while (not stopped) {
+      struct pollfd pfd = {out_fd, POLLIN, 0};
+      if (poll(&pfd, 1, SWARM_CHANNEL_POLL_TIMEOUT_MS) <= 0) {
+        continue;
+      }
+
+      ssize_t n = read(out_fd, buffer.data(), buffer.size());
+      if (n < 0 and errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+
+      received.add(static_cast<std::size_t>(n));
+      handler(buffer.data(), static_cast<std::size_t>(n));
+    }
+    return true;
+  }
+};
+
+
+// The CPU counters integrate the cores taken between snapshots and advance in jiffies like /proc/stat, 100 per second
+// and core, so snapshots taken in a quick succession may not differ at all.
+class telemetry_mock : public telemetry
+{
+private:
+  const host_t host;
+  const double interval_s;
+  bool         requested = false;
+  time_point_t last_tick = std::chrono::steady_clock::now();
+  time_point_t last_time = last_tick;
+  double       cpu_busy  = 0.0;
+  double       cpu_total = 0.0;
+
+  void take(telemetry_sample_t& sample)
+  {
+    time_point_t now      = std::chrono::steady_clock::now();
+    double       ticks    = std::chrono::duration<double>(now - last_time).count() * SWARM_MOCK_JIFFIES_PER_S;
+    int          nof_busy = count_busy_cores(host);
+    last_time             = now;
+    cpu_busy += ticks * nof_busy;
+    cpu_total += ticks * host.nof_cores;
+
+    uint64_t mem_total_kb   = static_cast<uint64_t>(host.nof_cores) * SWARM_MOCK_MEM_PER_CORE_KB;
+    sample.timestamp        = now;
+    sample.nof_cores        = host.nof_cores;
+    sample.cpu_busy         = static_cast<uint64_t>(cpu_busy);
+    sample.cpu_total        = static_cast<uint64_t>(cpu_total);
+    sample.load_1m          = nof_busy;
+    sample.mem_total_kb     = mem_total_kb;
+    sample.mem_available_kb = mem_total_kb - static_cast<uint64_t>(nof_busy) * SWARM_MOCK_MEM_PER_CORE_KB;
+  }
+
+public:
+  telemetry_mock(const host_t& host_, double interval_s_) : host(host_), interval_s(interval_s_) {}
+
+  void request() override { requested = true; }
+
+  bool read(telemetry_sample_t& sample, int timeout_ms) override
+  {
+    if (requested) {
+      requested = false;
+      sleep_ms(host.latency_ms);
+    } else {
+      time_point_t tick = last_tick + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                          std::chrono::duration<double>(interval_s));
+      if (tick > std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms)) {
+        sleep_ms(timeout_ms);
+        return false;
+      }
+      std::this_thread::sleep_until(tick);
+    }
+
+    last_tick = std::chrono::steady_clock::now();
+    take(sample);
+    return true;
+  }
+
+  // Snapshots are taken when they are read, none is ever pending
+  void drain() override {}
+};
+
+class session_mock : public session
+{
+private:
+  const host_t host;
+
+  telemetry_ptr      agent            = nullptr;
+  telemetry_sample_t last_sample      = {};
+  bool               has_last         = false;
+  telemetry_sample_t cpu_sample       = {};
+  int                last_cpu_percent = -1;
+
+  // Asks the agent for a snapshot and sets its round trip latency, drops the agent if it does not answer
+  bool request_sample(telemetry_sample_t& sample, int& latency_ms)
+  {
+    time_point_t begin = std::chrono::steady_clock::now();
+    agent->request();
+    if (not agent->read(sample, SWARM_TELEMETRY_TIMEOUT_MS)) {
+      agent = nullptr;
+      return false;
+    }
+    latency_ms = static_cast<int>(get_elapsed_ms(begin));
+    return true;
+  }
+
+  // Copies between local files, the remote side is the one under the host root
+  bool copy(const std::string& src, const std::string& dst, const char* operation, bool upload)
+  {
+    trace::span span(operation);
+    span.set("host", host.hostname);
+
+    time_point_t begin = std::chrono::steady_clock::now();
+    sleep_ms(host.latency_ms);
+    if (roll(host.failure_rate)) {
+      account(host.hostname, "failure", get_elapsed_ms(begin), 0, 0);
+      return false;
+    }
+
+    int src_fd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (src_fd < 0) {
+      fprintf(stderr, "Can't open file '%s': %s\n", src.c_str(), strerror(errno));
+      return false;
+    }
+    int dst_fd = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (dst_fd < 0) {
+      fprintf(stderr, "Can't open file '%s': %s\n", dst.c_str(), strerror(errno));
+      close(src_fd);
+      return false;
+    }
+
+    pacer             link(host.bandwidth_mbps);
+    std::vector<char> buffer(SWARM_SFTP_CHUNK_SZ);
+    bool              ok = true;
+    while (ok) {
+      ssize_t n = ::read(src_fd, buffer.data(), buffer.size());
+      if (n < 0 and errno == EINTR) {
+        continue;
+      }
+      if (n == 0) {
+        break;
+      }
+
+      ok = (n > 0 and write_all(dst_fd, buffer.data(), static_cast<std::size_t>(n)));
+      link.add(static_cast<std::size_t>(std::max<ssize_t>(n, 0)));
+    }
+
+    close(dst_fd);
+    close(src_fd);
+    if (not ok) {
+      unlink(dst.c_str());
+    }
+
+    uint64_t nbytes = link.get_nbytes();
+    span.set("bytes", nbytes);
+    account(host.hostname, operation, get_elapsed_ms(begin), upload ? nbytes : 0, upload ? 0 : nbytes);
+    return ok;
+  }
+
+public:
+  explicit session_mock(const host_t& host_) : host(host_) {}
+
+  std::string get_hostname() const override { return host.hostname; }
+
+  channel_ptr make_channel() override { return std::make_shared<channel_mock>(host); }
+
+  stream_ptr make_stream(const std::string& command) override
+  {
+    sleep_ms(host.latency_ms);
+    return std::make_shared<stream_mock>(host, command);
+  }
+
+  bool sftp_copy_local_to_remote(const std::string& local_path, const std::string& remote_path) override
+  {
+    std::string path = translate(host.hostname, remote_path);
+    make_directory(path.substr(0, path.find_last_of('/')));
+    return copy(local_path, path, "upload", true);
+  }
+
+  bool sftp_copy_remote_to_local(const std::string& remote_path, const std::string& local_path) override
+  {
+    return copy(translate(host.hostname, remote_path), local_path, "download", false);
+  }
+
+  telemetry_ptr make_telemetry(double interval_s) override
+  {
+    return std::make_shared<telemetry_mock>(host, interval_s);
+  }
+
+  telemetry_sample_t get_last_sample() const override { return has_last ? last_sample : telemetry_sample_t{}; }
+
+  int top(double measure_time_s) override
+  {
+    int cpu_percent = -1;
+    fitness(measure_time_s, &cpu_percent, nullptr);
+    return cpu_percent;
+  }
+
+  // Same measurement as the SSH session, through the simulated agent
+  double fitness(double measure_time_s, int* cpu_percent, int* latency_ms) override
+  {
+    if (agent == nullptr) {
+      agent            = make_telemetry(SWARM_TELEMETRY_INTERVAL_S);
+      has_last         = false;
+      last_cpu_percent = -1;
+    }
+
+    telemetry_sample_t sample      = {};
+    int                latency_ms_ = -1;
+    bool               reached     = (agent != nullptr and request_sample(sample, latency_ms_));
+
+    if (reached and not has_last) {
+      cpu_sample = sample;
+      usleep(static_cast<useconds_t>(measure_time_s * 1e6));
+      reached = request_sample(sample, latency_ms_);
+    }
+
+    if (not reached) {
+      if (cpu_percent != nullptr) {
+        *cpu_percent = -1;
+      }
+      if (latency_ms != nullptr) {
+        *latency_ms = -1;
+      }
+      return 0.0;
+    }
+
+    // Keep the previous CPU until the measuring time passed and the jiffies moved
+    if (std::chrono::duration<double>(sample.timestamp - cpu_sample.timestamp).count() >= measure_time_s) {
+      int cpu_percent_ = telemetry::cpu_percent(cpu_sample, sample);
+      if (cpu_percent_ >= 0) {
+        last_cpu_percent = cpu_percent_;
+        cpu_sample       = sample;
+      }
+    }
+    last_sample = sample;
+    has_last    = true;
+
+    if (cpu_percent != nullptr) {
+      *cpu_percent = last_cpu_percent;
+    }
+
+    if (latency_ms != nullptr) {
+      *latency_ms = latency_ms_;
+    }
+
+    return policy::compute_fitness(last_cpu_percent, latency_ms_);
+  }
+};
+
+static const std::vector<host_t>& get_hosts()
+{
+  static const std::vector<host_t> hosts = load(getenv(SWARM_ENV_VAR_MOCK));
+  return hosts;
+}
+
+static const host_t* find_host(const std::string& hostname)
+{
+  for (const host_t& host : get_hosts()) {
+    if (host.hostname == hostname) {
+      return &host;
+    }
+  }
+
+  fprintf(stderr, "Error. Unknown mock host '%s'\n", hostname.c_str());
+  return nullptr;
+}
+
+bool is_enabled()
+{
+  const char* mock_c = getenv(SWARM_ENV_VAR_MOCK);
+
+  return mock_c != nullptr and mock_c[0] != '\0';
+}
+
+std::vector<host_t> load(const std::string& path)
+{
+  std::vector<host_t> hosts;
+
+  std::ifstream file(path);
+  if (not file.good()) {
+    fprintf(stderr, "Error opening mock hosts file '%s'\n", path.c_str());
+    return hosts;
+  }
+
+  std::string line;
+  while (std::getline(file, line)) {
+    line = line.substr(0, line.find('#'));
+
+    std::istringstream       ss(line);
+    std::vector<std::string> fields;
+    std::string              field;
+    while (ss >> field) {
+      fields.push_back(field);
+    }
+    if (fields.empty()) {
+      continue;
+    }
+
+    // The missing fields take the defaults: the local cores, no latency, unlimited bandwidth and no failures
+    const std::string& name = fields[0];
+    host_t             host = {name, static_cast<int>(std::max(1L, sysconf(_SC_NPROCESSORS_ONLN))), 0.0, 0.0, 0.0};
+    if (fields.size() > 1) {
+      host.nof_cores = std::max(1, std::atoi(fields[1].c_str()));
+    }
+    if (fields.size() > 2) {
+      host.latency_ms = std::atof(fields[2].c_str());
+    }
+    if (fields.size() > 3) {
+      host.bandwidth_mbps = std::atof(fields[3].c_str());
+    }
+    if (fields.size() > 4) {
+      host.failure_rate = std::atof(fields[4].c_str());
+    }
+
+    std::size_t star = name.find('*');
+    if (star == std::string::npos) {
+      hosts.push_back(host);
+      continue;
+    }
+
+    int count = std::atoi(name.c_str() + star + 1);
+    for (int i = 0; i < count; i++) {
+      host.hostname = name.substr(0, star) + "-" + std::to_string(i);
+      hosts.push_back(host);
+    }
+  }
+
+  return hosts;
+}
+
+std::string get_root(const std::string& hostname)
+{
+  return SWARM_MOCK_PATH + hostname;
+}
+
+session_ptr make_session(const std::string& hostname)
+{
+  const host_t* host = find_host(hostname);
+  if (host == nullptr) {
+    return nullptr;
+  }
+
+  trace::span span("make_session");
+  span.set("host", hostname);
+
+  make_directory(get_root(hostname) + "/cores");
+
+  time_point_t begin = std::chrono::steady_clock::now();
+  sleep_ms(host->latency_ms * SWARM_MOCK_CONNECT_RTTS);
+  if (roll(host->failure_rate)) {
+    fprintf(stderr, "Error connection to mock host '%s'\n", hostname.c_str());
+    account(hostname, "failure", get_elapsed_ms(begin), 0, 0);
+    return nullptr;
+  }
+
+  account(hostname, "connect", get_elapsed_ms(begin), 0, 0);
+  return std::make_shared<session_mock>(*host);
+}
+
+// As the SSH session, the first candidates to answer are compared and the least loaded is kept
+session_ptr make_session(const std::vector<std::string>& hostnames)
+{
+  if (hostnames.size() == 1) {
+    return make_session(hostnames[0]);
+  }
+
+  std::vector<const host_t*> answered;
+  for (const std::string& hostname : hostnames) {
+    const host_t* host = find_host(hostname);
+    if (host != nullptr and not roll(host->failure_rate)) {
+      answered.push_back(host);
+    }
+  }
+  if (answered.empty()) {
+    fprintf(stderr, "Error connection to any host\n");
+    return nullptr;
+  }
+
+  // The candidates are connected at once, the closest answer first and the ties in any order
+  for (std::size_t i = answered.size() - 1; i > 0; i--) {
+    std::swap(answered[i], answered[static_cast<std::size_t>(get_random() * static_cast<double>(i + 1))]);
+  }
+  std::stable_sort(answered.begin(), answered.end(), [](const host_t* a, const host_t* b) {
+    return a->latency_ms < b->latency_ms;
+  });
+  answered.resize(std::min<std::size_t>(answered.size(), SWARM_SESSION_SELECT_NOF_CANDIDATES));
+
+  const host_t* best      = nullptr;
+  double        best_load = 0.0;
+  for (const host_t* host : answered) {
+    make_directory(get_root(host->hostname) + "/cores");
+    double load = static_cast<double>(count_busy_cores(*host)) / host->nof_cores;
+    if (best == nullptr or load < best_load) {
+      best      = host;
+      best_load = load;
+    }
+  }
+
+  sleep_ms(answered.back()->latency_ms * SWARM_MOCK_CONNECT_RTTS);
+  account(best->hostname, "connect", answered.back()->latency_ms * SWARM_MOCK_CONNECT_RTTS, 0, 0);
+  return std::make_shared<session_mock>(*best);
+}
+
+} // namespace mock
+} // namespace ssh
+} // namespace swarm
@@ -0,0 +1,57 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_SSH_MOCK_H
+#define SWARM_SSH_MOCK_H
+
+#include "ssh.h"
+#include <string>
+#include <vector>
+
+namespace swarm {
+namespace ssh {
+namespace mock {
+
+// Simulated host. Its commands run locally under its own root directory, holding one of its cores each.
+struct host_t {
+  std::string hostname;
+  int         nof_cores;      ///< Commands running at once, the rest wait for a free core
+  double      latency_ms;     ///< Round trip added to every connection, command and telemetry request
+  double      bandwidth_mbps; ///< Link speed in Mbit/s for the transferred bytes, unlimited if 0
+  double      failure_rate;   ///< Probability of a connection or a command failing with a transport error
+};
+
+// The sessions are simulated, instead of connecting through SSH, when SWARM_MOCK is set to a hosts file
+bool is_enabled();
+
+// Reads the hosts file, a host per line: "<hostname>[*<count>] [<cores> [<latency ms> [<Mbit/s> [<failure
+// rate>]]]]". A count expands into the hosts <hostname>-0 to <hostname>-<count - 1>. Empty lines and comments starting
+// with # are skipped.
+std::vector<host_t> load(const std::string& path);
+
+// Directory standing for the root file system of the host, the remote paths of the commands are moved under it
+std::string get_root(const std::string& hostname);
+
+// Same as the SSH factories, returns nullptr if the host is not in the hosts file or the connection failed
+session_ptr make_session(const std::string& hostname);
+session_ptr make_session(const std::vector<std::string>& hostnames);
+
+} // namespace mock
+} // namespace ssh
+} // namespace swarm
+
+#endif // SWARM_SSH_MOCK_H
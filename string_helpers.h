@@ -41,6 +41,16 @@ static inline std::vector<std::string> split(const std::string& str, char delimi
 
   return list;
 }
+
+// Single quotes a string for the remote shell
+static inline std::string quote(const std::string& str)
+{
+  std::string ret = "'";
+  for (char c : str) {
+    ret += (c == '\'') ? std::string("'\\''") : std::string(1, c);
+  }
+  return ret + "'";
+}
 } // namespace string_helpers
 } // namespace swarm
 #endif // SWARM_STRING_HELPERS_H
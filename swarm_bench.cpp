@@ -0,0 +1,343 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "args.h"
+#include "config.h"
+#include "shared.h"
+#include "ssh.h"
+#include "string_helpers.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock::time_point time_point_t;
+
+struct bench_request_t {
+  uint64_t seq;
+};
+
+struct bench_reply_t {
+  uint64_t seq;
+};
+
+// Compiler command line as make passes it to swarm-cc
+static const std::vector<std::string> compile_line = {
+    "swarm-cc", "g++",     "-DNDEBUG",          "-D_GNU_SOURCE",     "-I/usr/local/include/project",
+    "-I",       "include", "-isystem",          "/opt/sdk/include",  "-std=c++14",
+    "-O2",      "-g",      "-Wall",             "-Wextra",           "-fPIC",
+    "-MD",      "-MT",     "obj/src/module.o",  "-MF",               "obj/src/module.o.d",
+    "-o",       "obj/src/module.o",             "-c",                "src/module.cpp"};
+
+static void print_help(const char* prog)
+{
+  printf("Usage: %s [options]\n", prog);
+  printf("Measures the swarm-lib hot paths, every result is printed as a JSON object per line\n");
+  printf("-c        Maximum number of concurrent IPC clients, doubled from 1 (8 by default)\n");
+  printf("-n        Iterations per benchmark (100000 by default)\n");
+  printf("-H        Host for the transport benchmarks, skipped by default (localhost runs against the local sshd)\n");
+  printf("-s        Transport payload in MB (16 by default)\n");
+  printf("-h,--help This message\n");
+}
+
+static double get_elapsed_s(time_point_t begin)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// Prints the latency distribution of the samples, in microseconds per operation, and the overall rate
+static void report_latency(const std::string&   benchmark,
+                           const std::string&   params,
+                           std::vector<double>& samples_us,
+                           double               ops_per_s)
+{
+  if (samples_us.empty()) {
+    return;
+  }
+
+  std::sort(samples_us.begin(), samples_us.end());
+  double sum = 0.0;
+  for (double sample : samples_us) {
+    sum += sample;
+  }
+
+  double mean_us = sum / static_cast<double>(samples_us.size());
+  printf("{\"benchmark\":\"%s\",%s,\"samples\":%zu,\"mean_us\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f,"
+         "\"ops_per_s\":%.1f}\n",
+         benchmark.c_str(),
+         params.c_str(),
+         samples_us.size(),
+         mean_us,
+         samples_us[samples_us.size() / 2],
+         samples_us[std::min(samples_us.size() - 1, samples_us.size() * 99 / 100)],
+         samples_us.back(),
+         ops_per_s);
+  fflush(stdout);
+}
+
+static void report_throughput(const std::string& benchmark,
+                              const std::string& params,
+                              uint64_t           nbytes,
+                              double             elapsed_s)
+{
+  printf("{\"benchmark\":\"%s\",%s,\"bytes\":%lu,\"seconds\":%.6f,\"mb_per_s\":%.3f}\n",
+         benchmark.c_str(),
+         params.c_str(),
+         static_cast<unsigned long>(nbytes),
+         elapsed_s,
+         static_cast<double>(nbytes) / (1024.0 * 1024.0) / elapsed_s);
+  fflush(stdout);
+}
+
+// Runs the operation in batches, so the clock overhead is negligible, and reports the time per operation
+static void bench_loop(const std::string&           benchmark,
+                       const std::string&           params,
+                       std::size_t                  nof_iterations,
+                       const std::function<void()>& operation)
+{
+  static const std::size_t batch_size = 100;
+
+  std::vector<double> samples_us;
+  time_point_t        start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < nof_iterations; i += batch_size) {
+    time_point_t begin = std::chrono::steady_clock::now();
+    for (std::size_t j = 0; j < batch_size; j++) {
+      operation();
+    }
+    samples_us.push_back(get_elapsed_s(begin) * 1e6 / batch_size);
+  }
+
+  double elapsed_s = get_elapsed_s(start);
+  report_latency(benchmark, params, samples_us, static_cast<double>(samples_us.size() * batch_size) / elapsed_s);
+}
+
+// Round trip of a call through the shared memory queue, served by as many threads as swarm-lb
+static void bench_ipc(std::size_t nof_clients, std::size_t nof_iterations)
+{
+  std::string                                          filename = "/swarm-bench-" + std::to_string(getpid());
+  swarm::shared::reply<bench_request_t, bench_reply_t> server(filename);
+  std::atomic<bool>                                    done = {false};
+
+  std::vector<std::thread> servers;
+  for (std::size_t i = 0; i < SWARM_LB_NOF_THREADS; i++) {
+    servers.emplace_back([&server, &done]() {
+      while (not done) {
+        server.serve([](const bench_request_t& req, bench_reply_t& rep) { rep.seq = req.seq; });
+      }
+    });
+  }
+
+  // Every client takes its share of the calls
+  std::vector<std::vector<double>> samples(nof_clients);
+  std::vector<std::thread>         clients;
+  time_point_t                     start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < nof_clients; i++) {
+    clients.emplace_back([&filename, &samples, i, nof_clients, nof_iterations]() {
+      swarm::shared::request<bench_request_t, bench_reply_t> client(filename);
+      for (std::size_t seq = 0; seq < nof_iterations / nof_clients; seq++) {
+        bench_request_t req = {seq};
+        bench_reply_t   rep = {};
+
+        time_point_t begin = std::chrono::steady_clock::now();
+        SWARM_ASSERT(client.call(req, rep) and rep.seq == seq, "Error calling the benchmark server");
+        samples[i].push_back(get_elapsed_s(begin) * 1e6);
+      }
+    });
+  }
+  for (std::thread& client : clients) {
+    client.join();
+  }
+  double elapsed_s = get_elapsed_s(start);
+
+  done = true;
+  for (std::thread& thread : servers) {
+    thread.join();
+  }
+
+  std::vector<double> all;
+  for (const std::vector<double>& client_samples : samples) {
+    all.insert(all.end(), client_samples.begin(), client_samples.end());
+  }
+  double ops_per_s = static_cast<double>(all.size()) / elapsed_s;
+  report_latency("ipc_call", "\"clients\":" + std::to_string(nof_clients), all, ops_per_s);
+}
+
+// Parsing and the rewriting swarm-cc does on every compiler command line
+static void bench_args(std::size_t nof_iterations)
+{
+  std::vector<char*> argv;
+  for (const std::string& arg : compile_line) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  int         argc   = static_cast<int>(argv.size());
+  std::string params = "\"args\":" + std::to_string(argc);
+
+  bench_loop("args_parse", params, nof_iterations, [&argv, argc]() { swarm::args args(argc, argv.data()); });
+
+  swarm::args args(argc, argv.data());
+  bench_loop("args_rewrite", params, nof_iterations, [&args]() {
+    std::string source_file = args.get_source();
+    std::string object_file = args.get_output();
+
+    swarm::args precompile_args = args;
+    precompile_args.set_output("/tmp/swarm/" + source_file);
+    precompile_args.append("-E");
+
+    swarm::args compile_args = args;
+    compile_args.delete_preprocessor_options();
+    compile_args.set_output("/tmp/swarm/host/" + object_file);
+
+    swarm::args stream_args = compile_args;
+    stream_args.delete_output();
+    stream_args.delete_sources();
+
+    std::string command = precompile_args.get_command() + compile_args.get_command() + stream_args.get_command();
+  });
+}
+
+static void bench_split(std::size_t nof_iterations)
+{
+  std::string hostnames;
+  for (std::size_t i = 0; i < SWARM_LB_MAX_HOSTS; i++) {
+    hostnames += "build-host-" + std::to_string(i) + SWARM_HOSTNAME_LIST_DELIMITER;
+  }
+
+  bench_loop("split", "\"tokens\":" + std::to_string(SWARM_LB_MAX_HOSTS), nof_iterations, [&hostnames]() {
+    std::vector<std::string> list = swarm::string_helpers::split(hostnames, SWARM_HOSTNAME_LIST_DELIMITER);
+  });
+}
+
+// Channel and SFTP throughput in both directions, with the buffer sizes this binary was built with
+static void bench_transport(const std::string& hostname, std::size_t nof_bytes)
+{
+  swarm::ssh::session_ptr session = swarm::ssh::make_session(hostname);
+  SWARM_ASSERT(session != nullptr, "Error connecting to '%s'", hostname.c_str());
+
+  std::string params = "\"host\":\"" + hostname + "\",\"buffer_sz\":" + std::to_string(SWARM_SCP_BUFFER_SZ) +
+                       ",\"sftp_chunk_sz\":" + std::to_string(SWARM_SFTP_CHUNK_SZ);
+
+  // Local payload
+  char local_path[] = "/tmp/swarm-bench-XXXXXX";
+  int  fd           = mkstemp(local_path);
+  SWARM_ASSERT(fd >= 0, "Error creating payload: %s", strerror(errno));
+  std::vector<char> chunk(1024 * 1024);
+  for (std::size_t i = 0; i < chunk.size(); i++) {
+    chunk[i] = static_cast<char>(i * 2654435761U >> 24);
+  }
+  for (std::size_t written = 0; written < nof_bytes; written += chunk.size()) {
+    std::size_t n = std::min(chunk.size(), nof_bytes - written);
+    SWARM_ASSERT(write(fd, chunk.data(), n) == static_cast<ssize_t>(n), "Error writing payload: %s", strerror(errno));
+  }
+
+  int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  SWARM_ASSERT(null_fd >= 0, "Error opening /dev/null: %s", strerror(errno));
+
+  // Channel upload, the payload goes through the command standard input
+  lseek(fd, 0, SEEK_SET);
+  time_point_t begin  = std::chrono::steady_clock::now();
+  int          status = session->make_channel()->execute_stream("cat > /dev/null", fd, null_fd, STDERR_FILENO);
+  if (status == 0) {
+    report_throughput("channel_upload", params, nof_bytes, get_elapsed_s(begin));
+  }
+
+  // Channel download, the payload comes through the command standard output
+  begin  = std::chrono::steady_clock::now();
+  status = session->make_channel()->execute_stream(
+      "head -c " + std::to_string(nof_bytes) + " /dev/zero", -1, null_fd, STDERR_FILENO);
+  if (status == 0) {
+    report_throughput("channel_download", params, nof_bytes, get_elapsed_s(begin));
+  }
+
+  // SFTP round trip through a remote file
+  std::string remote_path = SWARM_REMOTE_PATH + "bench-" + std::to_string(getpid());
+  begin                   = std::chrono::steady_clock::now();
+  if (session->sftp_copy_local_to_remote(local_path, remote_path)) {
+    report_throughput("sftp_upload", params, nof_bytes, get_elapsed_s(begin));
+
+    begin = std::chrono::steady_clock::now();
+    if (session->sftp_copy_remote_to_local(remote_path, local_path)) {
+      report_throughput("sftp_download", params, nof_bytes, get_elapsed_s(begin));
+    }
+    session->make_channel()->execute("rm -f " + remote_path);
+  }
+
+  close(null_fd);
+  close(fd);
+  unlink(local_path);
+}
+
+int main(int argc, char** argv)
+{
+  // Parse arguments
+  swarm::args args(argc, argv);
+
+  // Parse help
+  {
+    if (args.has("-h") or args.has("--help")) {
+      print_help(argv[0]);
+      return 0;
+    }
+  }
+
+  std::size_t max_clients = 8;
+  {
+    std::string c_str = args.get_value("-c");
+    if (not c_str.empty()) {
+      max_clients = static_cast<std::size_t>(std::max(1, std::atoi(c_str.c_str())));
+    }
+  }
+
+  std::size_t nof_iterations = 100000;
+  {
+    std::string n_str = args.get_value("-n");
+    if (not n_str.empty()) {
+      nof_iterations = static_cast<std::size_t>(std::max(100, std::atoi(n_str.c_str())));
+    }
+  }
+
+  std::string hostname = args.get_value("-H");
+
+  std::size_t payload_mb = 16;
+  {
+    std::string s_str = args.get_value("-s");
+    if (not s_str.empty()) {
+      payload_mb = static_cast<std::size_t>(std::max(1, std::atoi(s_str.c_str())));
+    }
+  }
+
+  for (std::size_t nof_clients = 1; nof_clients <= max_clients; nof_clients *= 2) {
+    bench_ipc(nof_clients, nof_iterations / 10);
+  }
+
+  bench_args(nof_iterations / 10);
+  bench_split(nof_iterations);
+
+  if (not hostname.empty()) {
+    bench_transport(hostname, payload_mb * 1024 * 1024);
+  }
+
+  return 0;
+}
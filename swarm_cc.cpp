@@ -16,19 +16,38 @@
  */
 
 #include "args.h"
+#include "cache.h"
 #include "config.h"
+#include "daemon.h"
+#include "history.h"
 #include "hostnames.h"
+#include "job.h"
+#include "pump.h"
 #include "ssh.h"
+#include "trace.h"
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <csignal>
 #include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <thread>
+#include <unistd.h>
 
 static std::set<std::string> supported_languages = {"c", "c++"};
 static std::set<std::string> excluded_targets    = {"/dev/null"};
 
 static void precompile(std::string precompile_command)
 {
+  swarm::trace::span span("precompile");
+
   int status = system(precompile_command.c_str());
   SWARM_ASSERT(status == SWARM_PRECOMPILER_EXPECTED_STATUS,
                "Error. Precompiler exited with status code %d and expected %d",
@@ -36,6 +55,219 @@ static void precompile(std::string precompile_command)
                SWARM_PRECOMPILER_EXPECTED_STATUS);
 }
 
+// Copies the whole file into fd
+static void copy_file(FILE* file, int fd)
+{
+  char   buffer[4096];
+  size_t n = 0;
+  rewind(file);
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    if (write(fd, buffer, n) < 0) {
+      break;
+    }
+  }
+}
+
+// Diagnostics of a remote attempt, forwarded once the attempt is final so a retried job never repeats them
+class attempt_log
+{
+private:
+  FILE* file = nullptr;
+
+public:
+  attempt_log()
+  {
+    file = tmpfile();
+    SWARM_ASSERT(file != nullptr, "Error creating temporary file: %s", strerror(errno));
+  }
+
+  ~attempt_log() { fclose(file); }
+
+  int get_fd() const { return fileno(file); }
+
+  // Forwards the diagnostics into fd unless the host failed the job, which is retried
+  void finish(int status, int fd)
+  {
+    if (status != swarm::ssh::transport_error) {
+      copy_file(file, fd);
+    }
+  }
+};
+
+// Input of the streaming compilation
+class precompile_input
+{
+private:
+  const bool        stream;
+  const bool        precompiled;
+  const std::string path;
+  const std::string command;
+  int               fd   = STDIN_FILENO;
+  FILE*             pipe = nullptr;
+
+  void open_input()
+  {
+    if (not stream) {
+      return;
+    }
+
+    // Read the precompiled file if available, otherwise start the preprocessor
+    if (precompiled) {
+      fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      SWARM_ASSERT(fd >= 0, "Error opening '%s': %s", path.c_str(), strerror(errno));
+    } else {
+      pipe = popen(command.c_str(), "r");
+      SWARM_ASSERT(pipe != nullptr, "Error starting precompiler: %s", strerror(errno));
+      fd = fileno(pipe);
+    }
+  }
+
+  bool close_input()
+  {
+    bool ret = true;
+    if (pipe != nullptr) {
+      int status = pclose(pipe);
+      ret        = (WIFEXITED(status) and WEXITSTATUS(status) == SWARM_PRECOMPILER_EXPECTED_STATUS);
+      pipe       = nullptr;
+    } else if (fd != STDIN_FILENO) {
+      close(fd);
+    }
+    fd = STDIN_FILENO;
+    return ret;
+  }
+
+public:
+  precompile_input(bool stream_, bool precompiled_, std::string path_, std::string command_) :
+    stream(stream_), precompiled(precompiled_), path(std::move(path_)), command(std::move(command_))
+  {
+    open_input();
+  }
+
+  ~precompile_input() { close_input(); }
+
+  int get_fd() const { return fd; }
+
+  // Starts reading the input again from the beginning
+  void restart()
+  {
+    close_input();
+    open_input();
+  }
+
+  // Closes the input, returns false if the preprocessor failed
+  bool finish() { return close_input(); }
+};
+
+// Local compilation in its own process group, its output is kept until it is known whether the result is used
+class local_compile
+{
+private:
+  pid_t                                 pid        = -1;
+  FILE*                                 log        = nullptr;
+  swarm::trace::span                    span{"hedge"};
+  std::chrono::steady_clock::time_point begin      = std::chrono::steady_clock::now();
+  double                                elapsed_ms = 0.0;
+
+public:
+  explicit local_compile(const std::string& command)
+  {
+    log = tmpfile();
+    SWARM_ASSERT(log != nullptr, "Error creating temporary file: %s", strerror(errno));
+
+    pid = fork();
+    SWARM_ASSERT(pid >= 0, "Error forking local compilation: %s", strerror(errno));
+
+    if (pid == 0) {
+      setpgid(0, 0);
+      dup2(fileno(log), STDOUT_FILENO);
+      dup2(fileno(log), STDERR_FILENO);
+      execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+      _exit(127);
+    }
+  }
+
+  ~local_compile()
+  {
+    cancel();
+    fclose(log);
+  }
+
+  // Returns true if the compilation finished and sets its exit status
+  bool poll(int& status)
+  {
+    int wstatus = 0;
+    if (pid < 0 or waitpid(pid, &wstatus, WNOHANG) != pid) {
+      return false;
+    }
+
+    pid        = -1;
+    status     = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1;
+    elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    return true;
+  }
+
+  // Compilation time, once poll returned true
+  double get_elapsed_ms() const { return elapsed_ms; }
+
+  // Kills the compiler and every process it started
+  void cancel()
+  {
+    if (pid < 0) {
+      return;
+    }
+
+    kill(-pid, SIGKILL);
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    pid = -1;
+  }
+
+  // Copies the compiler output into fd
+  void forward_log(int fd) { copy_file(log, fd); }
+};
+
+// SSH session created in the background so the handshake overlaps the preprocessing. The thread shares the state, so
+// a job that does not need the session, like a cache hit, leaves it behind.
+class pending_session
+{
+private:
+  struct state_t {
+    std::mutex              mutex;
+    std::condition_variable cvar;
+    bool                    done    = false;
+    swarm::ssh::session_ptr session = nullptr;
+  };
+
+  std::shared_ptr<state_t> state = std::make_shared<state_t>();
+
+public:
+  explicit pending_session(const swarm::hostname::vector_t& hostnames)
+  {
+    std::shared_ptr<state_t> state_ = state;
+    std::thread([state_, hostnames]() {
+      swarm::ssh::session_ptr session = swarm::ssh::make_session(hostnames);
+
+      std::unique_lock<std::mutex> lock(state_->mutex);
+      state_->session = session;
+      state_->done    = true;
+      state_->cvar.notify_all();
+    }).detach();
+  }
+
+  // Waits for the session, nullptr if no host could be connected
+  swarm::ssh::session_ptr get()
+  {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cvar.wait(lock, [this] { return state->done; });
+    return state->session;
+  }
+};
+
+static std::string get_preprocessed_language(const swarm::args& args)
+{
+  return (args.get_source_language() == "c") ? "cpp-output" : "c++-cpp-output";
+}
+
 static int bypass_swarm_cc(const swarm::args& args)
 {
   std::string cmd = args.get_command();
@@ -46,17 +278,49 @@ static int bypass_swarm_cc(const swarm::args& args)
   return WEXITSTATUS(ret);
 }
 
+// Load balancer job slot, returned when the process exits including through SWARM_ASSERT
+static class lease_guard
+{
+public:
+  uint64_t id = 0;
+
+  ~lease_guard()
+  {
+    if (id != 0) {
+      swarm::hostname::release_lb(id);
+    }
+  }
+} lease;
+
+// Reports a host failure to the load balancer, together with the job slot if the host holds it
+static void report_failure(const std::string& hostname)
+{
+  if (lease.id != 0) {
+    swarm::hostname::release_lb(lease.id, true);
+    lease.id = 0;
+  } else {
+    swarm::hostname::report_lb(hostname, true);
+  }
+}
+
+static double get_elapsed_ms(std::chrono::steady_clock::time_point begin)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
 static swarm::hostname::vector_t get_host_candidates()
 {
   std::vector<std::string> hostnames;
 
+  swarm::trace::span span("get_hosts");
+
   // Try reading the host candidate from the local load balancer
-  std::string hostname_lb = swarm::hostname::get_lb();
+  std::string hostname_lb = swarm::hostname::get_lb(lease.id);
 
   // If getter from the load balancer failed...
   if (hostname_lb.empty()) {
-    // ... get all the hostnames candidates
-    hostnames = swarm::hostname::get_all();
+    // ... get all the hostnames candidates still in rotation
+    hostnames = swarm::hostname::get_available();
   } else {
     // ... use the load-balancer candidate
     hostnames.emplace_back(hostname_lb);
@@ -65,25 +329,79 @@ static swarm::hostname::vector_t get_host_candidates()
   return hostnames;
 }
 
+// Appends the compilation into the job log replayed by swarm-sim, a line "<working directory>\t<command>"
+static void record(const swarm::args& args)
+{
+  const char* record_c = getenv(SWARM_ENV_VAR_RECORD);
+  if (record_c == nullptr) {
+    return;
+  }
+
+  char cwd[PATH_MAX] = {};
+  if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+    return;
+  }
+
+  // A single write per line, the lines of concurrent compilations are not mixed
+  std::string line = std::string(cwd) + "\t" + args.get_command() + "\n";
+  int         fd   = open(record_c, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+  if (fd < 0 or write(fd, line.data(), line.size()) != static_cast<ssize_t>(line.size())) {
+    fprintf(stderr, "Warning: error recording the job into '%s'\n", record_c);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+static int print_cache_stats()
+{
+  swarm::cache::local::ptr cache = swarm::cache::local::make();
+  if (cache == nullptr) {
+    printf("Local object cache is disabled\n");
+    return 0;
+  }
+
+  swarm::cache::stats stats = cache->get_stats();
+  printf("Hits:   %lu\n", (unsigned long)stats.hits);
+  printf("Misses: %lu\n", (unsigned long)stats.misses);
+  printf("Size:   %.1f MB\n", static_cast<double>(stats.size) / (1024.0 * 1024.0));
+
+  return 0;
+}
+
 int main(int argc, char** argv)
 {
+  // Print cache statistics if requested
+  if (argc == 2 and std::string(argv[1]) == "--cache-stats") {
+    return print_cache_stats();
+  }
+
   // Parse input parameters
   swarm::args args(argc, argv);
 
   // Delete gcc-10 unsupported parameters...
-  args.delete_args("ftrivial", 1);
+  args.delete_options("-ftrivial");
 
-  // Get source file, extensions ".c", ".cpp" and ".cc"
-  std::string source_file = args.get_first_param_match("(\\.c$)|(\\.cpp$)|(\\.cc$)");
+  // Get C or C++ source file
+  std::string source_file = args.get_source();
 
   // Get compile target
-  std::string local_compile_target = args.get_first_param_match("\\.o$");
+  std::string local_compile_target = args.get_output();
 
-  // If no source nor typical C/C++ compiled file extension file is found, bypass swarm-cc
-  if (source_file.empty() or local_compile_target.empty()) {
+  // If it is not the compilation of a C/C++ source into an object, bypass swarm-cc
+  bool is_object = local_compile_target.size() > 2 and
+                   local_compile_target.compare(local_compile_target.size() - 2, 2, ".o") == 0;
+  if (source_file.empty() or not is_object or not args.has("-c")) {
     return bypass_swarm_cc(args);
   }
 
+  record(args);
+
+  // Whole invocation in the build timeline
+  swarm::trace::set_process_name("swarm-cc " + source_file);
+  swarm::trace::span span("swarm-cc");
+  span.set("source", source_file);
+
   // Lists the possible host candidates
   std::vector<std::string> hostnames = get_host_candidates();
 
@@ -114,22 +432,39 @@ int main(int argc, char** argv)
   swarm::args precompile_args = args;
 
   // Substitute
-  precompile_args.substitute_all_param_match("\\.o$", local_precompile_target);
+  precompile_args.set_output(local_precompile_target);
   precompile_args.append("-E");
 
   // Copy original compiler arguments to generate compilation command
   swarm::args compile_args = args;
 
-  // Remove precompiler parameters with secondary parameters
-  compile_args.delete_args("(\\-MT)|(\\-MF)|(\\-include)|(\\-I$)", 2);
+  // Remove precompiler parameters and their values
+  compile_args.delete_preprocessor_options();
 
-  // Remove precompiler flags
-  compile_args.delete_args("(\\-D)|(\\-I)|(\\-M)", 1);
+  // Normalized compile arguments for the object cache, independent from the local and remote paths
+  swarm::args cache_args = compile_args;
+  cache_args.set_output("-");
+  cache_args.set_source("-");
 
-  std::string local_target = compile_args.get_first_param_match("\\.o$");
-  compile_args.substitute_all_param_match("\\.o$", remote_compile_target);
-  compile_args.substitute_all_param_match("(\\.c$)|(\\.cpp$)|(\\.cc$)", remote_precompile_target);
-  std::string local_source = compile_args.get_last_param();
+  // Streaming arguments, the preprocessed source comes from stdin and the output is added by the job
+  swarm::args stream_args = compile_args;
+  stream_args.delete_output();
+  stream_args.delete_sources();
+  stream_args.append("-x");
+  stream_args.append(get_preprocessed_language(args));
+  stream_args.append("-");
+
+  // Local compilation of the preprocessed source
+  swarm::args local_compile_args = compile_args;
+  local_compile_args.set_source(local_precompile_target);
+
+  compile_args.set_output(remote_compile_target);
+  compile_args.set_source(remote_precompile_target);
+
+  // Preprocessor writing into stdout for streaming
+  swarm::args stream_precompile_args = args;
+  stream_precompile_args.set_output("-");
+  stream_precompile_args.append("-E");
 
   //    printf("Precompile command:\n\t%s\n", precompile_command.c_str());
   //    printf("Compile command:\n\t%s\n", compile_command.c_str());
@@ -137,25 +472,374 @@ int main(int argc, char** argv)
   //  fprintf(stderr, "Precompile command:\n\t%s\n", precompile_args.get_command().c_str());
   //  fprintf(stderr, "Compile command:\n\t%s\n", compile_args.get_command().c_str());
 
-  // Precompile
-  std::thread precompile_thread(precompile, precompile_args.get_command());
+  // Local object cache, nullptr if it is disabled
+  swarm::cache::local::ptr cache = swarm::cache::local::make();
+  std::string              cache_key;
+  std::string              cache_prefix;
+
+  // Stream the source and the object through the compilation channel unless it is disabled
+  const char* stream_c = getenv(SWARM_ENV_VAR_STREAM);
+  bool        stream   = (stream_c == nullptr or std::string(stream_c) != "0");
+
+  // Pump mode sends the source and its headers to be preprocessed remotely, unless the includes cannot be followed
+  swarm::pump::unit_t unit = {};
+  bool                pump = false;
+  if (swarm::pump::is_enabled()) {
+    swarm::trace::span scan_span("pump_scan");
+    pump = swarm::pump::prepare(args, source_file, local_compile_target, unit);
+    scan_span.set("files", static_cast<uint64_t>(unit.files.size()));
+  }
 
-  // Create SSH session
-  swarm::ssh::session_ptr session = swarm::ssh::make_session(hostnames);
+  // Precompile, the caches need the precompiled output before deciding whether a session is required
+  bool                             precompiled = false;
+  std::thread                      precompile_thread;
+  swarm::daemon::client::ptr       daemon  = nullptr;
+  std::shared_ptr<pending_session> pending = nullptr;
+  if (pump) {
+    // Not cached, the key could not identify the system headers of the remote host
+  } else if (cache != nullptr or (swarm::cache::remote::is_enabled() and not stream)) {
+    // Connect while preprocessing, unless the daemon keeps the sessions open
+    daemon = swarm::daemon::client::make();
+    if (daemon == nullptr) {
+      pending = std::make_shared<pending_session>(hostnames);
+    }
+
+    precompile(precompile_args.get_command());
+    precompiled = true;
+
+    cache_key = swarm::cache::make_key(local_precompile_target,
+                                       cache_args.get_command(),
+                                       swarm::cache::compiler_identity(args.get_first_param()));
+
+    // Restore the object on hit without touching any remote host
+    if (cache != nullptr and not cache_key.empty() and cache->fetch(cache_key, local_compile_target)) {
+      return 0;
+    }
+  } else if (swarm::cache::remote::is_enabled()) {
+    // Only the remote cache is enabled, the host computes the key once it has the source so preprocessing still
+    // overlaps the upload
+    cache_prefix = swarm::cache::make_key_prefix(cache_args.get_command(),
+                                                 swarm::cache::compiler_identity(args.get_first_param()));
+  } else if (not stream) {
+    precompile_thread = std::thread(precompile, precompile_args.get_command());
+  }
 
-  precompile_thread.join();
+  // Compile cheap jobs locally while the local cores are idle, the decision needs the preprocessed size. The streamed
+  // and pumped jobs only know it once the host has the source, so they are always placed remotely and never hedged.
+  swarm::history::table::ptr history      = precompiled ? swarm::history::table::make() : nullptr;
+  std::string                history_host = (hostnames.size() == 1) ? hostnames.front() : "";
+  uint64_t                   source_size  = 0;
+  struct stat                source_stat  = {};
+  if (history != nullptr and stat(local_precompile_target.c_str(), &source_stat) == 0) {
+    source_size = static_cast<uint64_t>(source_stat.st_size);
+
+    if (swarm::history::table::is_adaptive() and
+        history->decide(source_size, history_host) == swarm::history::PLACEMENT_LOCAL) {
+      // The job slot is not needed anymore
+      swarm::hostname::release_lb(lease.id);
+      lease.id = 0;
+
+      swarm::trace::span                    local_span("local_compile");
+      std::chrono::steady_clock::time_point begin  = std::chrono::steady_clock::now();
+      int                                   status = WEXITSTATUS(system(local_compile_args.get_command().c_str()));
+      if (status == 0) {
+        history->record(swarm::history::PLACEMENT_LOCAL, source_size, "", get_elapsed_ms(begin));
+        if (cache != nullptr and not cache_key.empty()) {
+          cache->store(cache_key, local_compile_target);
+        }
+      }
+      return status;
+    }
+  }
 
-  // Call precompiler and write file in remote machine
-  session->sftp_copy_local_to_remote(local_precompile_target, remote_precompile_target);
+  // Remote compilation job
+  swarm::job::description job = {};
+  job.hostnames               = hostnames;
+  job.cache_key               = cache_key;
+  job.cache_prefix            = cache_prefix;
+  job.stream                  = stream or pump;
+  job.local_source            = local_precompile_target;
+  job.remote_source           = remote_precompile_target;
+  job.command                 = stream ? stream_args.get_command() : compile_args.get_command();
+  job.remote_target           = remote_compile_target;
+  job.local_target            = local_compile_target;
+  if (pump) {
+    job.command        = unit.command;
+    job.pump_manifest  = unit.manifest;
+    job.pump_directory = unit.directory;
+  }
+
+  // Streaming input, either the already precompiled file or the preprocessor output. Pump mode needs none.
+  precompile_input input(
+      stream and not pump, precompiled, local_precompile_target, stream_precompile_args.get_command());
+
+  // The remote preprocessor may lack something the local one has, so in pump mode its errors are not shown when the
+  // compilation falls back to the local host
+  FILE* remote_log = pump ? tmpfile() : nullptr;
+  SWARM_ASSERT(not pump or remote_log != nullptr, "Error creating temporary file: %s", strerror(errno));
+  int remote_stderr_fd = (remote_log != nullptr) ? fileno(remote_log) : STDERR_FILENO;
+
+  // Hedge late remote jobs with a local compilation, every side writes its own object until one of them wins
+  double hedge_delay_ms = -1.0;
+  if (history != nullptr and source_size != 0 and swarm::history::table::is_hedging()) {
+    hedge_delay_ms = history->get_hedge_delay_ms(source_size);
+  }
+  std::string hedge_target = local_compile_target + ".hedge";
+  if (hedge_delay_ms > 0.0) {
+    job.local_target = local_compile_target + ".remote";
+  }
+
+  // The remote time includes the session, the transfers and the compilation
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+  auto run_remote = [&]() {
+    // Prefer the local daemon, which keeps the sessions open, otherwise create SSH session
+    if (daemon == nullptr and pending == nullptr) {
+      daemon = swarm::daemon::client::make();
+    }
+    swarm::ssh::session_ptr session = nullptr;
+    if (pending != nullptr) {
+      session = pending->get();
+    } else if (daemon == nullptr) {
+      session = swarm::ssh::make_session(hostnames);
+    }
+
+    if (precompile_thread.joinable()) {
+      precompile_thread.join();
+    }
+
+    // Hosts that failed the job, the retries skip them
+    std::set<std::string>     failed;
+    swarm::hostname::vector_t candidates = hostnames;
+    auto                      fail_host  = [&](const std::string& hostname) {
+      fprintf(stderr, "Warning: job failed in '%s', trying another host\n", hostname.c_str());
+      failed.insert(hostname);
+      report_failure(hostname);
+    };
+    auto update_candidates = [&]() {
+      candidates.clear();
+      for (const std::string& hostname : swarm::hostname::get_available()) {
+        if (failed.count(hostname) == 0) {
+          candidates.push_back(hostname);
+        }
+      }
+    };
+
+    // Run the job in the remote host, fall back to direct sessions if the daemon fails
+    int         status   = swarm::ssh::transport_error;
+    bool        consumed = false; // The input has been read by a previous attempt
+    std::string remote_host;      // Host that ran the job
+    if (daemon != nullptr) {
+      swarm::trace::span daemon_span("daemon_submit");
+      consumed = true;
+
+      attempt_log log;
+      if (not daemon->submit(job, input.get_fd(), STDOUT_FILENO, log.get_fd(), status, remote_host)) {
+        status = swarm::ssh::transport_error;
+      }
+      log.finish(status, remote_stderr_fd);
+
+      if (status == swarm::ssh::transport_error and not remote_host.empty()) {
+        fail_host(remote_host);
+        update_candidates();
+      }
+    }
+
+    // Retry the jobs failed by the host in the hosts that did not fail yet, within the retry budget
+    for (int trial = 0; status == swarm::ssh::transport_error and trial <= SWARM_JOB_MAX_RETRIES; trial++) {
+      if (session == nullptr) {
+        session = swarm::ssh::make_session(candidates);
+      }
+
+      if (session == nullptr) {
+        for (const std::string& hostname : candidates) {
+          failed.insert(hostname);
+          report_failure(hostname);
+        }
+      } else {
+        if (consumed) {
+          input.restart();
+        }
+        consumed = true;
+
+        swarm::trace::span job_span("remote_job");
+        job_span.set("host", session->get_hostname());
+        attempt_log log;
+        status = swarm::job::run(session, job, input.get_fd(), STDOUT_FILENO, log.get_fd());
+        job_span.end();
+        log.finish(status, remote_stderr_fd);
+        if (status != swarm::ssh::transport_error) {
+          break;
+        }
+
+        fail_host(session->get_hostname());
+        session = nullptr;
+      }
+
+      update_candidates();
+      if (candidates.empty()) {
+        break;
+      }
+    }
+
+    // Every attempt failed, compile locally rather than failing the build. A pumped compilation the remote
+    // preprocessor failed is compiled locally too, the remote headers may differ from the local ones.
+    bool fallback = (status == swarm::ssh::transport_error) or (pump and status == SWARM_PUMP_LOCAL_STATUS);
+    if (fallback) {
+      if (status == swarm::ssh::transport_error) {
+        fprintf(stderr, "Warning: no host could compile '%s', compiling locally\n", source_file.c_str());
+      } else {
+        fprintf(stderr, "Warning: pump mode failed for '%s', compiling locally\n", source_file.c_str());
+      }
+      swarm::args fallback_args = args;
+      fallback_args.set_output(job.local_target);
+      swarm::trace::span fallback_span("local_compile");
+      status = WEXITSTATUS(system(fallback_args.get_command().c_str()));
+    }
+
+    // A failed preprocessor may have produced a truncated source, which must never result in an object. The fallback
+    // does not use the input, which may have been left half read.
+    if (not input.finish() and not fallback) {
+      unlink(job.local_target.c_str());
+      SWARM_ASSERT(false, "Error. Precompiler exited with error while streaming");
+    }
+
+    // The remote output and the dependency file of a pumped compilation, the fallback writes its own
+    if (remote_log != nullptr) {
+      if (not fallback) {
+        copy_file(remote_log, STDERR_FILENO);
+      }
+      if (not fallback and status == 0) {
+        swarm::pump::write_deps(unit);
+      }
+      fclose(remote_log);
+      remote_log = nullptr;
+    }
+
+    if (session != nullptr) {
+      remote_host = session->get_hostname();
+    }
+    if (status == 0 and not fallback and not remote_host.empty()) {
+      span.set("host", remote_host);
+    }
+
+    // Learn the overhead of the host
+    if (status == 0 and not fallback and history != nullptr and source_size != 0) {
+      if (not remote_host.empty()) {
+        history_host = remote_host;
+      }
+      history->record(swarm::history::PLACEMENT_REMOTE, source_size, history_host, get_elapsed_ms(begin));
+    }
 
-  // Execute compilation command in remote machine
-  int status = session->make_channel()->execute(compile_args.get_command());
-  if (status != 0) {
     return status;
+  };
+
+  int status = 0;
+  if (hedge_delay_ms <= 0.0) {
+    status = run_remote();
+  } else {
+    std::mutex              mutex;
+    std::condition_variable cvar;
+    bool                    remote_done   = false;
+    int                     remote_status = 0;
+
+    std::thread remote_thread([&]() {
+      int s = run_remote();
+
+      std::unique_lock<std::mutex> lock(mutex);
+      remote_done   = true;
+      remote_status = s;
+      cvar.notify_all();
+    });
+
+    // Start the local compilation if the remote job is late
+    std::unique_ptr<local_compile> hedge = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cvar.wait_until(lock, begin + std::chrono::microseconds(static_cast<int64_t>(hedge_delay_ms * 1000.0)), [&] {
+        return remote_done;
+      });
+      if (not remote_done) {
+        swarm::args hedge_args = local_compile_args;
+        hedge_args.set_output(hedge_target);
+        hedge.reset(new local_compile(hedge_args.get_command()));
+      }
+    }
+
+    // Wait for the first successful result, or for both results if none succeeds
+    bool hedge_done   = (hedge == nullptr);
+    int  hedge_status = -1;
+    bool hedge_wins   = false;
+    while (true) {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (not hedge_done) {
+        hedge_done = hedge->poll(hedge_status);
+      }
+
+      if (remote_done and (remote_status == 0 or hedge_done)) {
+        hedge_wins = (remote_status != 0 and hedge_status == 0);
+        break;
+      }
+      if (hedge_done and (hedge_status == 0 or remote_done)) {
+        hedge_wins = (hedge_status == 0);
+        break;
+      }
+
+      cvar.wait_for(lock, std::chrono::milliseconds(SWARM_HEDGE_POLL_MS), [&] { return remote_done; });
+    }
+
+    if (hedge_wins) {
+      hedge->forward_log(STDERR_FILENO);
+      SWARM_ASSERT(rename(hedge_target.c_str(), local_compile_target.c_str()) == 0,
+                   "Error renaming '%s': %s",
+                   hedge_target.c_str(),
+                   strerror(errno));
+      unlink(job.local_target.c_str());
+
+      if (cache != nullptr and not cache_key.empty()) {
+        cache->store(cache_key, local_compile_target);
+      }
+
+      // Learn the local time too, the remote time of a late job is never recorded
+      if (history != nullptr) {
+        history->record(swarm::history::PLACEMENT_LOCAL, source_size, "", hedge->get_elapsed_ms());
+      }
+
+      // The remote job cannot be interrupted, leave it behind together with its job slot. A direct job dies with the
+      // process and its partial object is removed, the daemon removes the object once it sees the client is gone.
+      std::unique_lock<std::mutex> lock(mutex);
+      if (not remote_done) {
+        swarm::hostname::release_lb(lease.id);
+        unlink(swarm::job::get_partial_target(job.local_target).c_str());
+        fflush(stdout);
+        fflush(stderr);
+        _exit(0);
+      }
+      lock.unlock();
+      remote_thread.join();
+      return 0;
+    }
+
+    // The remote result is kept
+    hedge = nullptr;
+    unlink(hedge_target.c_str());
+    remote_thread.join();
+
+    status = remote_status;
+    if (status == 0) {
+      SWARM_ASSERT(rename(job.local_target.c_str(), local_compile_target.c_str()) == 0,
+                   "Error renaming '%s': %s",
+                   job.local_target.c_str(),
+                   strerror(errno));
+    } else {
+      unlink(job.local_target.c_str());
+    }
   }
 
-  // Copy remote file to local
-  session->sftp_copy_remote_to_local(remote_compile_target, local_compile_target);
+  // Keep the object for later builds
+  if (status == 0 and cache != nullptr and not cache_key.empty()) {
+    cache->store(cache_key, local_compile_target);
+  }
 
   return status;
-}
\ No newline at end of file
+}
@@ -0,0 +1,304 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "config.h"
+#include "daemon.h"
+#include "hostnames.h"
+#include "job.h"
+#include "ssh.h"
+#include "worker.h"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static std::atomic<bool> quit = {false};
+
+static void sig_handler(int signo)
+{
+  quit = true;
+}
+
+// Authenticated sessions kept open between jobs, several per host since a session serves a single job at a time. The
+// streaming jobs go through the host worker instead, which serves all of them in a single channel.
+class session_pool
+{
+private:
+  struct host_t {
+    std::string                           hostname;
+    std::vector<swarm::ssh::session_ptr>  idle              = {};
+    std::size_t                           inflight          = 0;
+    swarm::worker::client::ptr            worker            = nullptr;
+    std::chrono::steady_clock::time_point worker_retry_time = {};
+  };
+
+  std::mutex          mutex;
+  std::vector<host_t> hosts;
+  const bool          use_workers = swarm::worker::client::is_enabled();
+
+  std::size_t find_or_add(const std::string& hostname)
+  {
+    for (std::size_t i = 0; i < hosts.size(); i++) {
+      if (hosts[i].hostname == hostname) {
+        return i;
+      }
+    }
+    hosts.push_back({hostname});
+    return hosts.size() - 1;
+  }
+
+  // Selects the least busy candidate
+  std::size_t select(const swarm::hostname::vector_t& candidates)
+  {
+    std::size_t idx           = 0;
+    std::size_t best_inflight = SIZE_MAX;
+    for (const std::string& candidate : candidates) {
+      std::size_t i = find_or_add(candidate);
+      if (hosts[i].inflight < best_inflight) {
+        best_inflight = hosts[i].inflight;
+        idx           = i;
+      }
+    }
+    SWARM_ASSERT(best_inflight != SIZE_MAX, "No host candidates were given");
+
+    return idx;
+  }
+
+public:
+  explicit session_pool(const swarm::hostname::vector_t& hostnames)
+  {
+    // Connect in advance to every host, the unreachable ones are tried again on demand
+    for (const std::string& hostname : hostnames) {
+      host_t                  host    = {hostname};
+      swarm::ssh::session_ptr session = swarm::ssh::make_session(hostname);
+      if (session != nullptr) {
+        host.idle.emplace_back(session);
+      }
+      if (use_workers and session != nullptr) {
+        host.worker            = swarm::worker::client::make(hostname);
+        host.worker_retry_time = std::chrono::steady_clock::now() + std::chrono::seconds(SWARM_WORKER_RETRY_S);
+      }
+      hosts.emplace_back(host);
+    }
+  }
+
+  // Takes a session to the candidate with fewer jobs in flight, connecting a new one if all of them are busy. Returns
+  // nullptr if the host is not reachable.
+  swarm::ssh::session_ptr acquire(const swarm::hostname::vector_t& candidates, std::size_t& idx)
+  {
+    swarm::ssh::session_ptr session = nullptr;
+    std::string             hostname;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      idx          = select(candidates);
+      host_t& host = hosts[idx];
+      host.inflight++;
+      hostname = host.hostname;
+
+      if (not host.idle.empty()) {
+        session = host.idle.back();
+        host.idle.pop_back();
+      }
+    }
+
+    // Connect outside the lock to keep serving other jobs
+    if (session == nullptr) {
+      session = swarm::ssh::make_session(hostname);
+    }
+
+    return session;
+  }
+
+  // A nullptr session is not kept, the broken sessions are dropped this way
+  void release(std::size_t idx, const swarm::ssh::session_ptr& session)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    hosts[idx].inflight--;
+    if (session != nullptr) {
+      hosts[idx].idle.push_back(session);
+    }
+  }
+
+  // Takes the worker of the least busy candidate, starting it if it is not running. Returns nullptr if the host has no
+  // worker, the job then takes a session.
+  swarm::worker::client::ptr acquire_worker(const swarm::hostname::vector_t& candidates, std::size_t& idx)
+  {
+    if (not use_workers) {
+      return nullptr;
+    }
+
+    swarm::worker::client::ptr worker = nullptr;
+    std::string                hostname;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      idx          = select(candidates);
+      host_t& host = hosts[idx];
+      if (host.worker != nullptr and host.worker->is_alive()) {
+        host.inflight++;
+        return host.worker;
+      }
+
+      // Hosts without worker are not asked again for a while
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now < host.worker_retry_time) {
+        return nullptr;
+      }
+      host.worker            = nullptr;
+      host.worker_retry_time = now + std::chrono::seconds(SWARM_WORKER_RETRY_S);
+      hostname               = host.hostname;
+    }
+
+    // Start the worker outside the lock to keep serving other jobs
+    worker = swarm::worker::client::make(hostname);
+    if (worker == nullptr) {
+      return nullptr;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    hosts[idx].worker = worker;
+    hosts[idx].inflight++;
+    return worker;
+  }
+
+  void release_worker(std::size_t idx)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    hosts[idx].inflight--;
+  }
+};
+
+static void serve_connection(session_pool* pool, int sock)
+{
+  swarm::job::description job;
+  int                     stdin_fd  = -1;
+  int                     stdout_fd = -1;
+  int                     stderr_fd = -1;
+
+  // Serve jobs until the client closes the connection
+  while (swarm::daemon::receive_request(sock, job, stdin_fd, stdout_fd, stderr_fd)) {
+    // Use the known hosts still in rotation if the client did not give any candidate
+    if (job.hostnames.empty()) {
+      job.hostnames = swarm::hostname::get_available();
+    }
+
+    // The client retries the jobs failed by the host, and compiles locally if every host is out of rotation
+    std::size_t                idx    = 0;
+    int                        status = swarm::ssh::transport_error;
+    std::string                hostname;
+    bool                       any    = not job.hostnames.empty();
+    swarm::worker::client::ptr worker = (any and job.stream) ? pool->acquire_worker(job.hostnames, idx) : nullptr;
+    if (worker != nullptr) {
+      hostname = worker->get_hostname();
+      status   = swarm::job::run(worker, job, stdin_fd, stdout_fd, stderr_fd);
+      pool->release_worker(idx);
+    } else if (any) {
+      swarm::ssh::session_ptr session = pool->acquire(job.hostnames, idx);
+      if (session != nullptr) {
+        hostname = session->get_hostname();
+        status   = swarm::job::run(session, job, stdin_fd, stdout_fd, stderr_fd);
+      }
+
+      pool->release(idx, (status == swarm::ssh::transport_error) ? nullptr : session);
+    }
+
+    close(stdin_fd);
+    close(stdout_fd);
+    close(stderr_fd);
+
+    // A client gone before the reply, for instance beaten by its hedged local compilation, leaves the object behind
+    if (not swarm::daemon::send_reply(sock, status, hostname)) {
+      unlink(job.local_target.c_str());
+      break;
+    }
+  }
+
+  close(sock);
+}
+
+int main()
+{
+  // Signal handlers
+  SWARM_ASSERT(signal(SIGINT, sig_handler) == SIG_DFL, "Error, the system cannot catch SIGINT");
+  SWARM_ASSERT(signal(SIGTERM, sig_handler) == SIG_DFL, "Error, the system cannot catch SIGTERM");
+  SWARM_ASSERT(signal(SIGPIPE, SIG_IGN) == SIG_DFL, "Error, the system cannot ignore SIGPIPE");
+
+  // Open a session to every available host
+  session_pool pool(swarm::hostname::get_all());
+
+  // Create listening socket in a private directory, replacing a stale one
+  SWARM_ASSERT(swarm::daemon::make_socket_directory(),
+               "Error, the daemon socket directory of '%s' is not private",
+               swarm::daemon::get_socket_path().c_str());
+  std::string        path = swarm::daemon::get_socket_path();
+  struct sockaddr_un addr = {};
+  addr.sun_family         = AF_UNIX;
+  SWARM_ASSERT(path.size() < sizeof(addr.sun_path), "Daemon socket path '%s' is too long", path.c_str());
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  unlink(path.c_str());
+
+  // Only the current user can connect
+  int listen_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  SWARM_ASSERT(listen_sock >= 0, "Error creating socket: %s", strerror(errno));
+  mode_t mask = umask(S_IRWXG | S_IRWXO);
+  SWARM_ASSERT(bind(listen_sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0,
+               "Error binding socket '%s': %s",
+               path.c_str(),
+               strerror(errno));
+  umask(mask);
+  SWARM_ASSERT(chmod(path.c_str(), S_IRUSR | S_IWUSR) == 0, "Error setting socket mode: %s", strerror(errno));
+  SWARM_ASSERT(listen(listen_sock, SOMAXCONN) == 0, "Error listening socket: %s", strerror(errno));
+
+  printf("-- Listening in %s\n", path.c_str());
+
+  // Accept clients until a signal is handled
+  while (not quit) {
+    struct pollfd pfd = {listen_sock, POLLIN, 0};
+    if (poll(&pfd, 1, 1000) <= 0) {
+      continue;
+    }
+
+    int sock = accept4(listen_sock, nullptr, nullptr, SOCK_CLOEXEC);
+    if (sock < 0) {
+      continue;
+    }
+
+    // Other users could make the daemon write anywhere the current user can
+    if (not swarm::daemon::is_same_user(sock)) {
+      close(sock);
+      continue;
+    }
+
+    std::thread(serve_connection, &pool, sock).detach();
+  }
+
+  // Quit time!
+  close(listen_sock);
+  unlink(path.c_str());
+
+  return 0;
+}
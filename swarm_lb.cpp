@@ -16,22 +16,348 @@
  */
 
 #include "args.h"
+#include "cluster.h"
 #include "config.h"
 #include "hostnames.h"
+#include "lb.h"
+#include "metrics.h"
+#include "policy.h"
 #include "shared.h"
 #include "ssh.h"
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <csignal>
 #include <cstdio>
-#include <semaphore.h>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
 #include <thread>
 #include <unistd.h>
 #include <vector>
 
-static std::atomic<bool>   quit         = {false};
-static std::vector<double> host_fitness = {};
-static std::size_t         interval_us  = 0; // 0 for free-running
+static std::atomic<bool>                quit          = {false};
+static std::vector<std::atomic<double>> host_fitness  = {};
+static std::vector<std::atomic<double>> host_smoothed = {};
+static std::vector<std::atomic<int>>    host_cores    = {};
+static std::size_t                      interval_us   = static_cast<std::size_t>(SWARM_TELEMETRY_INTERVAL_S * 1e6);
+static swarm::metrics::registry         metrics;
+
+static const char* get_type_label(swarm::lb::message_type_t type)
+{
+  switch (type) {
+    case swarm::lb::MESSAGE_TYPE_ACQUIRE:
+      return "acquire";
+    case swarm::lb::MESSAGE_TYPE_RELEASE:
+      return "release";
+    case swarm::lb::MESSAGE_TYPE_LEASE:
+      return "lease";
+    case swarm::lb::MESSAGE_TYPE_REPORT:
+      return "report";
+  }
+  return "unknown";
+}
+
+static void declare_metrics()
+{
+  static const std::vector<double> ipc_bounds   = {1e-5, 5e-5, 1e-4, 5e-4, 1e-3, 5e-3, 1e-2, 5e-2, 0.1, 0.5};
+  static const std::vector<double> probe_bounds = {1e-3, 2e-3, 5e-3, 1e-2, 2e-2, 5e-2, 0.1, 0.2, 0.5, 1.0, 2.0, 5.0};
+
+  metrics.declare("swarm_lb_requests_total", swarm::metrics::TYPE_COUNTER, "Requests served by type");
+  metrics.declare("swarm_lb_busy_total", swarm::metrics::TYPE_COUNTER, "Slot requests refused with every slot taken");
+  metrics.declare("swarm_lb_ipc_latency_seconds",
+                  swarm::metrics::TYPE_HISTOGRAM,
+                  "Time from a request being sent until it is served",
+                  ipc_bounds);
+  metrics.declare("swarm_lb_assignments_total", swarm::metrics::TYPE_COUNTER, "Job slots taken per host");
+  metrics.declare("swarm_lb_job_failures_total", swarm::metrics::TYPE_COUNTER, "Jobs failed by the host");
+  metrics.declare("swarm_lb_probes_total", swarm::metrics::TYPE_COUNTER, "Host samples");
+  metrics.declare("swarm_lb_probe_failures_total", swarm::metrics::TYPE_COUNTER, "Failed host samples");
+  metrics.declare("swarm_lb_probe_latency_seconds",
+                  swarm::metrics::TYPE_HISTOGRAM,
+                  "Latency of the successful host samples",
+                  probe_bounds);
+  metrics.declare("swarm_lb_host_fitness", swarm::metrics::TYPE_GAUGE, "Fitness of the last sample");
+  metrics.declare("swarm_lb_host_cpu_percent", swarm::metrics::TYPE_GAUGE, "CPU load of the last sample");
+  metrics.declare("swarm_lb_host_inflight", swarm::metrics::TYPE_GAUGE, "Job slots taken");
+  metrics.declare("swarm_lb_host_capacity", swarm::metrics::TYPE_GAUGE, "Maximum number of job slots");
+  metrics.declare("swarm_lb_host_breaker_state",
+                  swarm::metrics::TYPE_GAUGE,
+                  "Circuit breaker state, 0 closed, 1 open and 2 half open");
+}
+
+// Circuit breaker of every host, fed by the own probes and by the job outcomes reported by the clients. A host that
+// keeps failing is opened, that is pulled from rotation, for a backoff that doubles every time it opens again. Once the
+// backoff expires the host is half open and the next probe decides whether it closes or opens again.
+class breaker_table
+{
+private:
+  struct host_t {
+    swarm::lb::breaker_state_t            state        = swarm::lb::BREAKER_CLOSED;
+    double                                failure_rate = 0.0; ///< Smoothed ratio of failed outcomes
+    uint32_t                              nof_outcomes = 0;
+    uint32_t                              nof_failures = 0; ///< Consecutive failures
+    uint32_t                              backoff_ms   = SWARM_BREAKER_MIN_BACKOFF_MS;
+    int                                   latency_ms   = -1; ///< Last probe latency, negative if it failed
+    std::chrono::steady_clock::time_point retry_time   = {};
+  };
+
+  std::mutex          mutex;
+  std::vector<host_t> hosts;
+
+  void open(std::size_t idx)
+  {
+    host_t& host    = hosts[idx];
+    host.state      = swarm::lb::BREAKER_OPEN;
+    host.retry_time = std::chrono::steady_clock::now() + std::chrono::milliseconds(host.backoff_ms);
+    printf("-- host %zu out of rotation for %u ms\n", idx, host.backoff_ms);
+    host.backoff_ms = std::min(host.backoff_ms * 2, static_cast<uint32_t>(SWARM_BREAKER_MAX_BACKOFF_MS));
+  }
+
+  void close(std::size_t idx)
+  {
+    host_t& host      = hosts[idx];
+    host.state        = swarm::lb::BREAKER_CLOSED;
+    host.failure_rate = 0.0;
+    host.nof_outcomes = 0;
+    host.nof_failures = 0;
+    host.backoff_ms   = SWARM_BREAKER_MIN_BACKOFF_MS;
+    printf("-- host %zu back in rotation\n", idx);
+  }
+
+  void update_state(std::size_t idx)
+  {
+    host_t& host = hosts[idx];
+    if (host.state == swarm::lb::BREAKER_OPEN and std::chrono::steady_clock::now() > host.retry_time) {
+      host.state = swarm::lb::BREAKER_HALF_OPEN;
+    }
+  }
+
+  void record_locked(std::size_t idx, bool failed)
+  {
+    host_t& host = hosts[idx];
+    if (host.state != swarm::lb::BREAKER_CLOSED) {
+      return;
+    }
+
+    host.failure_rate += SWARM_BREAKER_ALPHA * ((failed ? 1.0 : 0.0) - host.failure_rate);
+    host.nof_outcomes++;
+    host.nof_failures = failed ? host.nof_failures + 1 : 0;
+
+    if (host.nof_failures >= SWARM_BREAKER_MAX_FAILURES or
+        (host.nof_outcomes >= SWARM_BREAKER_MIN_OUTCOMES and host.failure_rate >= SWARM_BREAKER_MAX_FAILURE_RATE)) {
+      open(idx);
+    }
+  }
+
+  // A latency far above the median of the other hosts counts as a failure
+  bool is_latency_outlier(std::size_t idx) const
+  {
+    std::vector<int> latencies;
+    for (std::size_t i = 0; i < hosts.size(); i++) {
+      if (i != idx and hosts[i].latency_ms >= 0) {
+        latencies.push_back(hosts[i].latency_ms);
+      }
+    }
+    if (latencies.empty()) {
+      return false;
+    }
+
+    std::nth_element(latencies.begin(), latencies.begin() + latencies.size() / 2, latencies.end());
+    int median = latencies[latencies.size() / 2];
+
+    int latency_ms = hosts[idx].latency_ms;
+    return latency_ms > SWARM_BREAKER_MIN_OUTLIER_MS and latency_ms > SWARM_BREAKER_OUTLIER_FACTOR * median;
+  }
+
+public:
+  explicit breaker_table(std::size_t nof_hosts) : hosts(nof_hosts) {}
+
+  // Records the outcome of a job reported by a client
+  void record(std::size_t idx, bool failed)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (idx >= hosts.size()) {
+      return;
+    }
+
+    update_state(idx);
+    record_locked(idx, failed);
+  }
+
+  // Records a probe, a half open host closes or opens again depending on it
+  void record_probe(std::size_t idx, bool failed, int latency_ms)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    hosts[idx].latency_ms = failed ? -1 : latency_ms;
+    failed                = failed or is_latency_outlier(idx);
+
+    update_state(idx);
+    if (hosts[idx].state == swarm::lb::BREAKER_HALF_OPEN) {
+      if (failed) {
+        open(idx);
+      } else {
+        close(idx);
+      }
+      return;
+    }
+
+    record_locked(idx, failed);
+  }
+
+  swarm::lb::breaker_state_t get_state(std::size_t idx)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    update_state(idx);
+    return hosts[idx].state;
+  }
+};
+
+// Job slots handed out to swarm-cc processes, each host takes up to its number of cores times the overcommit factor
+class lease_table
+{
+private:
+  struct lease_t {
+    std::size_t                           host_idx;
+    pid_t                                 pid;
+    std::chrono::steady_clock::time_point expiry;
+  };
+
+  std::mutex                    mutex;
+  breaker_table&                breakers;
+  std::map<uint64_t, lease_t>   leases;
+  std::vector<std::size_t>      inflight;
+  std::vector<int64_t>          credits;
+  uint64_t                      next_id    = 1;
+  double                        overcommit = SWARM_DEFAULT_OVERCOMMIT;
+  swarm::policy::placement::ptr policy     = swarm::policy::placement::make();
+
+  // Reclaims the leases of dead processes and the expired ones
+  void reclaim()
+  {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (auto it = leases.begin(); it != leases.end();) {
+      if (now > it->second.expiry or (kill(it->second.pid, 0) != 0 and errno == ESRCH)) {
+        inflight[it->second.host_idx]--;
+        it = leases.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  std::size_t get_capacity(std::size_t host_idx) const
+  {
+    return static_cast<std::size_t>(std::max(1, host_cores[host_idx].load()) * overcommit + 0.5);
+  }
+
+  // Hosts as seen by the placement policy
+  std::vector<swarm::policy::host_view_t> get_views()
+  {
+    std::vector<swarm::policy::host_view_t> hosts(inflight.size());
+    for (std::size_t i = 0; i < inflight.size(); i++) {
+      std::size_t capacity      = get_capacity(i);
+      hosts[i].valid            = (host_fitness[i] > 0.0);
+      hosts[i].fitness          = host_fitness[i];
+      hosts[i].free_slots       = (inflight[i] < capacity) ? static_cast<uint32_t>(capacity - inflight[i]) : 0;
+      hosts[i].smoothed_fitness = host_smoothed[i];
+      hosts[i].credit           = credits[i];
+
+      // The hosts out of rotation take no job, even if no host is valid
+      if (breakers.get_state(i) != swarm::lb::BREAKER_CLOSED) {
+        hosts[i].free_slots = 0;
+      }
+    }
+    return hosts;
+  }
+
+public:
+  lease_table(std::size_t nof_hosts, breaker_table& breakers_) :
+    breakers(breakers_), inflight(nof_hosts, 0), credits(nof_hosts, 0)
+  {
+    const char* overcommit_c = getenv(SWARM_ENV_VAR_OVERCOMMIT);
+    if (overcommit_c != nullptr) {
+      overcommit = std::max(std::strtod(overcommit_c, nullptr), 0.1);
+    }
+  }
+
+  // Takes a slot in the host chosen by the placement policy, returns false if all of them are taken
+  bool acquire(pid_t pid, std::size_t& host_idx, uint64_t& lease_id)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    reclaim();
+
+    std::vector<swarm::policy::host_view_t> hosts    = get_views();
+    int                                     selected = policy->select(hosts);
+    if (selected < 0) {
+      return false;
+    }
+    swarm::policy::update_credits(hosts, selected, credits);
+
+    host_idx = static_cast<std::size_t>(selected);
+    lease_id = next_id++;
+    inflight[host_idx]++;
+    leases[lease_id] = {host_idx, pid, std::chrono::steady_clock::now() + std::chrono::seconds(SWARM_LEASE_TIMEOUT_S)};
+
+    return true;
+  }
+
+  // Takes a slot in the host chosen by the client, returns false if the host has no free slot or is out of rotation.
+  // The clients place from the same snapshot, so a burst of them may choose a host that is already full.
+  bool add(uint64_t lease_id, pid_t pid, std::size_t host_idx)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    reclaim();
+
+    if (host_idx >= inflight.size() or leases.count(lease_id) != 0) {
+      return false;
+    }
+    if (inflight[host_idx] >= get_capacity(host_idx) or breakers.get_state(host_idx) != swarm::lb::BREAKER_CLOSED) {
+      return false;
+    }
+
+    // The clients select from the published credits, charge the host they chose
+    swarm::policy::update_credits(get_views(), static_cast<int>(host_idx), credits);
+
+    inflight[host_idx]++;
+    leases[lease_id] = {host_idx, pid, std::chrono::steady_clock::now() + std::chrono::seconds(SWARM_LEASE_TIMEOUT_S)};
+    return true;
+  }
+
+  void get_usage(std::size_t host_idx, uint32_t& inflight_, uint32_t& capacity_)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    inflight_ = static_cast<uint32_t>(inflight[host_idx]);
+    capacity_ = static_cast<uint32_t>(get_capacity(host_idx));
+  }
+
+  int64_t get_credit(std::size_t host_idx)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    return credits[host_idx];
+  }
+
+  // Returns false if the lease does not exist, otherwise sets its host
+  bool release(uint64_t lease_id, std::size_t& host_idx)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    auto it = leases.find(lease_id);
+    if (it == leases.end()) {
+      return false;
+    }
+
+    host_idx = it->second.host_idx;
+    inflight[host_idx]--;
+    leases.erase(it);
+    return true;
+  }
+};
 
 static void sig_handler(int signo)
 {
@@ -46,50 +372,171 @@ static void print_help(const char* prog)
   printf("-h,--help This message\n");
 }
 
-static void update_cpu_loads(std::vector<swarm::ssh::session_ptr> sessions)
+// Publishes the cluster table for the clients and tools, serializing the updates from the sampler and server threads
+class table_publisher
 {
-  // For each session get CPU percent and update value
-  for (std::size_t i = 0; i < sessions.size(); i++) {
-    // Select session
-    swarm::ssh::session_ptr& session = sessions[i];
+private:
+  std::mutex                                      mutex;
+  std::vector<swarm::cluster::host_state_t>       states;
+  lease_table&                                    leases;
+  breaker_table&                                  breakers;
+  swarm::shared::publisher<swarm::lb::snapshot_t> publisher;
+  swarm::lb::snapshot_t                           snapshot = {};
 
-    // Get host fitness
-    double measure_time_s = 0.01;
-    int    latency_ms     = 0;
-    int    cpu_percent    = 0;
-    double fitness        = session->fitness(measure_time_s, &cpu_percent, &latency_ms);
+  void publish_locked()
+  {
+    snapshot.server_pid     = getpid();
+    snapshot.nof_hosts      = static_cast<uint32_t>(states.size());
+    snapshot.update_time_ns = swarm::lb::get_time_ns();
 
-    // Write shared variable
-    host_fitness[i] = fitness;
+    for (std::size_t i = 0; i < states.size(); i++) {
+      const swarm::cluster::host_state_t& state = states[i];
+      swarm::lb::host_entry_t&            host  = snapshot.hosts[i];
+
+      strncpy(host.hostname, state.hostname.c_str(), sizeof(host.hostname) - 1);
+      host.breaker          = breakers.get_state(i);
+      host.valid            = state.valid and host.breaker == swarm::lb::BREAKER_CLOSED;
+      host.fitness          = state.fitness;
+      host.smoothed_fitness = state.smoothed_fitness;
+      host.cpu_percent      = state.cpu_percent;
+      host.latency_ms       = state.latency_ms;
+      host.nof_cores        = state.nof_cores;
+      host.mem_total_kb     = state.mem_total_kb;
+      host.mem_available_kb = state.mem_available_kb;
+      host.sample_time_ns   = static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(state.timestamp.time_since_epoch()).count());
+      leases.get_usage(i, host.inflight, host.capacity);
+      host.credit = leases.get_credit(i);
+    }
 
-    printf("-- %20s -- %10d %10d %10.2f\n", session->get_hostname().c_str(), cpu_percent, latency_ms, fitness);
+    publisher.publish(snapshot);
   }
-}
 
-static void top_thread(std::vector<swarm::ssh::session_ptr> sessions)
-{
-  // Forever loop unless signal is handled
-  while (not quit) {
-    // Get the current of the beginning
-    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+public:
+  table_publisher(const std::vector<std::string>& hostnames, lease_table& leases_, breaker_table& breakers_) :
+    states(hostnames.size()), leases(leases_), breakers(breakers_), publisher(SWARM_LB_SNAPSHOT_FILENAME)
+  {
+    for (std::size_t i = 0; i < hostnames.size(); i++) {
+      states[i].hostname = hostnames[i];
+    }
 
-    update_cpu_loads(sessions);
+    std::unique_lock<std::mutex> lock(mutex);
+    publish_locked();
+  }
 
-    // Sleep to match interval
-    if (not quit and interval_us != 0) {
-      // Get time of the end
-      std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  void update(std::size_t idx, const swarm::cluster::host_state_t& state)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    states[idx] = state;
+    publish_locked();
+  }
 
-      // Calculate elapsed time
-      std::size_t elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+  void publish()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    publish_locked();
+  }
+};
 
-      // Sleep to match the interval time
-      if (elapsed_us < interval_us)
-        usleep(interval_us - elapsed_us);
+static void serve_thread(swarm::shared::reply<swarm::lb::request_t, swarm::lb::reply_t>* reply,
+                         lease_table*                                                    leases,
+                         breaker_table*                                                  breakers,
+                         table_publisher*                                                table,
+                         std::vector<std::string>                                        hostnames)
+{
+  auto handler = [&hostnames, leases, breakers, table](const swarm::lb::request_t& req, swarm::lb::reply_t& rep) {
+    rep = {};
+
+    metrics.add("swarm_lb_requests_total", swarm::metrics::label("type", get_type_label(req.type)));
+    uint64_t now_ns = swarm::lb::get_time_ns();
+    if (req.send_time_ns != 0 and now_ns >= req.send_time_ns) {
+      metrics.observe("swarm_lb_ipc_latency_seconds", "", static_cast<double>(now_ns - req.send_time_ns) / 1e9);
+    }
+
+    switch (req.type) {
+      case swarm::lb::MESSAGE_TYPE_RELEASE: {
+        // The outcome of the job is reported together with its slot
+        std::size_t host_idx = 0;
+        if (leases->release(req.lease_id, host_idx)) {
+          breakers->record(host_idx, req.failed != 0);
+          if (req.failed != 0) {
+            metrics.add("swarm_lb_job_failures_total", swarm::metrics::label("host", hostnames[host_idx]));
+          }
+        }
+        break;
+      }
+      case swarm::lb::MESSAGE_TYPE_REPORT:
+        breakers->record(req.host_idx, req.failed != 0);
+        if (req.failed != 0 and req.host_idx < hostnames.size()) {
+          metrics.add("swarm_lb_job_failures_total", swarm::metrics::label("host", hostnames[req.host_idx]));
+        }
+        break;
+      case swarm::lb::MESSAGE_TYPE_LEASE:
+        // The client asks for another slot if the host it chose is full
+        if (not leases->add(req.lease_id, req.pid, req.host_idx)) {
+          metrics.add("swarm_lb_busy_total");
+          rep.busy = true;
+          return;
+        }
+        rep.lease_id = req.lease_id;
+        metrics.add("swarm_lb_assignments_total", swarm::metrics::label("host", hostnames[req.host_idx]));
+        break;
+      case swarm::lb::MESSAGE_TYPE_ACQUIRE: {
+        // Take a job slot, the client retries if all of them are taken
+        std::size_t host_idx = 0;
+        if (not leases->acquire(req.pid, host_idx, rep.lease_id)) {
+          metrics.add("swarm_lb_busy_total");
+          rep.busy = true;
+          return;
+        }
+        metrics.add("swarm_lb_assignments_total", swarm::metrics::label("host", hostnames[host_idx]));
+
+        // Convert C++ to C fix size type by copying
+        strncpy(rep.hostname, hostnames[host_idx].c_str(), sizeof(rep.hostname) - 1);
+        break;
+      }
     }
+
+    // Make the slot usage visible to the clients
+    table->publish();
+  };
+
+  // Serve requests until a signal is handled
+  while (not quit) {
+    reply->serve(handler);
   }
+}
+
+// Rewrites the metrics file periodically until a signal is handled, the slot usage and the breakers are sampled then
+static void export_thread(std::string              path,
+                          lease_table*             leases,
+                          breaker_table*           breakers,
+                          std::vector<std::string> hostnames)
+{
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+  while (true) {
+    for (std::size_t i = 0; i < hostnames.size(); i++) {
+      std::string labels   = swarm::metrics::label("host", hostnames[i]);
+      uint32_t    inflight = 0, capacity = 0;
+      leases->get_usage(i, inflight, capacity);
+      metrics.set("swarm_lb_host_inflight", labels, inflight);
+      metrics.set("swarm_lb_host_capacity", labels, capacity);
+      metrics.set("swarm_lb_host_breaker_state", labels, breakers->get_state(i));
+    }
+
+    if (not metrics.write(path)) {
+      fprintf(stderr, "Error writing metrics into '%s'\n", path.c_str());
+    }
 
-  // Quit thread, do nothing
+    // The last export happens after the signal
+    if (quit) {
+      break;
+    }
+    next += std::chrono::milliseconds(SWARM_LB_METRICS_INTERVAL_MS);
+    while (not quit and std::chrono::steady_clock::now() < next) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(SWARM_IPC_SERVE_TIMEOUT_MS));
+    }
+  }
 }
 
 int main(int argc, char** argv)
@@ -102,56 +549,84 @@ int main(int argc, char** argv)
   // Parse arguments
   swarm::args args(argc, argv);
 
+  // Parse sampling interval in seconds
+  {
+    std::string i_str = args.get_value("-i");
+
+    // Check if -i argument is present
+    if (not i_str.empty()) {
+      interval_us = static_cast<std::size_t>(std::strtod(i_str.c_str(), nullptr) * 1e6);
+    }
+  }
+
   // Retrieve available hostnames
   std::vector<std::string> hostnames = swarm::hostname::get_all();
+  SWARM_ASSERT(hostnames.size() <= SWARM_LB_MAX_HOSTS, "Error, more than %d hosts", SWARM_LB_MAX_HOSTS);
 
-  // Create a session for each hostname
-  std::vector<swarm::ssh::session_ptr> sessions;
-  sessions.reserve(hostnames.size());
-  for (const std::string& hostname : hostnames) {
-    sessions.emplace_back(swarm::ssh::make_session(hostname));
+  // Create host fitness and initialise to 0
+  host_fitness = std::vector<std::atomic<double>>(hostnames.size());
+  for (std::atomic<double>& host_fitness_ : host_fitness) {
+    host_fitness_ = 0.0;
+  }
+  host_smoothed = std::vector<std::atomic<double>>(hostnames.size());
+  for (std::atomic<double>& host_smoothed_ : host_smoothed) {
+    host_smoothed_ = 0.0;
   }
 
-  // Create CPU percent and initialise to -1
-  host_fitness.resize(sessions.size());
-  for (double& cpu_fitness_ : host_fitness) {
-    cpu_fitness_ = 0.0;
+  // Create number of cores and initialise to unknown
+  host_cores = std::vector<std::atomic<int>>(hostnames.size());
+  for (std::atomic<int>& host_cores_ : host_cores) {
+    host_cores_ = 0;
   }
 
-  // Create asynchronous thread
-  std::thread thread(top_thread, sessions);
+  declare_metrics();
 
-  // Create shared memory for hostname
-  swarm::shared::reply<char[SWARM_HOSTNAME_MAX_LENGTH]> reply(SWARM_HOSTNAME_IPC_FILENAME);
-  while (not quit) {
-    // Skip processing if no request is available
-    if (not reply.available()) {
-      continue;
-    }
-
-    char hostname[SWARM_HOSTNAME_MAX_LENGTH] = "localhost";
+  // Create host health tracking, job slot accounting and the published cluster table
+  breaker_table   breakers(hostnames.size());
+  lease_table     leases(hostnames.size(), breakers);
+  table_publisher table(hostnames, leases, breakers);
 
-    // Update CPU loads
-    //    update_cpu_loads(sessions);
+  // Sample every host concurrently, every sample is a probe for the circuit breakers
+  auto update_host = [&table, &breakers](std::size_t idx, const swarm::cluster::host_state_t& state) {
+    // Write shared variables
+    host_fitness[idx]  = state.fitness;
+    host_smoothed[idx] = state.smoothed_fitness;
+    host_cores[idx]    = state.nof_cores;
+    // Only a host that did not answer fails the probe, a CPU not measured yet is not a failure
+    breakers.record_probe(idx, not state.reachable, state.latency_ms);
+    table.update(idx, state);
 
-    // Find minimum
-    double      best_host_fitness = 0;
-    std::size_t best_host_idx     = 0;
-    for (std::size_t i = 0; i < host_fitness.size(); i++) {
-      double host_fitness_ = host_fitness[i];
-      if (best_host_fitness < host_fitness_) {
-        best_host_fitness = host_fitness_;
-        best_host_idx     = i;
-      }
+    std::string labels = swarm::metrics::label("host", state.hostname);
+    metrics.add("swarm_lb_probes_total", labels);
+    if (not state.reachable) {
+      metrics.add("swarm_lb_probe_failures_total", labels);
+    } else {
+      metrics.observe("swarm_lb_probe_latency_seconds", labels, state.latency_ms / 1000.0);
+    }
+    if (state.cpu_percent >= 0) {
+      metrics.set("swarm_lb_host_cpu_percent", labels, state.cpu_percent);
     }
+    metrics.set("swarm_lb_host_fitness", labels, state.fitness);
 
-    // Convert C++ to C fix size type by copying
-    strcpy(hostname, hostnames[best_host_idx].c_str());
+    printf("-- %20s -- %10d %10d %10.2f\n", state.hostname.c_str(), state.cpu_percent, state.latency_ms, state.fitness);
+  };
+  swarm::cluster::sampler::ptr sampler = swarm::cluster::sampler::make(hostnames, 0.01, interval_us, update_host);
 
-    //    printf("-- %10s -- %20s: %10d\n", "reply", hostname, best_cpu_load);
+  // Create shared memory queue for hostname requests and serve it from several threads
+  swarm::shared::reply<swarm::lb::request_t, swarm::lb::reply_t> reply(SWARM_HOSTNAME_IPC_FILENAME);
+  std::vector<std::thread>                                        servers;
+  for (std::size_t i = 0; i < SWARM_LB_NOF_THREADS; i++) {
+    servers.emplace_back(serve_thread, &reply, &leases, &breakers, &table, hostnames);
+  }
+
+  // Export the metrics if a file is given
+  const char* metrics_c = getenv(SWARM_ENV_VAR_LB_METRICS);
+  if (metrics_c != nullptr and metrics_c[0] != '\0') {
+    servers.emplace_back(export_thread, std::string(metrics_c), &leases, &breakers, hostnames);
+  }
 
-    // Write hostname
-    reply.write(hostname);
+  for (std::thread& server : servers) {
+    server.join();
   }
 
   // Quit time!
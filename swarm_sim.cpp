@@ -0,0 +1,606 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "args.h"
+#include "config.h"
+#include "lb.h"
+#include "ssh_mock.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Compilation to replay, the command starts with the compiler
+struct job_t {
+  std::string directory;
+  std::string command;
+};
+
+// Activity of a mock host in a run, from its log
+struct host_stats_t {
+  uint64_t nof_connects   = 0;
+  uint64_t nof_commands   = 0;
+  uint64_t nof_transfers  = 0;
+  uint64_t nof_failures   = 0;
+  double   busy_ms        = 0.0; ///< Time the commands held a core
+  uint64_t bytes_sent     = 0;
+  uint64_t bytes_received = 0;
+};
+
+static void print_help(const char* prog)
+{
+  printf("Usage: %s [options]\n", prog);
+  printf("Replays compilations through swarm-cc against simulated hosts, the results are printed as JSON lines\n");
+  printf("-m        Mock hosts file (SWARM_MOCK by default)\n");
+  printf("-p        compile_commands.json to replay\n");
+  printf("-l        Job log to replay, as recorded by swarm-cc in the SWARM_RECORD file\n");
+  printf("-j        Maximum number of concurrent compilations (total mock cores by default)\n");
+  printf("-r        Number of runs, the caches are kept between runs (1 by default)\n");
+  printf("-C        Compiler replacing the recorded one, for instance a script faking the compilation\n");
+  printf("-b        Start swarm-lb for the simulated hosts\n");
+  printf("-h,--help This message\n");
+}
+
+// Quotes the argument for the shell unless it is safe as it is
+static std::string quote(const std::string& arg)
+{
+  static const std::string safe = "+-./:=@_%,";
+
+  bool is_safe = not arg.empty();
+  for (char c : arg) {
+    is_safe = is_safe and (isalnum(static_cast<unsigned char>(c)) or safe.find(c) != std::string::npos);
+  }
+  if (is_safe) {
+    return arg;
+  }
+
+  std::string ret = "'";
+  for (char c : arg) {
+    ret += (c == '\'') ? std::string("'\\''") : std::string(1, c);
+  }
+  return ret + "'";
+}
+
+// Reader of the compilation database, only the string members and the arguments arrays are kept
+class compile_db_reader
+{
+private:
+  const std::string& text;
+  std::size_t        pos = 0;
+
+  void skip_spaces()
+  {
+    while (pos < text.size() and isspace(static_cast<unsigned char>(text[pos]))) {
+      pos++;
+    }
+  }
+
+  bool expect(char c)
+  {
+    skip_spaces();
+    if (pos >= text.size() or text[pos] != c) {
+      return false;
+    }
+    pos++;
+    return true;
+  }
+
+  // Appends the code point in UTF-8
+  static void append_utf8(unsigned code, std::string& str)
+  {
+    if (code < 0x80) {
+      str += static_cast<char>(code);
+    } else if (code < 0x800) {
+      str += static_cast<char>(0xc0 | (code >> 6));
+      str += static_cast<char>(0x80 | (code & 0x3f));
+    } else {
+      str += static_cast<char>(0xe0 | (code >> 12));
+      str += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      str += static_cast<char>(0x80 | (code & 0x3f));
+    }
+  }
+
+  bool parse_string(std::string& str)
+  {
+    if (not expect('"')) {
+      return false;
+    }
+
+    str.clear();
+    while (pos < text.size() and text[pos] != '"') {
+      char c = text[pos++];
+      if (c != '\\') {
+        str += c;
+        continue;
+      }
+      if (pos >= text.size()) {
+        return false;
+      }
+
+      c = text[pos++];
+      switch (c) {
+        case 'b':
+          str += '\b';
+          break;
+        case 'f':
+          str += '\f';
+          break;
+        case 'n':
+          str += '\n';
+          break;
+        case 'r':
+          str += '\r';
+          break;
+        case 't':
+          str += '\t';
+          break;
+        case 'u':
+          if (pos + 4 > text.size()) {
+            return false;
+          }
+          append_utf8(static_cast<unsigned>(std::strtoul(text.substr(pos, 4).c_str(), nullptr, 16)), str);
+          pos += 4;
+          break;
+        default:
+          str += c;
+          break;
+      }
+    }
+
+    return expect('"');
+  }
+
+  // Skips a value of any type
+  bool skip_value()
+  {
+    skip_spaces();
+    if (pos >= text.size()) {
+      return false;
+    }
+
+    std::string str;
+    char        c = text[pos];
+    if (c == '"') {
+      return parse_string(str);
+    }
+    if (c == '[' or c == '{') {
+      char close = (c == '[') ? ']' : '}';
+      pos++;
+      if (expect(close)) {
+        return true;
+      }
+      do {
+        if (close == '}' and (not parse_string(str) or not expect(':'))) {
+          return false;
+        }
+        if (not skip_value()) {
+          return false;
+        }
+      } while (expect(','));
+      return expect(close);
+    }
+
+    // Number or literal
+    while (pos < text.size() and std::string(",]} \t\r\n").find(text[pos]) == std::string::npos) {
+      pos++;
+    }
+    return true;
+  }
+
+  bool parse_arguments(std::string& command)
+  {
+    if (not expect('[')) {
+      return false;
+    }
+
+    command.clear();
+    if (expect(']')) {
+      return true;
+    }
+    do {
+      std::string arg;
+      if (not parse_string(arg)) {
+        return false;
+      }
+      command += (command.empty() ? "" : " ") + quote(arg);
+    } while (expect(','));
+
+    return expect(']');
+  }
+
+  bool parse_entry(job_t& job)
+  {
+    if (not expect('{')) {
+      return false;
+    }
+    if (expect('}')) {
+      return true;
+    }
+
+    do {
+      std::string key;
+      if (not parse_string(key) or not expect(':')) {
+        return false;
+      }
+
+      bool ok = true;
+      if (key == "directory") {
+        ok = parse_string(job.directory);
+      } else if (key == "command") {
+        ok = parse_string(job.command);
+      } else if (key == "arguments") {
+        ok = parse_arguments(job.command);
+      } else {
+        ok = skip_value();
+      }
+      if (not ok) {
+        return false;
+      }
+    } while (expect(','));
+
+    return expect('}');
+  }
+
+public:
+  explicit compile_db_reader(const std::string& text_) : text(text_) {}
+
+  // Returns false if the text is not an array of entries
+  bool parse(std::vector<job_t>& jobs)
+  {
+    if (not expect('[')) {
+      return false;
+    }
+    if (expect(']')) {
+      return true;
+    }
+
+    do {
+      job_t job = {};
+      if (not parse_entry(job)) {
+        return false;
+      }
+      if (not job.command.empty()) {
+        jobs.push_back(job);
+      }
+    } while (expect(','));
+
+    return expect(']');
+  }
+};
+
+static std::vector<job_t> load_compile_db(const std::string& path)
+{
+  std::ifstream file(path);
+  SWARM_ASSERT(file.good(), "Error opening '%s'", path.c_str());
+
+  std::stringstream ss;
+  ss << file.rdbuf();
+  std::string text = ss.str();
+
+  std::vector<job_t> jobs;
+  SWARM_ASSERT(compile_db_reader(text).parse(jobs), "Error parsing '%s'", path.c_str());
+  return jobs;
+}
+
+// Job log lines "<working directory>\t<command>"
+static std::vector<job_t> load_job_log(const std::string& path)
+{
+  std::ifstream file(path);
+  SWARM_ASSERT(file.good(), "Error opening '%s'", path.c_str());
+
+  std::vector<job_t> jobs;
+  std::string        line;
+  while (std::getline(file, line)) {
+    std::size_t tab = line.find('\t');
+    if (tab != std::string::npos) {
+      jobs.push_back({line.substr(0, tab), line.substr(tab + 1)});
+    }
+  }
+  return jobs;
+}
+
+// Directory of this executable, the other tools are expected next to it
+static std::string get_tools_directory()
+{
+  char path[PATH_MAX] = {};
+  if (readlink("/proc/self/exe", path, sizeof(path) - 1) < 0) {
+    return ".";
+  }
+
+  std::string str = path;
+  return str.substr(0, str.find_last_of('/'));
+}
+
+// Command given to swarm-cc, a command that already goes through swarm-cc is kept
+static std::string get_command(const job_t& job, const std::string& swarm_cc, const std::string& compiler)
+{
+  std::string command  = job.command;
+  std::size_t end      = command.find(' ');
+  std::string first    = command.substr(0, end);
+  std::string basename = first.substr(first.find_last_of('/') + 1);
+  if (basename == "swarm-cc") {
+    command = (end == std::string::npos) ? "" : command.substr(end + 1);
+    end     = command.find(' ');
+  }
+
+  if (not compiler.empty()) {
+    command = compiler + ((end == std::string::npos) ? "" : command.substr(end));
+  }
+
+  return quote(swarm_cc) + " " + command;
+}
+
+static pid_t start(const std::string& directory, const std::string& command)
+{
+  pid_t pid = fork();
+  SWARM_ASSERT(pid >= 0, "Error forking: %s", strerror(errno));
+
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    if (not directory.empty() and chdir(directory.c_str()) != 0) {
+      fprintf(stderr, "Error entering '%s': %s\n", directory.c_str(), strerror(errno));
+      _exit(127);
+    }
+    execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+    _exit(127);
+  }
+
+  return pid;
+}
+
+static host_stats_t read_host_stats(const std::string& hostname)
+{
+  host_stats_t  stats = {};
+  std::ifstream file(swarm::ssh::mock::get_root(hostname) + "/log");
+
+  std::string   operation;
+  double        elapsed_ms = 0.0;
+  unsigned long sent = 0, received = 0;
+  while (file >> operation >> elapsed_ms >> sent >> received) {
+    if (operation == "connect") {
+      stats.nof_connects++;
+    } else if (operation == "exec") {
+      stats.nof_commands++;
+      stats.busy_ms += elapsed_ms;
+    } else if (operation == "failure") {
+      stats.nof_failures++;
+    } else {
+      stats.nof_transfers++;
+    }
+    stats.bytes_sent += sent;
+    stats.bytes_received += received;
+  }
+
+  return stats;
+}
+
+static double get_percentile(const std::vector<double>& sorted, double percentile)
+{
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(percentile * static_cast<double>(sorted.size())))];
+}
+
+// Replays every job keeping up to nof_parallel of them running, and prints the run results
+static void run(std::size_t                                  run_idx,
+                const std::vector<job_t>&                    jobs,
+                const std::vector<std::string>&              commands,
+                const std::vector<swarm::ssh::mock::host_t>& hosts,
+                std::size_t                                  nof_parallel)
+{
+  typedef std::chrono::steady_clock::time_point time_point_t;
+
+  // Every run is accounted on its own
+  for (const swarm::ssh::mock::host_t& host : hosts) {
+    unlink((swarm::ssh::mock::get_root(host.hostname) + "/log").c_str());
+  }
+
+  std::map<pid_t, time_point_t> running;
+  std::vector<double>           latencies_ms;
+  std::size_t                   next       = 0;
+  std::size_t                   nof_failed = 0;
+  time_point_t                  begin      = std::chrono::steady_clock::now();
+
+  while (next < jobs.size() or not running.empty()) {
+    while (next < jobs.size() and running.size() < nof_parallel) {
+      running[start(jobs[next].directory, commands[next])] = std::chrono::steady_clock::now();
+      next++;
+    }
+
+    int   status = 0;
+    pid_t pid    = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      SWARM_ASSERT(errno == EINTR, "Error waiting for the jobs: %s", strerror(errno));
+      continue;
+    }
+
+    auto it = running.find(pid);
+    if (it == running.end()) {
+      continue;
+    }
+
+    latencies_ms.push_back(
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - it->second).count());
+    if (not WIFEXITED(status) or WEXITSTATUS(status) != 0) {
+      nof_failed++;
+    }
+    running.erase(it);
+  }
+
+  double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+  std::sort(latencies_ms.begin(), latencies_ms.end());
+  double sum_ms = 0.0;
+  for (double latency_ms : latencies_ms) {
+    sum_ms += latency_ms;
+  }
+
+  printf("{\"run\":%zu,\"jobs\":%zu,\"failed\":%zu,\"parallel\":%zu,\"hosts\":%zu,\"wall_s\":%.3f,\"jobs_per_s\":%.3f,"
+         "\"mean_ms\":%.3f,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}\n",
+         run_idx,
+         jobs.size(),
+         nof_failed,
+         nof_parallel,
+         hosts.size(),
+         wall_s,
+         static_cast<double>(jobs.size()) / wall_s,
+         latencies_ms.empty() ? 0.0 : sum_ms / static_cast<double>(latencies_ms.size()),
+         get_percentile(latencies_ms, 0.5),
+         get_percentile(latencies_ms, 0.99),
+         latencies_ms.empty() ? 0.0 : latencies_ms.back());
+
+  for (const swarm::ssh::mock::host_t& host : hosts) {
+    host_stats_t stats = read_host_stats(host.hostname);
+    printf("{\"run\":%zu,\"host\":\"%s\",\"connects\":%lu,\"commands\":%lu,\"transfers\":%lu,\"failures\":%lu,"
+           "\"busy_s\":%.3f,\"utilization\":%.3f,\"bytes_sent\":%lu,\"bytes_received\":%lu}\n",
+           run_idx,
+           host.hostname.c_str(),
+           static_cast<unsigned long>(stats.nof_connects),
+           static_cast<unsigned long>(stats.nof_commands),
+           static_cast<unsigned long>(stats.nof_transfers),
+           static_cast<unsigned long>(stats.nof_failures),
+           stats.busy_ms / 1000.0,
+           stats.busy_ms / 1000.0 / (wall_s * host.nof_cores),
+           static_cast<unsigned long>(stats.bytes_sent),
+           static_cast<unsigned long>(stats.bytes_received));
+  }
+  fflush(stdout);
+}
+
+// Starts swarm-lb and waits for its first cluster table
+static pid_t start_lb(const std::string& tools_directory)
+{
+  pid_t pid = start("", "exec " + quote(tools_directory + "/swarm-lb"));
+
+  swarm::lb::snapshot_t snapshot = {};
+  for (int i = 0; i < SWARM_SIM_LB_START_TIMEOUT_MS / 10 and not swarm::lb::read_snapshot(snapshot); i++) {
+    usleep(10000);
+  }
+  SWARM_ASSERT(swarm::lb::read_snapshot(snapshot), "Error. swarm-lb did not publish the cluster table");
+
+  return pid;
+}
+
+int main(int argc, char** argv)
+{
+  // Parse arguments
+  swarm::args args(argc, argv);
+
+  // Parse help
+  {
+    if (args.has("-h") or args.has("--help") or argc == 1) {
+      print_help(argv[0]);
+      return 0;
+    }
+  }
+
+  // The mock hosts file is given to every process of the simulation, which may run in other directories
+  std::string hosts_path = args.get_value("-m");
+  if (hosts_path.empty() and swarm::ssh::mock::is_enabled()) {
+    hosts_path = getenv(SWARM_ENV_VAR_MOCK);
+  }
+  SWARM_ASSERT(not hosts_path.empty(), "Error. The mock hosts file is missing, see -h");
+  char hosts_realpath[PATH_MAX] = {};
+  SWARM_ASSERT(realpath(hosts_path.c_str(), hosts_realpath) != nullptr,
+               "Error opening '%s': %s",
+               hosts_path.c_str(),
+               strerror(errno));
+
+  std::vector<swarm::ssh::mock::host_t> hosts = swarm::ssh::mock::load(hosts_realpath);
+  SWARM_ASSERT(not hosts.empty(), "Error. No hosts in '%s'", hosts_realpath);
+  SWARM_ASSERT(hosts.size() <= SWARM_LB_MAX_HOSTS, "Error. More than %d hosts", SWARM_LB_MAX_HOSTS);
+
+  std::string hostnames;
+  std::size_t nof_cores = 0;
+  for (const swarm::ssh::mock::host_t& host : hosts) {
+    hostnames += (hostnames.empty() ? "" : std::string(1, SWARM_HOSTNAME_LIST_DELIMITER)) + host.hostname;
+    nof_cores += static_cast<std::size_t>(host.nof_cores);
+  }
+  setenv(SWARM_ENV_VAR_MOCK, hosts_realpath, 1);
+  setenv(SWARM_ENV_VAR_HOSTNAME_LIST, hostnames.c_str(), 1);
+
+  // Jobs to replay
+  std::vector<job_t> jobs;
+  std::string        db_path  = args.get_value("-p");
+  std::string        log_path = args.get_value("-l");
+  if (not db_path.empty()) {
+    jobs = load_compile_db(db_path);
+  } else if (not log_path.empty()) {
+    jobs = load_job_log(log_path);
+  }
+  SWARM_ASSERT(not jobs.empty(), "Error. No jobs to replay, see -h");
+
+  std::size_t nof_parallel = nof_cores;
+  {
+    std::string j_str = args.get_value("-j");
+    if (not j_str.empty()) {
+      nof_parallel = static_cast<std::size_t>(std::max(1, std::atoi(j_str.c_str())));
+    }
+  }
+
+  std::size_t nof_runs = 1;
+  {
+    std::string r_str = args.get_value("-r");
+    if (not r_str.empty()) {
+      nof_runs = static_cast<std::size_t>(std::max(1, std::atoi(r_str.c_str())));
+    }
+  }
+
+  std::string tools_directory = get_tools_directory();
+  std::string compiler        = args.get_value("-C");
+
+  std::vector<std::string> commands;
+  for (const job_t& job : jobs) {
+    commands.push_back(get_command(job, tools_directory + "/swarm-cc", compiler));
+  }
+
+  // Every simulation starts from empty hosts
+  for (const swarm::ssh::mock::host_t& host : hosts) {
+    std::string command = "rm -rf " + quote(swarm::ssh::mock::get_root(host.hostname));
+    SWARM_ASSERT(system(command.c_str()) == 0, "Error cleaning the mock host '%s'", host.hostname.c_str());
+  }
+
+  pid_t lb_pid = -1;
+  if (args.has("-b")) {
+    lb_pid = start_lb(tools_directory);
+  }
+
+  for (std::size_t i = 0; i < nof_runs; i++) {
+    run(i, jobs, commands, hosts, nof_parallel);
+  }
+
+  if (lb_pid > 0) {
+    kill(lb_pid, SIGINT);
+    waitpid(lb_pid, nullptr, 0);
+  }
+
+  return 0;
+}
@@ -16,13 +16,16 @@
  */
 
 #include "args.h"
+#include "cluster.h"
 #include "config.h"
 #include "hostnames.h"
+#include "lb.h"
 #include "ssh.h"
 #include <atomic>
 #include <chrono>
 #include <csignal>
 #include <cstdio>
+#include <cstring>
 #include <unistd.h>
 
 static std::atomic<bool> quit = {false};
@@ -37,6 +40,7 @@ static void print_help(const char* prog)
   printf("Usage: %s [options]\n", prog);
   printf("-n        Number of repetitions (infinite by default)\n");
   printf("-i        Interval in seconds (1 second)\n");
+  printf("-s        Read the cluster table published by swarm-lb instead of connecting to the hosts\n");
   printf("-h,--help This message\n");
 }
 
@@ -52,8 +56,7 @@ int main(int argc, char** argv)
 
   // Parse help
   {
-    std::string help_str = args.get_first_param_match("^((\\-){1,2}((h)|(help)))$", 0);
-    if (not help_str.empty()) {
+    if (args.has("-h") or args.has("--help")) {
       print_help(argv[0]);
       return 0;
     }
@@ -62,7 +65,7 @@ int main(int argc, char** argv)
   // Parse number of repetitions
   std::size_t n = 0;
   {
-    std::string n_str = args.get_first_param_match("\\-n", 1);
+    std::string n_str = args.get_value("-n");
 
     // Check if -n argument is present
     if (not n_str.empty()) {
@@ -73,7 +76,7 @@ int main(int argc, char** argv)
   // Parse interval in seconds
   std::size_t interval_us = 1000000UL;
   {
-    std::string i_str = args.get_first_param_match("\\-i", 1);
+    std::string i_str = args.get_value("-i");
 
     // Check if -n argument is present
     if (not i_str.empty()) {
@@ -81,14 +84,15 @@ int main(int argc, char** argv)
     }
   }
 
-  // Retrieve available hostnames
-  std::vector<std::string> hostnames = swarm::hostname::get_all();
+  // Parse snapshot mode
+  bool from_snapshot = args.has("-s");
 
-  // Create session for each hostname
-  std::vector<swarm::ssh::session_ptr> sessions;
-  sessions.reserve(hostnames.size());
-  for (const std::string& hostname : hostnames) {
-    sessions.emplace_back(swarm::ssh::make_session(hostname));
+  // Sample every host concurrently at the display interval, unless the table is read from swarm-lb
+  swarm::cluster::sampler::ptr sampler = nullptr;
+  if (not from_snapshot) {
+    const double measure_time_s = 0.05;
+    sampler = swarm::cluster::sampler::make(swarm::hostname::get_all(), measure_time_s, interval_us);
+    sampler->wait_first_samples(SWARM_TELEMETRY_TIMEOUT_MS + static_cast<int>(measure_time_s * 1000.0));
   }
 
   // Counter for table header print
@@ -99,25 +103,65 @@ int main(int argc, char** argv)
     // Get the current of the beginning
     std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 
+    // Get the host states and their job slots
+    std::vector<swarm::cluster::host_state_t> states;
+    std::vector<std::string>                  slots;
+    if (sampler != nullptr) {
+      states = sampler->get_states();
+      slots.assign(states.size(), "-");
+    } else {
+      swarm::lb::snapshot_t snapshot = {};
+      if (not swarm::lb::read_snapshot(snapshot)) {
+        fprintf(stderr, "Error. swarm-lb is not running\n");
+        return -1;
+      }
+
+      for (uint32_t i = 0; i < snapshot.nof_hosts; i++) {
+        const swarm::lb::host_entry_t& host  = snapshot.hosts[i];
+        swarm::cluster::host_state_t   state = {};
+        state.hostname    = std::string(host.hostname, strnlen(host.hostname, sizeof(host.hostname)));
+        state.fitness     = host.fitness;
+        state.cpu_percent = host.cpu_percent;
+        state.latency_ms  = host.latency_ms;
+        state.nof_samples = (host.sample_time_ns != 0) ? 1 : 0;
+        state.timestamp   = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(host.sample_time_ns));
+        states.push_back(state);
+        slots.push_back(std::to_string(host.inflight) + "/" + std::to_string(host.capacity));
+      }
+    }
+
     // Print table header
     if (head_count == 0) {
-      printf("+----------------------+------------+------------+\n");
-      printf("| %20s | %10s | %10s | %10s |\n", "Hostname", "Lat. [ms]", "CPU [%]", "Fitness");
-      printf("+----------------------+------------+------------+\n");
+      printf("+----------------------+------------+------------+------------+------------+------------+\n");
+      printf("| %20s | %10s | %10s | %10s | %10s | %10s |\n",
+             "Hostname",
+             "Lat. [ms]",
+             "CPU [%]",
+             "Fitness",
+             "Age [ms]",
+             "Slots");
+      printf("+----------------------+------------+------------+------------+------------+------------+\n");
     }
     head_count = (head_count + 1) % 10;
 
-    // For each session...
-    for (swarm::ssh::session_ptr session : sessions) {
-      const double measure_time_s = 0.05;
+    // For each host...
+    for (std::size_t i = 0; i < states.size(); i++) {
+      const swarm::cluster::host_state_t& state = states[i];
 
-      // Calculate parameters
-      int    latency_ms  = 0;
-      int    cpu_percent = 0;
-      double fitness     = session->fitness(measure_time_s, &cpu_percent, &latency_ms);
+      // Calculate how old the sample is
+      long age_ms = std::chrono::duration_cast<std::chrono::milliseconds>(begin - state.timestamp).count();
+      if (state.nof_samples == 0) {
+        age_ms = -1;
+      }
 
       // Print latency
-      printf("| %20s | %10d | %10d | %10.2f |\n", session->get_hostname().c_str(), latency_ms, cpu_percent, fitness);
+      printf("| %20s | %10d | %10d | %10.2f | %10ld | %10s |\n",
+             state.hostname.c_str(),
+             state.latency_ms,
+             state.cpu_percent,
+             state.fitness,
+             age_ms,
+             slots[i].c_str());
     }
 
     // If n is set, then the loop is finite
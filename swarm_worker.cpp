@@ -0,0 +1,384 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "args.h"
+#include "config.h"
+#include "ssh.h"
+#include "worker.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <map>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Job received from the client, it waits in the queue until a slot is free
+struct job_t {
+  std::string       command;
+  pid_t             pid       = 0;
+  int               stdin_fd  = -1;
+  int               stdout_fd = -1;
+  int               stderr_fd = -1;
+  std::vector<char> input; ///< Input not written yet
+  bool              input_end = false;
+};
+
+static std::map<uint32_t, job_t> jobs;
+static std::deque<uint32_t>      queue;
+static std::size_t               nof_running = 0;
+static bool                      starving    = false; ///< A running job waits for input the client did not send yet
+static std::vector<char>         output; ///< Frames not written yet into the standard output
+
+static void print_help(const char* prog)
+{
+  printf("Usage: %s [options]\n", prog);
+  printf("Runs the jobs sent through the standard input, it is started by swarm-daemon in every host\n");
+  printf("-j        Maximum number of concurrent jobs (number of cores by default)\n");
+  printf("-h,--help This message\n");
+}
+
+static void close_fd(int& fd)
+{
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+// Starts the job, returns false if the worker ran out of descriptors or processes
+static bool start(job_t& job)
+{
+  int  in[2]  = {-1, -1};
+  int  out[2] = {-1, -1};
+  int  err[2] = {-1, -1};
+  bool piped  = pipe2(in, O_CLOEXEC) == 0 and pipe2(out, O_CLOEXEC) == 0 and pipe2(err, O_CLOEXEC) == 0;
+
+  job.pid = piped ? fork() : -1;
+  if (job.pid < 0) {
+    fprintf(stderr, "Error starting job: %s\n", strerror(errno));
+    for (int* fd : {&in[0], &in[1], &out[0], &out[1], &err[0], &err[1]}) {
+      close_fd(*fd);
+    }
+    return false;
+  }
+
+  if (job.pid == 0) {
+    // Own process group, so the whole job can be killed
+    setpgid(0, 0);
+    dup2(in[0], STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    dup2(err[1], STDERR_FILENO);
+    execl("/bin/sh", "sh", "-c", job.command.c_str(), static_cast<char*>(nullptr));
+    _exit(127);
+  }
+
+  close(in[0]);
+  close(out[1]);
+  close(err[1]);
+  job.stdin_fd  = in[1];
+  job.stdout_fd = out[0];
+  job.stderr_fd = err[0];
+  fcntl(job.stdin_fd, F_SETFL, O_NONBLOCK);
+  nof_running++;
+  return true;
+}
+
+// Starts the queued jobs while there are free slots
+static void schedule(std::size_t nof_slots)
+{
+  while (nof_running < nof_slots and not queue.empty()) {
+    uint32_t job_id = queue.front();
+    queue.pop_front();
+
+    // Only this job fails, the client retries it in another host
+    if (not start(jobs[job_id])) {
+      swarm::worker::encode_u32(
+          swarm::worker::FRAME_STATUS, job_id, static_cast<uint32_t>(swarm::ssh::transport_error), output);
+      jobs.erase(job_id);
+    }
+  }
+}
+
+// Input received and not written yet into the jobs
+static std::size_t get_pending_input()
+{
+  std::size_t nbytes = 0;
+  for (const auto& entry : jobs) {
+    nbytes += entry.second.input.size();
+  }
+  return nbytes;
+}
+
+static void handle_frame(swarm::worker::frame_t& frame)
+{
+  switch (frame.type) {
+    case swarm::worker::FRAME_SUBMIT:
+      jobs[frame.job_id].command.assign(frame.payload.begin(), frame.payload.end());
+      queue.push_back(frame.job_id);
+      break;
+    case swarm::worker::FRAME_INPUT: {
+      auto it = jobs.find(frame.job_id);
+      if (it == jobs.end() or it->second.input_end) {
+        break;
+      }
+
+      // The input is only read past its limit for a starving job, the queued jobs over the limit fail and the client
+      // retries them in another host. Their remaining frames are ignored.
+      if (it->second.pid <= 0 and starving and
+          get_pending_input() + frame.payload.size() > SWARM_WORKER_MAX_INPUT_SZ) {
+        queue.erase(std::remove(queue.begin(), queue.end(), frame.job_id), queue.end());
+        swarm::worker::encode_u32(
+            swarm::worker::FRAME_STATUS, frame.job_id, static_cast<uint32_t>(swarm::ssh::transport_error), output);
+        jobs.erase(it);
+        break;
+      }
+      it->second.input.insert(it->second.input.end(), frame.payload.begin(), frame.payload.end());
+      break;
+    }
+    case swarm::worker::FRAME_INPUT_END: {
+      auto it = jobs.find(frame.job_id);
+      if (it != jobs.end()) {
+        it->second.input_end = true;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// Writes as much pending input as the job takes, the input is closed once it has been written
+static void feed(job_t& job)
+{
+  if (job.stdin_fd < 0) {
+    return;
+  }
+
+  if (not job.input.empty()) {
+    ssize_t n = write(job.stdin_fd, job.input.data(), job.input.size());
+    if (n > 0) {
+      job.input.erase(job.input.begin(), job.input.begin() + n);
+    } else if (n < 0 and errno != EAGAIN and errno != EINTR) {
+      // The job does not read its input anymore
+      job.input.clear();
+      job.input_end = true;
+    }
+  }
+
+  if (job.input_end and job.input.empty()) {
+    close_fd(job.stdin_fd);
+  }
+}
+
+// Forwards a chunk of the job output as a frame, closes the descriptor at the end
+static void forward(uint32_t job_id, int& fd, swarm::worker::frame_type_t type)
+{
+  char    buffer[SWARM_WORKER_CHUNK_SZ];
+  ssize_t n = read(fd, buffer, sizeof(buffer));
+  if (n > 0) {
+    swarm::worker::encode(type, job_id, buffer, static_cast<std::size_t>(n), output);
+  } else if (n == 0 or errno != EINTR) {
+    close_fd(fd);
+  }
+}
+
+// Reports the jobs that closed their output and exited
+static void reap()
+{
+  for (auto it = jobs.begin(); it != jobs.end();) {
+    job_t& job = it->second;
+    if (job.pid <= 0 or job.stdout_fd >= 0 or job.stderr_fd >= 0) {
+      ++it;
+      continue;
+    }
+
+    int status = 0;
+    if (waitpid(job.pid, &status, WNOHANG) != job.pid) {
+      ++it;
+      continue;
+    }
+
+    int exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    swarm::worker::encode_u32(swarm::worker::FRAME_STATUS, it->first, static_cast<uint32_t>(exit_status), output);
+
+    close_fd(job.stdin_fd);
+    nof_running--;
+    it = jobs.erase(it);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  // A job that stops reading its input must not kill the worker
+  SWARM_ASSERT(signal(SIGPIPE, SIG_IGN) == SIG_DFL, "Error, the system cannot ignore SIGPIPE");
+
+  // Parse arguments
+  swarm::args args(argc, argv);
+
+  // Parse help
+  {
+    if (args.has("-h") or args.has("--help")) {
+      print_help(argv[0]);
+      return 0;
+    }
+  }
+
+  // Parse number of slots
+  std::size_t nof_slots = static_cast<std::size_t>(std::max(1L, sysconf(_SC_NPROCESSORS_ONLN)));
+  {
+    std::string j_str = args.get_value("-j");
+    if (not j_str.empty()) {
+      nof_slots = static_cast<std::size_t>(std::max(1, std::atoi(j_str.c_str())));
+    }
+  }
+
+  // The output is written as the client takes it, so the input is never blocked
+  fcntl(STDOUT_FILENO, F_SETFL, fcntl(STDOUT_FILENO, F_GETFL) | O_NONBLOCK);
+
+  // Announce the protocol version
+  swarm::worker::encode_u32(swarm::worker::FRAME_HELLO, 0, SWARM_WORKER_PROTOCOL_VERSION, output);
+
+  swarm::worker::decoder decoder;
+  bool                   input_eof = false;
+
+  // Serve until the client closes the connection and every output has been written
+  while (not input_eof or not output.empty()) {
+    schedule(nof_slots);
+
+    // A running job may wait for input behind the input of the queued jobs, which is then read past its limit
+    starving = false;
+    for (auto& entry : jobs) {
+      job_t& job = entry.second;
+      starving   = starving or (job.pid > 0 and job.stdin_fd >= 0 and job.input.empty() and not job.input_end);
+    }
+
+    // Watch the client input while the jobs keep up, the job outputs while the client keeps up, and the inputs with
+    // pending bytes
+    std::vector<struct pollfd> pfds;
+    std::vector<uint32_t>      owners;
+    bool                       reaping = false;
+    if (not input_eof and (starving or get_pending_input() < SWARM_WORKER_MAX_INPUT_SZ)) {
+      pfds.push_back({STDIN_FILENO, POLLIN, 0});
+      owners.push_back(0);
+    }
+    if (not output.empty()) {
+      pfds.push_back({STDOUT_FILENO, POLLOUT, 0});
+      owners.push_back(0);
+    }
+    for (auto& entry : jobs) {
+      job_t& job = entry.second;
+      if (job.pid <= 0) {
+        continue;
+      }
+
+      feed(job);
+      if (job.stdin_fd >= 0 and not job.input.empty()) {
+        pfds.push_back({job.stdin_fd, POLLOUT, 0});
+        owners.push_back(entry.first);
+      }
+      if (output.size() < SWARM_WORKER_MAX_OUTPUT_SZ) {
+        for (int fd : {job.stdout_fd, job.stderr_fd}) {
+          if (fd >= 0) {
+            pfds.push_back({fd, POLLIN, 0});
+            owners.push_back(entry.first);
+          }
+        }
+      }
+      reaping = reaping or (job.stdout_fd < 0 and job.stderr_fd < 0);
+    }
+
+    // The exited jobs are polled, SIGCHLD would wake up nothing
+    if (poll(pfds.data(), pfds.size(), reaping ? SWARM_WORKER_POLL_MS : -1) < 0 and errno != EINTR) {
+      SWARM_ASSERT(false, "Error polling: %s", strerror(errno));
+    }
+
+    for (std::size_t i = 0; i < pfds.size(); i++) {
+      const struct pollfd& pfd = pfds[i];
+      if (pfd.revents == 0) {
+        continue;
+      }
+
+      if (pfd.fd == STDIN_FILENO) {
+        char    buffer[SWARM_WORKER_CHUNK_SZ];
+        ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (n <= 0 and not(n < 0 and errno == EINTR)) {
+          input_eof = true;
+          continue;
+        }
+        if (n > 0) {
+          decoder.append(buffer, static_cast<std::size_t>(n));
+        }
+
+        swarm::worker::frame_t frame;
+        while (decoder.pop(frame)) {
+          handle_frame(frame);
+        }
+
+        // The stream is out of sync, drop the connection together with its jobs
+        if (decoder.is_corrupt()) {
+          fprintf(stderr, "Error. Corrupt input stream, closing the connection\n");
+          input_eof = true;
+          output.clear();
+          break;
+        }
+      } else if (pfd.fd == STDOUT_FILENO) {
+        ssize_t n = write(STDOUT_FILENO, output.data(), output.size());
+        if (n > 0) {
+          output.erase(output.begin(), output.begin() + n);
+        } else if (n < 0 and errno != EAGAIN and errno != EINTR) {
+          // Nobody is listening anymore
+          input_eof = true;
+          output.clear();
+        }
+      } else {
+        auto it = jobs.find(owners[i]);
+        if (it == jobs.end()) {
+          continue;
+        }
+
+        job_t& job = it->second;
+        if (pfd.fd == job.stdin_fd) {
+          feed(job);
+        } else if (pfd.fd == job.stdout_fd) {
+          forward(it->first, job.stdout_fd, swarm::worker::FRAME_STDOUT);
+        } else if (pfd.fd == job.stderr_fd) {
+          forward(it->first, job.stderr_fd, swarm::worker::FRAME_STDERR);
+        }
+      }
+    }
+
+    reap();
+  }
+
+  // The client is gone, its jobs are useless
+  for (auto& entry : jobs) {
+    if (entry.second.pid > 0) {
+      kill(-entry.second.pid, SIGKILL);
+      waitpid(entry.second.pid, nullptr, 0);
+    }
+  }
+
+  // Quit time!
+  return 0;
+}
@@ -0,0 +1,136 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "trace.h"
+#include "config.h"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const char* get_path()
+{
+  static const char* path = getenv(SWARM_ENV_VAR_TRACE);
+  return (path != nullptr and path[0] != '\0') ? path : nullptr;
+}
+
+static uint64_t get_time_us()
+{
+  struct timespec ts = {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000UL + static_cast<uint64_t>(ts.tv_nsec) / 1000UL;
+}
+
+static std::string escape(const std::string& str)
+{
+  std::string ret;
+  for (char c : str) {
+    if (c == '"' or c == '\\') {
+      ret += '\\';
+      ret += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      ret += code;
+    } else {
+      ret += c;
+    }
+  }
+  return ret;
+}
+
+// Appends the event to the trace file. The first writer opens the array, the closing bracket is optional in the format.
+static void write_event(const std::string& event)
+{
+  static int fd = open(get_path(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    return;
+  }
+
+  // Every process of the build appends to the same file
+  std::string line = event + ",\n";
+  flock(fd, LOCK_EX);
+  struct stat st = {};
+  if (fstat(fd, &st) == 0 and st.st_size == 0) {
+    line = "[\n" + line;
+  }
+  if (write(fd, line.data(), line.size()) < 0) {
+    perror("Error writing trace");
+  }
+  flock(fd, LOCK_UN);
+}
+
+static std::string get_ids()
+{
+  return "\"pid\":" + std::to_string(getpid()) + ",\"tid\":" + std::to_string(syscall(SYS_gettid));
+}
+
+bool swarm::trace::is_enabled()
+{
+  return get_path() != nullptr;
+}
+
+void swarm::trace::set_process_name(const std::string& name)
+{
+  if (is_enabled()) {
+    write_event("{\"name\":\"process_name\",\"ph\":\"M\"," + get_ids() + ",\"args\":{\"name\":\"" + escape(name) +
+                "\"}}");
+  }
+}
+
+swarm::trace::span::span(const char* name_) : name(name_)
+{
+  if (is_enabled()) {
+    begin_us = get_time_us();
+  }
+}
+
+swarm::trace::span::~span()
+{
+  end();
+}
+
+void swarm::trace::span::end()
+{
+  if (ended or not is_enabled()) {
+    return;
+  }
+  ended = true;
+
+  uint64_t end_us = get_time_us();
+  write_event(std::string("{\"name\":\"") + name + "\",\"cat\":\"swarm\",\"ph\":\"X\",\"ts\":" +
+              std::to_string(begin_us) + ",\"dur\":" + std::to_string(end_us - begin_us) + "," + get_ids() +
+              ",\"args\":{" + args + "}}");
+}
+
+void swarm::trace::span::set(const char* key, const std::string& value)
+{
+  if (is_enabled()) {
+    args += std::string(args.empty() ? "" : ",") + "\"" + key + "\":\"" + escape(value) + "\"";
+  }
+}
+
+void swarm::trace::span::set(const char* key, uint64_t value)
+{
+  if (is_enabled()) {
+    args += std::string(args.empty() ? "" : ",") + "\"" + key + "\":" + std::to_string(value);
+  }
+}
@@ -0,0 +1,61 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_TRACE_H
+#define SWARM_TRACE_H
+
+#include <cstdint>
+#include <string>
+
+namespace swarm {
+namespace trace {
+
+// Tracing is enabled by SWARM_TRACE with the path of a trace file shared by every process of the build. The events are
+// appended in the Chrome trace JSON array format, which chrome://tracing and Perfetto open as a timeline.
+bool is_enabled();
+
+// Names the calling process in the timeline
+void set_process_name(const std::string& name);
+
+// Phase of the calling thread from its construction until it goes out of scope, the timestamps are monotonic and
+// shared by every process of the host. Does nothing if tracing is disabled.
+class span
+{
+private:
+  const char* name;
+  uint64_t    begin_us = 0;
+  bool        ended    = false;
+  std::string args; ///< JSON members of the event arguments
+
+public:
+  explicit span(const char* name_);
+  ~span();
+
+  span(const span&) = delete;
+  span& operator=(const span&) = delete;
+
+  void set(const char* key, const std::string& value);
+  void set(const char* key, uint64_t value);
+
+  // Ends the phase before going out of scope
+  void end();
+};
+
+} // namespace trace
+} // namespace swarm
+
+#endif // SWARM_TRACE_H
@@ -0,0 +1,399 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "worker.h"
+#include "compress.h"
+#include "ssh.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+static void put_u32(uint32_t value, std::vector<char>& buffer)
+{
+  for (int i = 0; i < 4; i++) {
+    buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+uint32_t swarm::worker::decode_u32(const char* data)
+{
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+  }
+  return value;
+}
+
+void swarm::worker::encode(frame_type_t       type,
+                           uint32_t           job_id,
+                           const char*        data,
+                           std::size_t        nbytes,
+                           std::vector<char>& buffer)
+{
+  buffer.push_back(static_cast<char>(type));
+  put_u32(job_id, buffer);
+  put_u32(static_cast<uint32_t>(nbytes), buffer);
+  buffer.insert(buffer.end(), data, data + nbytes);
+}
+
+void swarm::worker::encode_u32(frame_type_t type, uint32_t job_id, uint32_t value, std::vector<char>& buffer)
+{
+  std::vector<char> payload;
+  put_u32(value, payload);
+  encode(type, job_id, payload.data(), payload.size(), buffer);
+}
+
+void swarm::worker::decoder::append(const char* data, std::size_t nbytes)
+{
+  // Drop the consumed bytes before growing the buffer
+  if (offset > 0 and offset >= buffer.size() / 2) {
+    buffer.erase(buffer.begin(), buffer.begin() + offset);
+    offset = 0;
+  }
+  buffer.insert(buffer.end(), data, data + nbytes);
+}
+
+bool swarm::worker::decoder::pop(frame_t& frame)
+{
+  if (corrupt or buffer.size() - offset < frame_header_size) {
+    return false;
+  }
+
+  const char* header = buffer.data() + offset;
+  uint32_t    length = decode_u32(header + 5);
+  if (length > SWARM_WORKER_MAX_FRAME_SZ) {
+    corrupt = true;
+    return false;
+  }
+
+  if (buffer.size() - offset < frame_header_size + length) {
+    return false;
+  }
+
+  frame.type   = static_cast<frame_type_t>(header[0]);
+  frame.job_id = decode_u32(header + 1);
+  frame.payload.assign(header + frame_header_size, header + frame_header_size + length);
+  offset += frame_header_size + length;
+
+  return true;
+}
+
+static bool write_all(int fd, const char* buffer, std::size_t nbytes)
+{
+  while (nbytes > 0) {
+    ssize_t n = write(fd, buffer, nbytes);
+    if (n < 0 and errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buffer += n;
+    nbytes -= n;
+  }
+  return true;
+}
+
+// A thread runs the worker stream and hands the received frames over to the threads waiting for their jobs
+class client_impl : public swarm::worker::client
+{
+private:
+  struct job_t {
+    std::deque<swarm::worker::frame_t> frames;
+  };
+
+  std::string             hostname;
+  swarm::ssh::session_ptr session = nullptr;
+  swarm::ssh::stream_ptr  stream  = nullptr;
+  std::thread             thread;
+  swarm::worker::decoder  decoder;
+
+  // State shared with the job threads
+  std::mutex                 mutex;
+  std::condition_variable    cvar;
+  std::map<uint32_t, job_t*> jobs;
+  uint32_t                   next_job_id = 1;
+  bool                       ready       = false;
+  bool                       alive       = true;
+
+  static std::string get_command()
+  {
+    std::string command = SWARM_WORKER_COMMAND;
+
+    const char* slots_c = getenv(SWARM_ENV_VAR_WORKER_SLOTS);
+    if (slots_c != nullptr) {
+      command += " -j " + std::to_string(std::max(1, std::atoi(slots_c)));
+    }
+
+    return "exec " + command;
+  }
+
+  void dispatch(swarm::worker::frame_t& frame)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (frame.type == swarm::worker::FRAME_HELLO) {
+      ready = frame.payload.size() >= 4 and
+              swarm::worker::decode_u32(frame.payload.data()) == SWARM_WORKER_PROTOCOL_VERSION;
+      if (not ready) {
+        fprintf(stderr, "Error. The worker in '%s' speaks another protocol version\n", hostname.c_str());
+        stream->stop();
+      }
+      cvar.notify_all();
+      return;
+    }
+
+    // The frames of abandoned jobs are dropped
+    auto it = jobs.find(frame.job_id);
+    if (it != jobs.end()) {
+      it->second->frames.emplace_back(std::move(frame));
+      cvar.notify_all();
+    }
+  }
+
+  void run()
+  {
+    stream->run([this](const char* data, std::size_t nbytes) {
+      decoder.append(data, nbytes);
+
+      swarm::worker::frame_t frame;
+      while (decoder.pop(frame)) {
+        dispatch(frame);
+      }
+
+      if (decoder.is_corrupt()) {
+        fprintf(stderr, "Error. Corrupt stream from the worker in '%s'\n", hostname.c_str());
+        stream->stop();
+      }
+    });
+
+    // Wake up every job, their frames will never come
+    std::unique_lock<std::mutex> lock(mutex);
+    alive = false;
+    cvar.notify_all();
+  }
+
+  // Sends the command and its input, the end of the input is always sent so the worker never waits for it
+  bool send_input(uint32_t job_id, const std::string& command, int stdin_fd, swarm::compress::stream* compressor)
+  {
+    std::vector<char> buffer;
+    swarm::worker::encode(swarm::worker::FRAME_SUBMIT, job_id, command.data(), command.size(), buffer);
+
+    bool input_ok = true;
+    if (stdin_fd >= 0) {
+      std::vector<char> input(SWARM_WORKER_CHUNK_SZ);
+      std::vector<char> chunk;
+      while (true) {
+        ssize_t n = read(stdin_fd, input.data(), input.size());
+        if (n < 0 and errno == EINTR) {
+          continue;
+        }
+        if (n < 0) {
+          fprintf(stderr, "Error reading job input: %s\n", strerror(errno));
+          input_ok = false;
+          break;
+        }
+
+        chunk.clear();
+        if (compressor == nullptr) {
+          chunk.assign(input.data(), input.data() + n);
+        } else if (n > 0) {
+          compressor->process(input.data(), n, chunk);
+        } else {
+          compressor->finish(chunk);
+        }
+
+        if (not chunk.empty()) {
+          swarm::worker::encode(swarm::worker::FRAME_INPUT, job_id, chunk.data(), chunk.size(), buffer);
+        }
+
+        if (n == 0) {
+          break;
+        }
+
+        if (not stream->write(buffer.data(), buffer.size())) {
+          return false;
+        }
+        buffer.clear();
+      }
+    }
+
+    swarm::worker::encode(swarm::worker::FRAME_INPUT_END, job_id, nullptr, 0, buffer);
+    return stream->write(buffer.data(), buffer.size()) and input_ok;
+  }
+
+  // Forwards the job output until its exit status arrives
+  int wait_status(job_t& job, int stdout_fd, int stderr_fd, swarm::compress::stream* decompressor)
+  {
+    bool              write_error  = false;
+    bool              decode_error = false;
+    std::vector<char> decompressed;
+
+    while (true) {
+      swarm::worker::frame_t frame;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cvar.wait(lock, [this, &job]() { return not job.frames.empty() or not alive; });
+        if (job.frames.empty()) {
+          return swarm::ssh::transport_error;
+        }
+        frame = std::move(job.frames.front());
+        job.frames.pop_front();
+      }
+
+      const char* data   = frame.payload.data();
+      std::size_t nbytes = frame.payload.size();
+      switch (frame.type) {
+        case swarm::worker::FRAME_STDOUT:
+          if (decompressor != nullptr) {
+            decompressed.clear();
+            decode_error = decode_error or not decompressor->process(data, nbytes, decompressed);
+            data         = decompressed.data();
+            nbytes       = decompressed.size();
+          }
+          write_error = write_error or not write_all(stdout_fd, data, nbytes);
+          break;
+        case swarm::worker::FRAME_STDERR:
+          write_error = write_error or not write_all(stderr_fd, data, nbytes);
+          break;
+        case swarm::worker::FRAME_STATUS: {
+          if (write_error or nbytes < 4) {
+            return swarm::ssh::transport_error;
+          }
+          if (decode_error) {
+            fprintf(stderr, "Error. Corrupted compressed output from the worker in '%s'\n", hostname.c_str());
+            return swarm::ssh::transport_error;
+          }
+
+          // A truncated compressed output is a failure even if the remote command succeeded
+          int status = static_cast<int32_t>(swarm::worker::decode_u32(data));
+          decompressed.clear();
+          if (status == 0 and decompressor != nullptr and not decompressor->finish(decompressed)) {
+            fprintf(stderr, "Error. Truncated compressed output from the worker in '%s'\n", hostname.c_str());
+            return swarm::ssh::transport_error;
+          }
+          return status;
+        }
+        default:
+          break;
+      }
+    }
+  }
+
+public:
+  explicit client_impl(const std::string& hostname_) : hostname(hostname_) {}
+
+  ~client_impl()
+  {
+    if (stream != nullptr) {
+      stream->stop();
+    }
+    if (thread.joinable()) {
+      thread.join();
+    }
+
+    // The stream belongs to the session
+    stream  = nullptr;
+    session = nullptr;
+  }
+
+  // Starts the worker and waits for it to be ready
+  bool start()
+  {
+    session = swarm::ssh::make_session(hostname);
+    if (session == nullptr) {
+      return false;
+    }
+
+    stream = session->make_stream(get_command());
+    if (stream == nullptr) {
+      return false;
+    }
+
+    thread = std::thread(&client_impl::run, this);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cvar.wait_for(lock, std::chrono::milliseconds(SWARM_WORKER_START_TIMEOUT_MS), [this]() {
+      return ready or not alive;
+    });
+    return ready and alive;
+  }
+
+  std::string get_hostname() const override { return hostname; }
+
+  int execute(const std::string& command, int stdin_fd, int stdout_fd, int stderr_fd, int compression_level) override
+  {
+    // Optional compression stages
+    swarm::compress::stream::ptr compressor   = nullptr;
+    swarm::compress::stream::ptr decompressor = nullptr;
+    if (compression_level > 0) {
+      compressor   = swarm::compress::stream::make_compressor(compression_level);
+      decompressor = swarm::compress::stream::make_decompressor();
+      SWARM_ASSERT(compressor != nullptr and decompressor != nullptr, "Compression is not supported in this build");
+    }
+
+    job_t    job    = {};
+    uint32_t job_id = 0;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (not alive) {
+        return swarm::ssh::transport_error;
+      }
+      job_id       = next_job_id++;
+      jobs[job_id] = &job;
+    }
+
+    int status = swarm::ssh::transport_error;
+    if (send_input(job_id, command, stdin_fd, compressor.get())) {
+      status = wait_status(job, stdout_fd, stderr_fd, decompressor.get());
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    jobs.erase(job_id);
+
+    return status;
+  }
+
+  bool is_alive() override
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    return alive;
+  }
+};
+
+bool swarm::worker::client::is_enabled()
+{
+  const char* worker_c = getenv(SWARM_ENV_VAR_WORKER);
+
+  return worker_c == nullptr or std::string(worker_c) != "0";
+}
+
+swarm::worker::client::ptr swarm::worker::client::make(const std::string& hostname)
+{
+  std::shared_ptr<client_impl> worker = std::make_shared<client_impl>(hostname);
+
+  return worker->start() ? worker : nullptr;
+}
@@ -0,0 +1,108 @@
+/**
+ * This file is part of the swarm project
+ *
+ * Copyright (c) 2021 by Xavier Arteaga
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef SWARM_WORKER_H
+#define SWARM_WORKER_H
+
+#include "config.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace swarm {
+namespace worker {
+
+// Frames exchanged with swarm-worker through the standard input and output of a single channel. Every frame starts
+// with its type, the job identifier and the payload length, the integers in little endian.
+enum frame_type_t : uint8_t {
+  FRAME_HELLO     = 0, ///< Worker ready, the payload is the protocol version
+  FRAME_SUBMIT    = 1, ///< New job, the payload is the shell command
+  FRAME_INPUT     = 2, ///< Chunk of the job standard input
+  FRAME_INPUT_END = 3, ///< End of the job standard input
+  FRAME_STDOUT    = 4, ///< Chunk of the job standard output
+  FRAME_STDERR    = 5, ///< Chunk of the job standard error
+  FRAME_STATUS    = 6, ///< Job finished, the payload is the exit status or ssh::transport_error if it never started
+};
+
+static const std::size_t frame_header_size = 9;
+
+struct frame_t {
+  frame_type_t      type;
+  uint32_t          job_id;
+  std::vector<char> payload;
+};
+
+// Appends the frame to the buffer
+void encode(frame_type_t type, uint32_t job_id, const char* data, std::size_t nbytes, std::vector<char>& buffer);
+
+// Appends a frame whose payload is a single integer
+void encode_u32(frame_type_t type, uint32_t job_id, uint32_t value, std::vector<char>& buffer);
+
+uint32_t decode_u32(const char* data);
+
+// Splits a byte stream into frames
+class decoder
+{
+private:
+  std::vector<char> buffer;
+  std::size_t       offset  = 0;
+  bool              corrupt = false;
+
+public:
+  void append(const char* data, std::size_t nbytes);
+
+  // Takes the next complete frame, returns false if there is none
+  bool pop(frame_t& frame);
+
+  // A frame larger than SWARM_WORKER_MAX_FRAME_SZ means the stream is out of sync
+  bool is_corrupt() const { return corrupt; }
+};
+
+// Connection to the swarm-worker of a host, several jobs run concurrently through it
+class client
+{
+public:
+  virtual ~client() = default;
+
+  virtual std::string get_hostname() const = 0;
+
+  // Runs the command in the worker streaming stdin_fd into it, unless it is negative, and forwarding its output,
+  // thread-safe. A non-zero compression level compresses the input and decompresses the standard output. Returns the
+  // command exit status or ssh::transport_error if the worker failed.
+  virtual int execute(const std::string& command,
+                      int                stdin_fd,
+                      int                stdout_fd,
+                      int                stderr_fd,
+                      int                compression_level = 0) = 0;
+
+  // False once the connection failed, the worker is then useless
+  virtual bool is_alive() = 0;
+
+  typedef std::shared_ptr<client> ptr;
+
+  // Workers are used unless SWARM_WORKER is 0
+  static bool is_enabled();
+
+  // Connects to the host and starts its worker, returns nullptr if the host is not reachable or has no worker
+  static ptr make(const std::string& hostname);
+};
+
+} // namespace worker
+} // namespace swarm
+
+#endif // SWARM_WORKER_H